@@ -0,0 +1,371 @@
+/* bench_kernels.c
+ * Micro- and macro-benchmarks for the fixed-point tracing kernels, with the
+ * results written as JSON so runs on two revisions of trace_path.c can be
+ * diffed.
+ *
+ * Microbenchmarks run each kernel over fixed inputs taken from the frame:
+ *   - mul, div_fp, inv_sqrt_fp, vec_norm: operands from a seeded generator;
+ *   - intersect_sphere, intersect_plane: primary rays against every primitive;
+ *   - intersect_scene: the primary rays plus the first bounce ray of every
+ *     pixel that hits something;
+ *   - occluded: the shadow rays of the first sample of every pixel.
+ * Each reports the best-of-REPEATS ns per call and a checksum of the results.
+ * The checksum only changes when a kernel's output changes, so a speedup
+ * that also moves the checksum is not a like-for-like comparison.
+ *
+ * The frame benchmark renders the whole image with trace_path on one thread
+ * and with render_frame on -t threads, and reports rays (intersect_scene
+ * plus occluded calls) and samples per second.
+ *
+ * Build:
+ *     gcc -std=c99 -O2 -pthread bench_kernels.c render.c scene.c trace_path.c -o bench_kernels -lm
+ * Run:
+ *     ./bench_kernels [-t threads] [-s scene] [-r revision] [-o results.json]
+ *         -t  threads for the multithreaded frame (default: every online core)
+ *         -s  load a scene file instead of the built-in Cornell box
+ *         -r  revision label stored in the JSON (e.g. `git rev-parse --short HEAD`)
+ *         -o  write the JSON here instead of stdout
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace_path.h"
+#include "render.h"
+#include "scene.h"
+
+#define REPEATS 5
+#define MIN_SECONDS 0.05        // each repeat runs the input set at least this long
+#define NUM_OPERANDS 4096
+#define NUM_PRIMITIVE_RAYS 1024 // rays tested against every sphere and plane
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Fixed inputs, built once by build_inputs()
+static int32_t s_a[NUM_OPERANDS], s_b[NUM_OPERANDS];
+static Vec3 s_vec[NUM_OPERANDS];
+static Ray *s_rays;             // primary rays, then first bounce rays
+static int s_num_primary, s_num_rays;
+static Ray *s_shadow_rays;
+static int32_t *s_shadow_max_t;
+static int s_num_shadow;
+
+static volatile uint32_t g_sink;
+
+// Deterministic operand generator; the inputs must not depend on the tree
+static uint32_t lcg(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static int build_inputs(void)
+{
+    uint32_t state = 12345;
+    for (int i = 0; i < NUM_OPERANDS; ++i) {
+        // mul / div_fp: 4.12 values in (-8, 8), as the kernel mostly sees
+        s_a[i] = (int32_t)(lcg(&state) & 0xFFFF) - 0x8000;
+        s_b[i] = (int32_t)(lcg(&state) & 0xFFFF) - 0x8000;
+        // vec_norm: components of up to +-2, like unnormalised directions
+        s_vec[i] = (Vec3){(fp_t)((lcg(&state) & 0x3FFF) - 0x2000),
+                          (fp_t)((lcg(&state) & 0x3FFF) - 0x2000),
+                          (fp_t)((lcg(&state) & 0x3FFF) - 0x2000)};
+    }
+
+    s_rays = malloc(2 * g_width * g_height * sizeof(*s_rays));
+    s_shadow_rays = malloc(MAX_BOUNCES * g_width * g_height * sizeof(*s_shadow_rays));
+    s_shadow_max_t = malloc(MAX_BOUNCES * g_width * g_height * sizeof(*s_shadow_max_t));
+    if (!s_rays || !s_shadow_rays || !s_shadow_max_t) return -1;
+
+    for (int y = 0; y < g_height; ++y)
+        for (int x = 0; x < g_width; ++x)
+            s_rays[s_num_rays++] = camera_ray(x, y);
+    s_num_primary = s_num_rays;
+
+    // Follow sample 0 of every pixel as trace_path does, keeping its first
+    // bounce ray and every shadow ray
+    for (int y = 0; y < g_height; ++y)
+        for (int x = 0; x < g_width; ++x) {
+            PathKey key = rand_path_key(x, y, 0);
+            PathState ps = {camera_ray(x, y), {F(0), F(0), F(0)}, {ONE, ONE, ONE}};
+            for (int b = 0; b < MAX_BOUNCES; ++b) {
+                BounceState bs;
+                if (!path_hit(&ps, intersect_scene(ps.ray), b, key, &bs))
+                    break;
+                s_shadow_rays[s_num_shadow] = bs.shadow_ray;
+                s_shadow_max_t[s_num_shadow++] = bs.light_dist;
+                if (!path_bounce(&ps, &bs, occluded(bs.shadow_ray, bs.light_dist), b, key))
+                    break;
+                if (b == 0) s_rays[s_num_rays++] = ps.ray;
+            }
+        }
+    return 0;
+}
+
+// Kernel bodies. Each runs once over its input set and returns a checksum.
+static uint32_t run_mul(void)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < NUM_OPERANDS; ++i)
+        sum = sum * 31 + (uint32_t)mul(s_a[i], s_b[i]);
+    return sum;
+}
+
+static uint32_t run_div_fp(void)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < NUM_OPERANDS; ++i)
+        sum = sum * 31 + (uint32_t)div_fp(s_a[i], s_b[i]);
+    return sum;
+}
+
+static uint32_t run_inv_sqrt_fp(void)
+{
+    uint32_t sum = 0;
+    // Lengths around 1 and sphere discriminants up to ~2^20
+    for (int i = 0; i < NUM_OPERANDS; ++i)
+        sum = sum * 31 + (uint32_t)inv_sqrt_fp(1 + (((uint32_t)s_a[i] * 2654435761u) >> 12));
+    return sum;
+}
+
+static uint32_t run_vec_norm(void)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < NUM_OPERANDS; ++i) {
+        Vec3 n = vec_norm(s_vec[i]);
+        sum = sum * 31 + (uint32_t)(n.x ^ (n.y << 8) ^ (n.z << 16));
+    }
+    return sum;
+}
+
+static uint32_t run_intersect_sphere(void)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < NUM_PRIMITIVE_RAYS; ++i) {
+        Ray r = s_rays[i * (s_num_primary / NUM_PRIMITIVE_RAYS)];
+        for (int j = 0; j < g_num_spheres; ++j)
+            sum = sum * 31 + (uint32_t)intersect_sphere(r, g_spheres[j]);
+    }
+    return sum;
+}
+
+static uint32_t run_intersect_plane(void)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < NUM_PRIMITIVE_RAYS; ++i) {
+        Ray r = s_rays[i * (s_num_primary / NUM_PRIMITIVE_RAYS)];
+        for (int j = 0; j < g_num_planes; ++j)
+            sum = sum * 31 + (uint32_t)intersect_plane(r, g_planes[j]);
+    }
+    return sum;
+}
+
+static uint32_t run_intersect_scene(void)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < s_num_rays; ++i) {
+        Intersection h = intersect_scene(s_rays[i]);
+        sum = sum * 31 + (uint32_t)(h.hit ? h.t ^ (h.hit_type << 24) ^ (h.hit_index << 16) : -1);
+    }
+    return sum;
+}
+
+static uint32_t run_occluded(void)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < s_num_shadow; ++i)
+        sum = sum * 31 + (uint32_t)occluded(s_shadow_rays[i], s_shadow_max_t[i]);
+    return sum;
+}
+
+typedef struct {
+    const char *name;
+    uint32_t (*run)(void);
+    long calls;         // kernel calls per run(), set in main
+} MicroBench;
+
+typedef struct {
+    double ns_per_call;
+    uint32_t checksum;
+} MicroResult;
+
+// Best-of-REPEATS ns per call; each repeat calls run() until MIN_SECONDS pass
+static MicroResult time_micro(const MicroBench *mb)
+{
+    MicroResult res = { 1e30, 0 };
+    for (int r = 0; r < REPEATS; ++r) {
+        long runs = 0;
+        double t0 = now(), t;
+        do {
+            res.checksum = mb->run();
+            ++runs;
+        } while ((t = now() - t0) < MIN_SECONDS);
+        g_sink = res.checksum;
+        double ns = t / ((double)runs * mb->calls) * 1e9;
+        if (ns < res.ns_per_call) res.ns_per_call = ns;
+    }
+    return res;
+}
+
+typedef struct {
+    int threads;
+    double seconds;     // best of REPEATS
+    uint32_t checksum;  // of the image
+} FrameResult;
+
+static uint32_t image_checksum(const Color *fb)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < g_width * g_height; ++i)
+        sum = sum * 31 + (uint32_t)(fb[i].r | fb[i].g << 8 | fb[i].b << 16);
+    return sum;
+}
+
+// threads == 1 calls trace_path directly, so pool overhead is not included
+static int time_frame(Color *fb, int threads, FrameResult *res)
+{
+    res->threads = threads;
+    res->seconds = 1e30;
+    for (int r = 0; r < REPEATS; ++r) {
+        double t0 = now();
+        if (threads == 1) {
+            for (int y = 0; y < g_height; ++y)
+                for (int x = 0; x < g_width; ++x)
+                    fb[y * g_width + x] = trace_path(x, y);
+        } else if (render_frame(fb, threads, trace_path) != 0) {
+            return -1;
+        }
+        double t = now() - t0;
+        if (t < res->seconds) res->seconds = t;
+    }
+    res->checksum = image_checksum(fb);
+    return 0;
+}
+
+// Rays one frame of trace_path casts: intersect_scene and occluded
+// calls, counted by walking the same path stages
+static long count_frame_rays(void)
+{
+    long rays = 0;
+    for (int y = 0; y < g_height; ++y)
+        for (int x = 0; x < g_width; ++x) {
+            Ray cam = camera_ray(x, y);
+            for (int sample = 0; sample < NUM_SAMPLES; ++sample) {
+                PathKey key = rand_path_key(x, y, sample);
+                PathState ps = {cam, {F(0), F(0), F(0)}, {ONE, ONE, ONE}};
+                for (int b = 0; b < MAX_BOUNCES; ++b) {
+                    BounceState bs;
+                    ++rays;
+                    if (!path_hit(&ps, intersect_scene(ps.ray), b, key, &bs))
+                        break;
+                    ++rays;
+                    if (!path_bounce(&ps, &bs, occluded(bs.shadow_ray, bs.light_dist), b, key))
+                        break;
+                }
+            }
+        }
+    return rays;
+}
+
+static void write_frame_json(FILE *fp, const char *key, const FrameResult *f, long rays, int last)
+{
+    const long samples = (long)g_width * g_height * NUM_SAMPLES;
+    fprintf(fp, "    \"%s\": {\"threads\": %d, \"seconds\": %.6f, \"rays_per_second\": %.0f, "
+                "\"samples_per_second\": %.0f, \"checksum\": \"%08x\"}%s\n",
+            key, f->threads, f->seconds, rays / f->seconds, samples / f->seconds,
+            f->checksum, last ? "" : ",");
+}
+
+int main(int argc, char **argv)
+{
+    int threads = 0;
+    const char *revision = "", *out_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:s:r:o:")) != -1) {
+        switch (opt) {
+        case 't': threads = atoi(optarg); break;
+        case 'r': revision = optarg; break;
+        case 'o': out_path = optarg; break;
+        case 's':
+#ifdef COMPILED_SCENE
+            fprintf(stderr, "%s: built with a compiled scene, -s is not available\n", argv[0]);
+            return 1;
+#else
+            if (scene_load(optarg) != 0) return 1;
+            break;
+#endif
+        default:
+            fprintf(stderr, "usage: %s [-t threads] [-s scene] [-r revision] [-o results.json]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (threads <= 0) threads = render_default_threads();
+
+    Color *fb = malloc(g_width * g_height * sizeof(*fb));
+    if (!fb || build_inputs() != 0) { perror("malloc"); return 1; }
+
+    MicroBench micro[] = {
+        { "mul",              run_mul,              NUM_OPERANDS },
+        { "div_fp",           run_div_fp,           NUM_OPERANDS },
+        { "inv_sqrt_fp",      run_inv_sqrt_fp,      NUM_OPERANDS },
+        { "vec_norm",         run_vec_norm,         NUM_OPERANDS },
+        { "intersect_sphere", run_intersect_sphere, (long)NUM_PRIMITIVE_RAYS * g_num_spheres },
+        { "intersect_plane",  run_intersect_plane,  (long)NUM_PRIMITIVE_RAYS * g_num_planes },
+        { "intersect_scene",  run_intersect_scene,  s_num_rays },
+        { "occluded",         run_occluded,           s_num_shadow },
+    };
+    const int num_micro = sizeof(micro) / sizeof(micro[0]);
+    MicroResult micro_res[sizeof(micro) / sizeof(micro[0])];
+
+    for (int i = 0; i < num_micro; ++i) {
+        if (micro[i].calls == 0) {      // e.g. a scene without spheres
+            micro_res[i] = (MicroResult){ 0, 0 };
+            continue;
+        }
+        micro_res[i] = time_micro(&micro[i]);
+        fprintf(stderr, "%-17s %9.2f ns\n", micro[i].name, micro_res[i].ns_per_call);
+    }
+
+    long rays = count_frame_rays();
+    FrameResult single, multi;
+    if (time_frame(fb, 1, &single) != 0 || time_frame(fb, threads, &multi) != 0) {
+        fprintf(stderr, "render_frame failed\n");
+        free(fb);
+        return 1;
+    }
+    fprintf(stderr, "frame, 1 thread   %9.3f s\nframe, %2d threads %9.3f s\n",
+            single.seconds, threads, multi.seconds);
+    free(fb);
+
+    FILE *fp = out_path ? fopen(out_path, "w") : stdout;
+    if (!fp) { perror(out_path); return 1; }
+
+    fprintf(fp, "{\n  \"revision\": \"%s\",\n", revision);
+    fprintf(fp, "  \"config\": {\"width\": %d, \"height\": %d, \"num_samples\": %d, \"max_bounces\": %d, "
+                "\"spheres\": %d, \"planes\": %d, \"repeats\": %d},\n",
+            g_width, g_height, NUM_SAMPLES, MAX_BOUNCES, g_num_spheres, g_num_planes, REPEATS);
+    fprintf(fp, "  \"micro\": {\n");
+    for (int i = 0; i < num_micro; ++i)
+        fprintf(fp, "    \"%s\": {\"calls\": %ld, \"ns_per_call\": %.3f, \"checksum\": \"%08x\"}%s\n",
+                micro[i].name, micro[i].calls, micro_res[i].ns_per_call, micro_res[i].checksum,
+                i + 1 < num_micro ? "," : "");
+    fprintf(fp, "  },\n  \"frame\": {\n    \"rays\": %ld,\n    \"samples\": %ld,\n",
+            rays, (long)g_width * g_height * NUM_SAMPLES);
+    write_frame_json(fp, "single_thread", &single, rays, 0);
+    write_frame_json(fp, "multi_thread", &multi, rays, 1);
+    fprintf(fp, "  }\n}\n");
+
+    if (out_path && fclose(fp) != 0) { perror(out_path); return 1; }
+    return 0;
+}
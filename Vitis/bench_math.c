@@ -0,0 +1,169 @@
+/* bench_math.c
+ * Compares the integer inv_sqrt_fp() and fixed-point camera_ray() against the
+ * float versions they replaced: accuracy over the whole input range and host
+ * latency per call. The camera is also timed with the float direction and
+ * the kernel's vec_norm, which separates the camera change from the
+ * inv_sqrt one. FPGA resources and latency need a csynth report; these are
+ * host figures only.
+ * Build:
+ *     gcc -std=c99 -O2 bench_math.c scene.c trace_path.c -o bench_math -lm
+ * Run:
+ *     ./bench_math
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "trace_path.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define REPEATS 5
+
+// The float fast inverse square root inv_sqrt_fp() used to be
+static int32_t inv_sqrt_float(int32_t x)
+{
+    if (x <= 0) return 0;
+    float x_f = (float)x / (float)ONE;
+    union { float f; uint32_t i; } u;
+    u.f = x_f;
+    u.i = 0x5f3759df - (u.i >> 1);
+    u.f = u.f * (1.5f - 0.5f * x_f * u.f * u.f);
+    return (int32_t)(u.f * (float)ONE);
+}
+
+// The float camera_ray() direction, before normalisation. Inline: with two
+// callers GCC keeps it out of line, which more than doubles its timing.
+static inline Vec3 camera_dir_float(int16_t x, int16_t y)
+{
+    float fov_rad = FOV * M_PI / 180.0;
+    float fov_scale = tan(fov_rad / 2.0);
+    float sx_ndc = (2.0f * (x) / g_width) - 1.0f;
+    float sy_ndc = 1.0f - (2.0f * (y) / g_height);
+    return (Vec3){F(sx_ndc * fov_scale), F(sy_ndc * fov_scale), F(-1)};
+}
+
+static Ray camera_ray_float(int16_t x, int16_t y)
+{
+    Vec3 d = camera_dir_float(x, y);
+    int32_t len_sq = (int32_t)(((int64_t)d.x * d.x + (int64_t)d.y * d.y + (int64_t)d.z * d.z) >> FRAC_BITS);
+    fp_t s = (fp_t)inv_sqrt_float(len_sq);     // as vec_scale() does
+    Ray r = {{F(0), F(0.8), F(2)}, {0, 0, 0}};
+    r.dir.x = (fp_t)((d.x * s) >> FRAC_BITS);
+    r.dir.y = (fp_t)((d.y * s) >> FRAC_BITS);
+    r.dir.z = (fp_t)((d.z * s) >> FRAC_BITS);
+    return r;
+}
+
+// The float direction, normalised by the kernel's vec_norm as camera_ray does
+static Ray camera_ray_float_dir(int16_t x, int16_t y)
+{
+    Ray r = {{F(0), F(0.8), F(2)}, {0, 0, 0}};
+    r.dir = vec_norm(camera_dir_float(x, y));
+    return r;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct {
+    double max_ulp, mean_ulp;
+} ErrStats;
+
+// Error of f against the exact 1/sqrt in 4.12 ulps, over
+// every input whose result fits 4.12 and keeps at least 6 significant bits:
+// x in [1/64, 4096] in real units
+static ErrStats inv_sqrt_error(int32_t (*f)(int32_t))
+{
+    ErrStats e = { 0, 0 };
+    long n = 0;
+    for (int32_t x = 64; x <= (1 << 24); ++x) {
+        double exact = ONE / sqrt((double)x / ONE);
+        double err = fabs(f(x) - exact);
+        if (err > e.max_ulp) e.max_ulp = err;
+        e.mean_ulp += err;
+        ++n;
+    }
+    e.mean_ulp /= n;
+    return e;
+}
+
+static volatile int32_t g_sink;
+
+// Best-of-REPEATS nanoseconds per call over a sweep of typical inputs
+// (vec_norm lengths around 1 and sphere discriminants up to ~2^20)
+static double inv_sqrt_ns(int32_t (*f)(int32_t))
+{
+    const int calls = 1 << 22;
+    double best = 1e30;
+    for (int r = 0; r < REPEATS; ++r) {
+        int32_t acc = 0;
+        double t0 = now();
+        for (int i = 0; i < calls; ++i)
+            acc += f(1 + ((i * 2654435761u) >> 12));
+        double t = now() - t0;
+        g_sink = acc;
+        if (t < best) best = t;
+    }
+    return best / calls * 1e9;
+}
+
+static double camera_ns(Ray (*f)(int16_t, int16_t))
+{
+    double best = 1e30;
+    for (int r = 0; r < REPEATS; ++r) {
+        int32_t acc = 0;
+        double t0 = now();
+        for (int y = 0; y < g_height; ++y)
+            for (int x = 0; x < g_width; ++x) {
+                Ray ray = f(x, y);
+                acc += ray.dir.x ^ ray.dir.y ^ ray.dir.z;
+            }
+        double t = now() - t0;
+        g_sink = acc;
+        if (t < best) best = t;
+    }
+    return best / (g_width * g_height) * 1e9;
+}
+
+int main(void)
+{
+    ErrStats ef = inv_sqrt_error(inv_sqrt_float);
+    ErrStats ei = inv_sqrt_error(inv_sqrt_fp);
+    printf("inv_sqrt accuracy (every input in [1/64, 4096]):\n");
+    printf("  float   max err %6.2f ulp  mean err %.3f ulp\n", ef.max_ulp, ef.mean_ulp);
+    printf("  integer max err %6.2f ulp  mean err %.3f ulp\n", ei.max_ulp, ei.mean_ulp);
+
+    // Camera: how far the unit directions are from length 1, and how many
+    // pixels changed direction
+    long changed = 0;
+    double max_len_f = 0, max_len_i = 0;
+    for (int y = 0; y < g_height; ++y)
+        for (int x = 0; x < g_width; ++x) {
+            Vec3 a = camera_ray_float(x, y).dir, b = camera_ray(x, y).dir;
+            double la = fabs(sqrt((double)a.x * a.x + (double)a.y * a.y + (double)a.z * a.z) / ONE - 1);
+            double lb = fabs(sqrt((double)b.x * b.x + (double)b.y * b.y + (double)b.z * b.z) / ONE - 1);
+            if (la > max_len_f) max_len_f = la;
+            if (lb > max_len_i) max_len_i = lb;
+            changed += a.x != b.x || a.y != b.y || a.z != b.z;
+        }
+    printf("camera_ray: max | |dir| - 1 | float %.2e, fixed %.2e; %ld of %d directions differ\n",
+           max_len_f, max_len_i, changed, g_width * g_height);
+
+    printf("latency (best of %d):\n", REPEATS);
+    printf("  inv_sqrt   float %6.2f ns  integer %6.2f ns\n", inv_sqrt_ns(inv_sqrt_float), inv_sqrt_ns(inv_sqrt_fp));
+    printf("  camera_ray float %6.2f ns  fixed   %6.2f ns\n", camera_ns(camera_ray_float), camera_ns(camera_ray));
+    printf("  camera_ray, both through vec_norm: float direction %6.2f ns  fixed %6.2f ns\n",
+           camera_ns(camera_ray_float_dir), camera_ns(camera_ray));
+    return 0;
+}
@@ -0,0 +1,280 @@
+/* denoise.c
+ * Feature-guided à-trous denoiser for the host testbench (see denoise.h).
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "denoise.h"
+#include "render.h"
+
+#define NUM_PIXELS (g_width * g_height)
+#define ALBEDO_MIN 1e-3f        // below this a channel is not divided out
+
+typedef struct {
+    DenoiseFrame *d;
+    int samples;
+} TraceCtx;
+
+static float luminance(const float c[3])
+{
+    return 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
+}
+
+static void store_features(DenoiseFrame *d, int i, int16_t x, int16_t y)
+{
+    PixelFeatures f = trace_path_features(x, y);
+    const float s = 1.0f / ONE;
+    d->normal[i][0] = f.normal.x * s;
+    d->normal[i][1] = f.normal.y * s;
+    d->normal[i][2] = f.normal.z * s;
+    d->albedo[i][0] = f.albedo.x * s;
+    d->albedo[i][1] = f.albedo.y * s;
+    d->albedo[i][2] = f.albedo.z * s;
+    d->depth[i] = f.depth == FP_INF ? -1.0f : f.depth * s;
+}
+
+// Each pixel is visited by exactly one worker, so no locking is needed
+static void trace_pixel(int16_t x, int16_t y, void *ctx)
+{
+    TraceCtx *t = (TraceCtx *)ctx;
+    DenoiseFrame *d = t->d;
+    int i = y * g_width + x;
+    double sum[3] = { 0, 0, 0 }, sum_l = 0, sum_l_sq = 0;
+
+    for (int s = 0; s < t->samples; ++s) {
+        int32_t c[3];
+        trace_path_sum(x, y, s, 1, c);
+        float v[3] = { (float)c[0] / ONE, (float)c[1] / ONE, (float)c[2] / ONE };
+        float l = luminance(v);
+        for (int k = 0; k < 3; ++k) sum[k] += v[k];
+        sum_l += l;
+        sum_l_sq += (double)l * l;
+    }
+    int n = t->samples;
+    for (int k = 0; k < 3; ++k) d->color[i][k] = (float)(sum[k] / n);
+    // Sample variance over n, the variance of the mean
+    double spread = sum_l_sq - sum_l * sum_l / n;
+    d->variance[i] = n > 1 && spread > 0 ? (float)(spread / ((double)n * (n - 1))) : 0.0f;
+    store_features(d, i, x, y);
+}
+
+static void feature_pixel(int16_t x, int16_t y, void *ctx)
+{
+    store_features((DenoiseFrame *)ctx, y * g_width + x, x, y);
+}
+
+// Variance of each pixel's luminance from its 3x3 neighbourhood, for colour
+// without samples to measure it from
+static void spatial_variance(DenoiseFrame *d)
+{
+    for (int y = 0; y < g_height; ++y) {
+        for (int x = 0; x < g_width; ++x) {
+            double sum = 0, sum_sq = 0;
+            int n = 0;
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int qx = x + dx, qy = y + dy;
+                    if (qx < 0 || qx >= g_width || qy < 0 || qy >= g_height) continue;
+                    float l = luminance(d->color[qy * g_width + qx]);
+                    sum += l;
+                    sum_sq += (double)l * l;
+                    ++n;
+                }
+            }
+            double spread = sum_sq - sum * sum / n;
+            d->variance[y * g_width + x] = spread > 0 ? (float)(spread / (n - 1)) : 0.0f;
+        }
+    }
+}
+
+int denoise_init(DenoiseFrame *d)
+{
+    d->color = malloc(NUM_PIXELS * sizeof(*d->color));
+    d->variance = malloc(NUM_PIXELS * sizeof(*d->variance));
+    d->normal = malloc(NUM_PIXELS * sizeof(*d->normal));
+    d->albedo = malloc(NUM_PIXELS * sizeof(*d->albedo));
+    d->depth = malloc(NUM_PIXELS * sizeof(*d->depth));
+    if (!d->color || !d->variance || !d->normal || !d->albedo || !d->depth) {
+        denoise_free(d);
+        return -1;
+    }
+    return 0;
+}
+
+void denoise_free(DenoiseFrame *d)
+{
+    free(d->color);
+    free(d->variance);
+    free(d->normal);
+    free(d->albedo);
+    free(d->depth);
+    memset(d, 0, sizeof(*d));
+}
+
+int denoise_trace(DenoiseFrame *d, int num_threads, int samples)
+{
+    TraceCtx t = { d, samples };
+    if (render_pixels(num_threads, trace_pixel, &t) != 0)
+        return -1;
+    if (samples == 1)
+        spatial_variance(d);
+    return 0;
+}
+
+int denoise_load_frame(DenoiseFrame *d, int num_threads, const Color *fb)
+{
+    // Inverse of fp_to_u8, to the middle of each display level
+    const float scale = 1.0f / (255 << BRIGHTNESS_SHIFT);
+    for (int i = 0; i < NUM_PIXELS; ++i) {
+        d->color[i][0] = (fb[i].r + 0.5f) * scale;
+        d->color[i][1] = (fb[i].g + 0.5f) * scale;
+        d->color[i][2] = (fb[i].b + 0.5f) * scale;
+    }
+    spatial_variance(d);
+    return render_pixels(num_threads, feature_pixel, d);
+}
+
+// Colour divided by the albedo (the lighting alone), or as is where the
+// albedo is too dark to divide by
+static float demodulate(float c, float a)
+{
+    return a > ALBEDO_MIN ? c / a : c;
+}
+
+static float remodulate(float c, float a)
+{
+    return a > ALBEDO_MIN ? c * a : c;
+}
+
+int denoise_filter(DenoiseFrame *d)
+{
+    static const float kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+    float (*color)[3] = malloc(NUM_PIXELS * sizeof(*color));
+    float (*next)[3] = malloc(NUM_PIXELS * sizeof(*next));
+    float *var = malloc(NUM_PIXELS * sizeof(*var));
+    float *next_var = malloc(NUM_PIXELS * sizeof(*next_var));
+    float *sigma = malloc(NUM_PIXELS * sizeof(*sigma));
+    float (*grad)[2] = malloc(NUM_PIXELS * sizeof(*grad));
+    int ret = -1;
+    if (!color || !next || !var || !next_var || !sigma || !grad)
+        goto out;
+
+    for (int i = 0; i < NUM_PIXELS; ++i) {
+        float la = luminance(d->albedo[i]);
+        for (int k = 0; k < 3; ++k)
+            color[i][k] = demodulate(d->color[i][k], d->albedo[i][k]);
+        var[i] = la > ALBEDO_MIN ? d->variance[i] / (la * la) : d->variance[i];
+    }
+
+    // Screen-space depth gradient from central differences, for the depth
+    // edge-stop: planes seen at a grazing angle change depth quickly
+    for (int y = 0; y < g_height; ++y) {
+        for (int x = 0; x < g_width; ++x) {
+            const float *z = d->depth;
+            int i = y * g_width + x;
+            int xl = x > 0 ? i - 1 : i, xr = x + 1 < g_width ? i + 1 : i;
+            int yu = y > 0 ? i - g_width : i, yd = y + 1 < g_height ? i + g_width : i;
+            grad[i][0] = z[xl] >= 0 && z[xr] >= 0 && xr != xl ? (z[xr] - z[xl]) / (xr - xl) : 0.0f;
+            grad[i][1] = z[yu] >= 0 && z[yd] >= 0 && yd != yu ? (z[yd] - z[yu]) / ((yd - yu) / g_width) : 0.0f;
+        }
+    }
+
+    for (int it = 0; it < DENOISE_ITERATIONS; ++it) {
+        int step = 1 << it;
+
+        // Brightness edge-stop from the 3x3 blurred variance, steadier than
+        // the pixel's own estimate at a few samples
+        for (int y = 0; y < g_height; ++y) {
+            for (int x = 0; x < g_width; ++x) {
+                float sum = 0, wsum = 0;
+                for (int dy = -1; dy <= 1; ++dy) {
+                    for (int dx = -1; dx <= 1; ++dx) {
+                        int qx = x + dx, qy = y + dy;
+                        if (qx < 0 || qx >= g_width || qy < 0 || qy >= g_height) continue;
+                        float w = kernel[2 + dx] * kernel[2 + dy];
+                        sum += w * var[qy * g_width + qx];
+                        wsum += w;
+                    }
+                }
+                sigma[y * g_width + x] = DENOISE_SIGMA_L * sqrtf(sum / wsum) + 1e-6f;
+            }
+        }
+
+        for (int y = 0; y < g_height; ++y) {
+            for (int x = 0; x < g_width; ++x) {
+                int p = y * g_width + x;
+                if (d->depth[p] < 0) {
+                    memcpy(next[p], color[p], sizeof(next[p]));
+                    next_var[p] = var[p];
+                    continue;
+                }
+                float lp = luminance(color[p]);
+                float sum[3] = { 0, 0, 0 }, sum_var = 0, wsum = 0;
+
+                for (int dy = -2; dy <= 2; ++dy) {
+                    for (int dx = -2; dx <= 2; ++dx) {
+                        int qx = x + dx * step, qy = y + dy * step;
+                        if (qx < 0 || qx >= g_width || qy < 0 || qy >= g_height) continue;
+                        int q = qy * g_width + qx;
+                        if (d->depth[q] < 0) continue;
+
+                        const float *np = d->normal[p], *nq = d->normal[q];
+                        float wn = np[0] * nq[0] + np[1] * nq[1] + np[2] * nq[2];
+                        if (wn <= 0) continue;
+                        for (int k = 0; k < DENOISE_NORMAL_POWER; ++k) wn *= wn;
+
+                        float expected = fabsf(grad[p][0] * dx * step + grad[p][1] * dy * step);
+                        float dz = fabsf(d->depth[p] - d->depth[q]) / (DENOISE_SIGMA_Z * expected + 1e-3f);
+                        float da = fabsf(d->albedo[p][0] - d->albedo[q][0]) + fabsf(d->albedo[p][1] - d->albedo[q][1])
+                                 + fabsf(d->albedo[p][2] - d->albedo[q][2]);
+                        float dl = fabsf(lp - luminance(color[q])) / sigma[p];
+
+                        float w = kernel[2 + dx] * kernel[2 + dy] * wn * expf(-dz - da / DENOISE_SIGMA_A - dl);
+                        for (int k = 0; k < 3; ++k) sum[k] += w * color[q][k];
+                        sum_var += w * w * var[q];
+                        wsum += w;
+                    }
+                }
+                // The centre tap always has weight, so wsum > 0
+                for (int k = 0; k < 3; ++k) next[p][k] = sum[k] / wsum;
+                next_var[p] = sum_var / (wsum * wsum);
+            }
+        }
+
+        float (*tmp)[3] = color; color = next; next = tmp;
+        float *tmp_var = var; var = next_var; next_var = tmp_var;
+    }
+
+    for (int i = 0; i < NUM_PIXELS; ++i) {
+        float la = luminance(d->albedo[i]);
+        for (int k = 0; k < 3; ++k)
+            d->color[i][k] = remodulate(color[i][k], d->albedo[i][k]);
+        d->variance[i] = la > ALBEDO_MIN ? var[i] * la * la : var[i];
+    }
+    ret = 0;
+
+out:
+    free(color);
+    free(next);
+    free(var);
+    free(next_var);
+    free(sigma);
+    free(grad);
+    return ret;
+}
+
+void denoise_resolve(const DenoiseFrame *d, Color *fb)
+{
+    // Same clamp and truncation as fp_to_u8
+    const float scale = 255 << BRIGHTNESS_SHIFT;
+    for (int i = 0; i < NUM_PIXELS; ++i) {
+        uint8_t v[3];
+        for (int k = 0; k < 3; ++k) {
+            float c = d->color[i][k] * scale;
+            v[k] = c >= 255 ? 255 : (c <= 0 ? 0 : (uint8_t)c);
+        }
+        fb[i] = (Color){ v[0], v[1], v[2] };
+    }
+}
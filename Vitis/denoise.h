@@ -0,0 +1,52 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "trace_path.h"
+
+// Host-side denoiser for low sample counts. An edge-avoiding à-trous wavelet
+// filter (Dammertz et al., "Edge-Avoiding À-Trous Wavelet Transform for fast
+// Global Illumination Filtering", HPG 2010) smooths the frame over ever wider
+// footprints. A neighbour's weight falls off with the difference in first-hit
+// normal, depth and albedo (trace_path_features), and with the difference in
+// brightness measured against the pixel's noise level, as in SVGF (Schied et
+// al., HPG 2017). Colour is filtered divided by the albedo, so only the
+// lighting is smoothed and material edges stay sharp.
+
+#define DENOISE_ITERATIONS 5    // footprint of 4 * 2^5 + 1 pixels
+#define DENOISE_SIGMA_L 4.0f    // brightness edge-stop, in standard deviations
+#define DENOISE_SIGMA_Z 1.0f    // depth edge-stop, in units of the depth gradient
+#define DENOISE_SIGMA_A 0.1f    // albedo edge-stop
+#define DENOISE_NORMAL_POWER 5  // normal edge-stop is dot(n_p, n_q)^(2^5)
+
+typedef struct {
+    float (*color)[3];    // g_width * g_height row-major mean path colour, 1.0 = ONE
+    float *variance;      // variance of that mean's luminance
+    float (*normal)[3];
+    float (*albedo)[3];
+    float *depth;         // < 0 where the camera ray escapes
+} DenoiseFrame;
+
+// Allocates the buffers. Returns 0 on success, -1 if out of memory.
+int denoise_init(DenoiseFrame *d);
+void denoise_free(DenoiseFrame *d);
+
+// Traces samples [0, samples) of every pixel (trace_path_sum, one at a time
+// for the variance) and the features. A single sample has no variance of its
+// own; it is then estimated like denoise_load_frame does. Returns 0 on
+// success, -1 on error.
+int denoise_trace(DenoiseFrame *d, int num_threads, int samples);
+
+// Takes the colour from an already tone mapped frame, such as one assembled
+// from the FPGA's UART stream, and traces only the features. Without the
+// samples, each pixel's variance is estimated from its 3x3 neighbourhood.
+// Returns 0 on success, -1 on error.
+int denoise_load_frame(DenoiseFrame *d, int num_threads, const Color *fb);
+
+// Filters d->color (and d->variance) in place. Returns 0 on success, -1 if
+// out of memory.
+int denoise_filter(DenoiseFrame *d);
+
+// Tone maps d->color into fb with the mapping trace_path uses.
+void denoise_resolve(const DenoiseFrame *d, Color *fb);
+
+#endif
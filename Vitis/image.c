@@ -1,64 +1,541 @@
 /* testbench_render.c
  * Build (native C simulation):
- *     gcc -std=c99 -O2 testbench_render.c trace_path.c -o render
+ *     gcc -std=c99 -O2 -mavx2 -pthread image.c render.c packet.c scene.c progressive.c denoise.c output.c trace_path.c -o render -lm
  * Run:
- *     ./render
+ *     ./render [-t threads] [-r WxH] [-p | -a | -S | -C | -P passes [-n samples] [-c checkpoint] | -d [-n samples] | -D frame] [-s scene] [-o file]...
+ *         -t  worker threads (default: every online core)
+ *         -r  frame size (default 256x256, up to MAX_RESOLUTION a side and
+ *             4:1 either way); -D takes the size of its frame
+ *         -s  load a scene file (see scene.h) instead of the built-in Cornell box
+ *         -o  write the frame to this file, .ppm (binary P6) or .pfm (linear
+ *             float, see output.h); repeat for several formats from one
+ *             render (default: render.ppm). The files are written in
+ *             place: a coarse preview (one pixel in PREVIEW_STEP x
+ *             PREVIEW_STEP, see render.h) first, then rows as they finish.
+ *         -p  trace with the SIMD packet path instead of trace_path;
+ *             the image is bit-identical (8-bit outputs only)
+ *         -a  adaptive sampling (trace_path_adaptive); also writes the
+ *             per-pixel sample counts to spp.pgm (8-bit outputs only)
+ *         -S  trace the frame with the streaming kernel (trace_path_stream),
+ *             in scanline order, STREAM_MAX_PIXELS pixels a call, and check
+ *             every pixel against trace_path; exits 1 on any difference
+ *             (8-bit outputs only)
+ *         -C  trace the frame with both trace_path_packet and trace_path and
+ *             check that every pixel is the same; exits 1 on any difference
+ *             (8-bit outputs only)
+ *         -P  progressive: run this many passes of -n samples per pixel
+ *             (default NUM_SAMPLES) into an HDR accumulation buffer,
+ *             rewriting the -o files after every pass
+ *         -c  with -P: resume from this checkpoint if it exists, and save
+ *             it after every pass
+ *         -d  trace -n samples per pixel (default NUM_SAMPLES) and denoise
+ *             them (see denoise.h); 2-4 are enough. The unfiltered frame
+ *             goes to noisy.ppm
+ *         -D  denoise an already assembled frame (P3 or P6 PPM, e.g. from
+ *             the UART client) instead of tracing one
+ * Instrumented build (hot-path counters, see stats.h); also writes stats.json
+ * and the heat_*.ppm per-pixel heatmaps (not for -P, -d or -D):
+ *     gcc -DTRACE_STATS ... (same files as above) stats.c
+ * Compiled scene (see scenec.py; -s is then unavailable):
+ *     python3 scenec.py scenes/cornell.scene -o scene_compiled.h
+ *     gcc -DCOMPILED_SCENE ... (same files as above)
  * View:
  *     display render.ppm     # ImageMagick
  *     gimp render.ppm        # or any PPM‑capable viewer
+ *     pfstoolsview / Photoshop / GIMP open the .pfm
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-//#include "trace_path.h"
+#include "trace_path.h"
+#include "render.h"
+#include "packet.h"
+#include "scene.h"
+#include "progressive.h"
+#include "denoise.h"
+#include "output.h"
+#ifdef TRACE_STATS
+#include "stats.h"
+#endif
 
-typedef struct {
-    uint8_t r, g, b;
-} Color;
+#define MAX_OUTPUTS 8
 
-extern Color trace_path(int x, int y);
+static uint8_t *s_spp;      // per-pixel sample counts for -a
+static float (*s_hdr)[3];   // linear colour of every pixel for the .pfm outputs
+static const char *s_outputs[MAX_OUTPUTS];
+static int s_num_outputs;
 
-/* Copy widths from the kernel */
-#define WIDTH   256
-#define HEIGHT  256
-#define FRAC_BITS 12
-#define ONE (1 << FRAC_BITS)
+// TraceFn for the default tracer: the same pixel as trace_path, keeping the
+// colour from before the 8-bit conversion as well
+static Color trace_hdr(int16_t x, int16_t y)
+{
+    int32_t sum[3];
+    trace_path_sum(x, y, 0, NUM_SAMPLES, sum);
+    for (int k = 0; k < 3; ++k)
+        s_hdr[y * g_width + x][k] = (float)sum[k] / ((float)NUM_SAMPLES * ONE);
+    return resolve_color(sum[0], sum[1], sum[2], NUM_SAMPLES);
+}
 
+// TraceFn wrapper: every pixel is traced exactly once, so the map needs no lock
+static Color trace_adaptive(int16_t x, int16_t y)
+{
+    int n;
+    Color c = trace_path_adaptive(x, y, &n);
+    s_spp[y * g_width + x] = (uint8_t)n;
+    return c;
+}
 
-int main(void)
+static int write_spp(const char *path)
 {
-    FILE *fp = fopen("render.ppm", "w");
-    if (!fp) { perror("render.ppm"); return 1; }
+    FILE *fp = fopen(path, "w");
+    if (!fp) { perror(path); return -1; }
+
+    long total = 0;
+    fprintf(fp, "P2\n%d %d\n%d\n", g_width, g_height, ADAPTIVE_MAX_SAMPLES);
+    for (int y = 0; y < g_height; ++y) {
+        for (int x = 0; x < g_width; ++x) {
+            fprintf(fp, "%d ", s_spp[y * g_width + x]);
+            total += s_spp[y * g_width + x];
+        }
+        fputc('\n', fp);
+    }
+    fclose(fp);
+    printf("Wrote %s (%.2f samples per pixel on average)\n", path, (double)total / (g_width * g_height));
+    return 0;
+}
 
-    /* P3 header: ascii RGB, max value 255 */
-    fprintf(fp, "P3\n%d %d\n255\n", WIDTH, HEIGHT);
+// Writes a finished frame to every -o file
+static int write_outputs(const Color *fb, const float (*hdr)[3])
+{
+    for (int i = 0; i < s_num_outputs; ++i)
+        if (output_write_frame(s_outputs[i], fb, hdr) != 0)
+            return -1;
+    return 0;
+}
 
-    /* Render top‑to‑bottom */
-    for (int y = 0; y < HEIGHT; ++y)
-    {
-        for (int x = 0; x < WIDTH; ++x)
-        {
-            float r = 0;
-            float g = 0;
-            float b = 0;
+static void print_outputs(const char *what)
+{
+    printf("Wrote");
+    for (int i = 0; i < s_num_outputs; ++i)
+        printf("%s %s", i ? "," : "", s_outputs[i]);
+    printf(" (%dx%d%s)\n", g_width, g_height, what);
+}
 
-            #define NUM_SAMPLES 1
-            for (int i=0; i<NUM_SAMPLES; i++) {
-                Color rgb_u8 = trace_path(x, y);
+#ifndef TRACE_STATS
+// Single-frame render that streams every band of rows to the -o files as
+// soon as it is traced. The instrumented build renders through stats_render
+// and writes the frame at the end instead.
+typedef struct {
+    TraceFn trace;
+    Color *fb;
+    OutputFile files[MAX_OUTPUTS];
+} StreamCtx;
 
-                r += (float)(rgb_u8.r) / NUM_SAMPLES;
-                g += (float)(rgb_u8.g) / NUM_SAMPLES;
-                b += (float)(rgb_u8.b) / NUM_SAMPLES;
-            }
+static void stream_pixel(int16_t x, int16_t y, void *ctx)
+{
+    StreamCtx *c = (StreamCtx *)ctx;
+    c->fb[y * g_width + x] = c->trace(x, y);
+}
 
-            fprintf(fp, "%d %d %d  ", (int)r, (int)g, (int)b);
+// Once the coarse pass is in: each of its pixels fills its PREVIEW_STEP
+// square, and the result is written over the whole of every -o file. The
+// fine pass then traces over it, and its bands overwrite it as they finish.
+static void stream_preview(void *ctx)
+{
+    StreamCtx *c = (StreamCtx *)ctx;
+    for (int y = 0; y < g_height; ++y)
+        for (int x = 0; x < g_width; ++x) {
+            int i = y * g_width + x;
+            int src = (y - y % PREVIEW_STEP) * g_width + x - x % PREVIEW_STEP;
+            c->fb[i] = c->fb[src];
+            memcpy(s_hdr[i], s_hdr[src], sizeof(*s_hdr));
         }
-        fputc('\n', fp);
+    for (int i = 0; i < s_num_outputs; ++i)
+        if (output_write_rows(&c->files[i], c->fb, (const float (*)[3])s_hdr, 0, g_height) != 0)
+            return;
+    printf("Preview written (1/%d of the pixels)\n", PREVIEW_STEP * PREVIEW_STEP);
+    fflush(stdout);
+}
+
+static void stream_band(int y0, int y1, void *ctx)
+{
+    StreamCtx *c = (StreamCtx *)ctx;
+    for (int i = 0; i < s_num_outputs; ++i)
+        output_write_rows(&c->files[i], c->fb, (const float (*)[3])s_hdr, y0, y1);
+}
+
+static int render_streamed(Color *fb, int threads, TraceFn trace)
+{
+    StreamCtx c = { .trace = trace, .fb = fb };
+    int opened = 0, ret = 0;
+    for (; opened < s_num_outputs; ++opened)
+        if (output_open(&c.files[opened], s_outputs[opened]) != 0)
+            break;
+    if (opened == s_num_outputs && render_pixels_preview(threads, stream_pixel, stream_preview, stream_band, &c) != 0) {
+        fprintf(stderr, "render_frame failed\n");
+        ret = -1;
+    }
+    if (opened < s_num_outputs)
+        ret = -1;
+    // A failed render still closes the files; their writes are marked failed
+    for (int i = 0; i < opened; ++i) {
+        if (ret != 0) c.files[i].failed = 1;
+        if (output_close(&c.files[i]) != 0) ret = -1;
+    }
+    return ret;
+}
+#endif
+
+// Compares a frame with trace_path's, pixel by pixel; reports the first few
+// differences and returns how many pixels differ
+static int count_mismatches(const Color *fb, const Color *ref, const char *name)
+{
+    int mismatches = 0;
+    for (int i = 0; i < g_width * g_height; ++i) {
+        if (STREAM_COLOR(fb[i]) != STREAM_COLOR(ref[i])) {
+            if (mismatches++ < 10)
+                fprintf(stderr, "pixel (%d, %d): %s %06x, trace_path %06x\n", i % g_width, i / g_width,
+                        name, (unsigned)STREAM_COLOR(fb[i]), (unsigned)STREAM_COLOR(ref[i]));
+        }
+    }
+    if (mismatches)
+        fprintf(stderr, "%s: %d of %d pixels differ from trace_path\n", name, mismatches, g_width * g_height);
+    else
+        printf("%s matches trace_path on all %d pixels\n", name, g_width * g_height);
+    return mismatches;
+}
+
+// -S: the frame through trace_path_stream in scanline order, STREAM_MAX_PIXELS
+// pixels a call, the way the FPGA is fed, checked pixel by pixel against
+// trace_path
+static int run_stream(Color *fb, int threads)
+{
+    uint32_t *coords = malloc(g_width * g_height * sizeof(*coords));
+    uint32_t *colors = malloc(g_width * g_height * sizeof(*colors));
+    Color *ref = malloc(g_width * g_height * sizeof(*ref));
+    int ret = -1;
+    if (!coords || !colors || !ref) { perror("malloc"); goto out; }
+
+    for (int i = 0; i < g_width * g_height; ++i)
+        coords[i] = STREAM_COORD(i % g_width, i / g_width);
+    for (int first = 0; first < g_width * g_height; first += STREAM_MAX_PIXELS) {
+        int count = g_width * g_height - first;
+        trace_path_stream(coords + first, colors + first, count < STREAM_MAX_PIXELS ? count : STREAM_MAX_PIXELS,
+                          g_width, g_height);
+    }
+    for (int i = 0; i < g_width * g_height; ++i)
+        fb[i] = (Color){ colors[i] & 0xFF, (colors[i] >> 8) & 0xFF, (colors[i] >> 16) & 0xFF };
+
+    if (render_frame(ref, threads, trace_path) != 0) { fprintf(stderr, "render_frame failed\n"); goto out; }
+    if (count_mismatches(fb, ref, "trace_path_stream") != 0)
+        goto out;
+    if (write_outputs(fb, NULL) == 0) {
+        print_outputs(", streamed");
+        ret = 0;
+    }
+
+out:
+    free(coords);
+    free(colors);
+    free(ref);
+    return ret;
+}
+
+// -C: the frame through trace_path_packet, checked pixel by pixel against
+// trace_path. Without AVX2 the packet entry points are the scalar kernels,
+// so this only tests something in a -mavx2 build.
+static int run_packet_check(Color *fb, int threads)
+{
+    Color *ref = malloc(g_width * g_height * sizeof(*ref));
+    int ret = -1;
+    if (!ref) { perror("malloc"); return -1; }
+
+    if (render_frame(fb, threads, trace_path_packet) != 0 || render_frame(ref, threads, trace_path) != 0)
+        fprintf(stderr, "render_frame failed\n");
+    else if (count_mismatches(fb, ref, "trace_path_packet") == 0 && write_outputs(fb, NULL) == 0) {
+        print_outputs(", packets");
+        ret = 0;
+    }
+    free(ref);
+    return ret;
+}
+
+// Opens a P3 or P6 PPM and reads its header, up to the first pixel
+static FILE *open_ppm(const char *path, char magic[3], int *w, int *h, int *maxval)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) { perror(path); return NULL; }
+
+    if (fscanf(fp, "%2s %d %d %d", magic, w, h, maxval) != 4 || fgetc(fp) == EOF
+        || (strcmp(magic, "P3") != 0 && strcmp(magic, "P6") != 0)) {
+        fprintf(stderr, "%s: not a PPM\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+// Sets the frame size to a PPM's
+static int resolution_of_ppm(const char *path)
+{
+    char magic[3];
+    int w, h, maxval;
+    FILE *fp = open_ppm(path, magic, &w, &h, &maxval);
+    if (!fp) return -1;
+    fclose(fp);
+    if (set_resolution(w, h) != 0) {
+        fprintf(stderr, "%s: %dx%d is not a size this build renders\n", path, w, h);
+        return -1;
+    }
+    return 0;
+}
+
+// Reads a g_width x g_height, maxval 255 P3 or P6 PPM into fb
+static int read_ppm(const char *path, Color *fb)
+{
+    char magic[3];
+    int w, h, maxval;
+    FILE *fp = open_ppm(path, magic, &w, &h, &maxval);
+    if (!fp) return -1;
+
+    if (w != g_width || h != g_height || maxval != 255) {
+        fprintf(stderr, "%s: %dx%d with maxval %d; expected %dx%d with maxval 255\n",
+                path, w, h, maxval, g_width, g_height);
+        fclose(fp);
+        return -1;
     }
 
+    int ok = 1;
+    for (int i = 0; i < g_width * g_height && ok; ++i) {
+        if (magic[1] == '6') {
+            ok = fread(&fb[i], 3, 1, fp) == 1;
+        } else {
+            int r, g, b;
+            ok = fscanf(fp, "%d %d %d", &r, &g, &b) == 3;
+            fb[i] = (Color){ (uint8_t)r, (uint8_t)g, (uint8_t)b };
+        }
+    }
     fclose(fp);
-    printf("Wrote render.ppm (%dx%d)\n", WIDTH, HEIGHT);
+    if (!ok) {
+        fprintf(stderr, "%s: truncated image\n", path);
+        return -1;
+    }
     return 0;
 }
+
+// -d / -D: fills the denoiser from a traced frame, or from fb if frame is set
+static int run_denoise(Color *fb, int threads, int samples, const char *frame)
+{
+    DenoiseFrame d;
+    if (denoise_init(&d) != 0) { perror("malloc"); return -1; }
+
+    int ret = -1;
+    if (frame) {
+        if (read_ppm(frame, fb) != 0 || denoise_load_frame(&d, threads, fb) != 0)
+            goto out;
+    } else {
+        if (denoise_trace(&d, threads, samples) != 0)
+            goto out;
+        denoise_resolve(&d, fb);
+        if (output_write_frame("noisy.ppm", fb, NULL) != 0)
+            goto out;
+    }
+    if (denoise_filter(&d) != 0) { perror("malloc"); goto out; }
+    denoise_resolve(&d, fb);
+    if (write_outputs(fb, (const float (*)[3])d.color) != 0)
+        goto out;
+    print_outputs(", denoised");
+    ret = 0;
+
+out:
+    denoise_free(&d);
+    return ret;
+}
+
+static int run_progressive(Color *fb, int threads, int passes, int samples, const char *checkpoint)
+{
+    Accum acc;
+    if (accum_init(&acc) != 0) { perror("malloc"); return -1; }
+
+    if (checkpoint && access(checkpoint, F_OK) == 0) {
+        if (accum_load(&acc, checkpoint) != 0) { accum_free(&acc); return -1; }
+        printf("Resuming %s at %u samples per pixel\n", checkpoint, acc.samples);
+    }
+
+    for (int pass = 0; pass < passes; ++pass) {
+        if (accum_pass(&acc, threads, samples) != 0) {
+            fprintf(stderr, "accum_pass failed\n");
+            accum_free(&acc);
+            return -1;
+        }
+        accum_resolve(&acc, fb);
+        accum_resolve_hdr(&acc, s_hdr);
+        if (write_outputs(fb, (const float (*)[3])s_hdr) != 0
+            || (checkpoint && accum_save(&acc, checkpoint) != 0)) {
+            accum_free(&acc);
+            return -1;
+        }
+        printf("Pass %d/%d: %u samples per pixel\n", pass + 1, passes, acc.samples);
+        fflush(stdout);
+    }
+    accum_free(&acc);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int threads = 0;
+    TraceFn trace = trace_path;
+    int passes = 0, pass_samples = NUM_SAMPLES;
+    const char *checkpoint = NULL;
+    int denoise = 0, stream = 0, check = 0;
+    const char *frame = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:r:paSCs:P:n:c:dD:o:")) != -1) {
+        switch (opt) {
+        case 't': threads = atoi(optarg); break;
+        case 'r': {
+            int w, h;
+            if (sscanf(optarg, "%dx%d", &w, &h) != 2 || set_resolution(w, h) != 0) {
+                fprintf(stderr, "%s: -r takes WxH, each side 1-%d and at most 4 times the other\n",
+                        argv[0], MAX_RESOLUTION);
+                return 1;
+            }
+            break;
+        }
+        case 'p': trace = trace_path_packet; break;
+        case 'a': trace = trace_adaptive; break;
+        case 'S': stream = 1; break;
+        case 'C': check = 1; break;
+        case 'P': passes = atoi(optarg); break;
+        case 'n': pass_samples = atoi(optarg); break;
+        case 'c': checkpoint = optarg; break;
+        case 'd': denoise = 1; break;
+        case 'D': denoise = 1; frame = optarg; break;
+        case 'o':
+            if (s_num_outputs == MAX_OUTPUTS) {
+                fprintf(stderr, "%s: at most %d -o files\n", argv[0], MAX_OUTPUTS);
+                return 1;
+            }
+            s_outputs[s_num_outputs++] = optarg;
+            break;
+        case 's':
+#ifdef COMPILED_SCENE
+            fprintf(stderr, "%s: built with a compiled scene, -s is not available\n", argv[0]);
+            return 1;
+#else
+            if (scene_load(optarg) != 0) return 1;
+            break;
+#endif
+        default:
+            fprintf(stderr, "usage: %s [-t threads] [-r WxH] [-p | -a | -S | -C | -P passes [-n samples] [-c checkpoint] | -d [-n samples] | -D frame] [-s scene] [-o file]...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (passes > 0 && trace != trace_path) {
+        fprintf(stderr, "%s: -P cannot be combined with -p or -a\n", argv[0]);
+        return 1;
+    }
+    if (denoise && (passes > 0 || trace != trace_path)) {
+        fprintf(stderr, "%s: -d and -D cannot be combined with -p, -a or -P\n", argv[0]);
+        return 1;
+    }
+    if (stream && (denoise || passes > 0 || trace != trace_path)) {
+        fprintf(stderr, "%s: -S cannot be combined with -p, -a, -P, -d or -D\n", argv[0]);
+        return 1;
+    }
+    if (check && (stream || denoise || passes > 0 || trace != trace_path)) {
+        fprintf(stderr, "%s: -C cannot be combined with -p, -a, -S, -P, -d or -D\n", argv[0]);
+        return 1;
+    }
+    if (s_num_outputs == 0)
+        s_outputs[s_num_outputs++] = "render.ppm";
+    for (int i = 0; i < s_num_outputs; ++i) {
+        if ((trace != trace_path || stream || check) && output_needs_hdr(s_outputs[i])) {
+            fprintf(stderr, "%s: %s needs the linear colour, which -p, -a, -S and -C do not keep\n", argv[0], s_outputs[i]);
+            return 1;
+        }
+    }
+    // A pass sums up to pass_samples 4.12 colours into an int32_t
+    if (pass_samples < 1 || pass_samples > 4096) {
+        fprintf(stderr, "%s: -n must be between 1 and 4096\n", argv[0]);
+        return 1;
+    }
+
+    if (frame && resolution_of_ppm(frame) != 0)
+        return 1;
+
+    Color *fb = malloc(g_width * g_height * sizeof(*fb));
+    s_spp = malloc(g_width * g_height);
+    s_hdr = malloc(g_width * g_height * sizeof(*s_hdr));
+    if (!fb || !s_spp || !s_hdr) { perror("malloc"); free(fb); free(s_spp); free(s_hdr); return 1; }
+    if (trace == trace_path)
+        trace = trace_hdr;
+
+    if (stream) {
+        int ret = run_stream(fb, threads) != 0;
+        free(fb);
+        free(s_spp);
+        free(s_hdr);
+        return ret;
+    }
+    if (check) {
+        int ret = run_packet_check(fb, threads) != 0;
+        free(fb);
+        free(s_spp);
+        free(s_hdr);
+        return ret;
+    }
+    if (denoise) {
+        int ret = run_denoise(fb, threads, pass_samples, frame) != 0;
+        free(fb);
+        free(s_spp);
+        free(s_hdr);
+        return ret;
+    }
+    if (passes > 0) {
+        int ret = run_progressive(fb, threads, passes, pass_samples, checkpoint) != 0;
+        free(fb);
+        free(s_spp);
+        free(s_hdr);
+        return ret;
+    }
+
+    int ret = 0;
+#ifdef TRACE_STATS
+    StatsFrame sf;
+    if (stats_render(fb, threads, trace, &sf) != 0) {
+        fprintf(stderr, "render_frame failed\n");
+        ret = 1;
+    } else {
+        if (stats_write(&sf, "stats.json", "heat_") != 0)
+            ret = 1;
+        else
+            printf("Wrote stats.json and heat_*.ppm\n");
+        stats_free(&sf);
+        if (write_outputs(fb, (const float (*)[3])s_hdr) != 0)
+            ret = 1;
+        else
+            print_outputs("");
+    }
+#else
+    if (render_streamed(fb, threads, trace) != 0)
+        ret = 1;
+    else
+        print_outputs("");
+#endif
+    free(fb);
+    free(s_hdr);
+
+    if (trace == trace_adaptive && write_spp("spp.pgm") != 0)
+        ret = 1;
+    free(s_spp);
+    return ret;
+}
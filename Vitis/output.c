@@ -0,0 +1,138 @@
+/* output.c
+ * Binary PPM and PFM frame writer for the host testbench (see output.h).
+ *
+ * Every row of either format is the same number of bytes after a fixed
+ * header, so a band of rows goes out as a single pwrite at its own offset:
+ * nothing is seeked, and workers finishing different bands do not wait on
+ * each other.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "output.h"
+
+static int has_extension(const char *path, const char *ext)
+{
+    size_t n = strlen(path), e = strlen(ext);
+    return n > e && strcmp(path + n - e, ext) == 0;
+}
+
+static long row_bytes(OutputFormat format)
+{
+    return format == OUTPUT_PFM ? g_width * 3 * (long)sizeof(float) : g_width * 3L;
+}
+
+int output_needs_hdr(const char *path)
+{
+    return has_extension(path, ".pfm");
+}
+
+// output_open, writing under path + suffix and renamed to path by
+// output_close; an empty suffix writes path in place
+static int open_as(OutputFile *f, const char *path, const char *suffix)
+{
+    if (has_extension(path, ".pfm")) {
+        f->format = OUTPUT_PFM;
+    } else if (has_extension(path, ".ppm")) {
+        f->format = OUTPUT_PPM;
+    } else {
+        fprintf(stderr, "%s: unknown output format (use .ppm or .pfm)\n", path);
+        return -1;
+    }
+    if (snprintf(f->path, sizeof(f->path), "%s", path) >= (int)sizeof(f->path)
+        || snprintf(f->tmp, sizeof(f->tmp), "%s%s", path, suffix) >= (int)sizeof(f->tmp)) {
+        fprintf(stderr, "%s: path too long\n", path);
+        return -1;
+    }
+
+    char header[64];
+    int n;
+    if (f->format == OUTPUT_PFM) {
+        // A negative scale marks little-endian floats
+        const uint16_t probe = 1;
+        int little = *(const uint8_t *)&probe == 1;
+        n = snprintf(header, sizeof(header), "PF\n%d %d\n%s\n", g_width, g_height, little ? "-1.0" : "1.0");
+    } else {
+        n = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", g_width, g_height);
+    }
+
+    f->fd = open(f->tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (f->fd < 0) { perror(f->tmp); return -1; }
+    // Sizing the file up front lets bands land in any order without holes,
+    // and makes it a whole (black) frame from the start
+    if (write(f->fd, header, n) != n || ftruncate(f->fd, n + row_bytes(f->format) * g_height) != 0) {
+        perror(f->tmp);
+        close(f->fd);
+        remove(f->tmp);
+        return -1;
+    }
+    f->data_offset = n;
+    f->failed = 0;
+    return 0;
+}
+
+int output_open(OutputFile *f, const char *path)
+{
+    return open_as(f, path, "");
+}
+
+int output_write_rows(OutputFile *f, const Color *fb, const float (*hdr)[3], int y0, int y1)
+{
+    long row = row_bytes(f->format);
+    size_t size = (size_t)row * (y1 - y0);
+    unsigned char *band = malloc(size);
+    if (!band) { f->failed = 1; return -1; }
+
+    long offset;
+    if (f->format == OUTPUT_PFM) {
+        // Bottom row first: rows y1-1 .. y0 sit in that order from g_height - y1
+        const float exposure = 1 << BRIGHTNESS_SHIFT;
+        float *dst = (float *)band;
+        for (int y = y1 - 1; y >= y0; --y)
+            for (int x = 0; x < g_width; ++x)
+                for (int k = 0; k < 3; ++k)
+                    *dst++ = hdr[y * g_width + x][k] * exposure;
+        offset = f->data_offset + row * (g_height - y1);
+    } else {
+        unsigned char *dst = band;
+        for (int i = y0 * g_width; i < y1 * g_width; ++i) {
+            *dst++ = fb[i].r;
+            *dst++ = fb[i].g;
+            *dst++ = fb[i].b;
+        }
+        offset = f->data_offset + row * y0;
+    }
+
+    int ret = pwrite(f->fd, band, size, offset) == (ssize_t)size ? 0 : -1;
+    free(band);
+    if (ret != 0) f->failed = 1;
+    return ret;
+}
+
+int output_close(OutputFile *f)
+{
+    int failed = f->failed;
+    if (close(f->fd) != 0) failed = 1;
+    if (!failed && strcmp(f->tmp, f->path) != 0 && rename(f->tmp, f->path) != 0) failed = 1;
+    if (failed) {
+        perror(f->path);
+        remove(f->tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int output_write_frame(const char *path, const Color *fb, const float (*hdr)[3])
+{
+    OutputFile f;
+    if (open_as(&f, path, ".tmp") != 0)
+        return -1;
+    output_write_rows(&f, fb, hdr, 0, g_height);
+    return output_close(&f);
+}
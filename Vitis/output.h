@@ -0,0 +1,55 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "trace_path.h"
+
+// Host-side frame files. The format follows the extension:
+//   .ppm  binary PPM (P6), the 8-bit pixels trace_path returns
+//   .pfm  Portable Float Map, linear colour before the 8-bit conversion,
+//         scaled by 2^BRIGHTNESS_SHIFT so 1.0 is the PPM's white; RGB
+//         floats in host byte order, bottom row first as the format has it
+// Both have a fixed size, so a file is laid out when it is opened and any
+// band of rows can be written at its place as soon as it is traced, in any
+// order and from any thread. output_open writes the file in place: the
+// header and a black frame are there at once and every band shows up as it
+// lands, so a viewer that reloads the file watches the frame fill in.
+// output_write_frame, which has the whole frame at hand, writes under a
+// temporary name and renames it instead, so the file is never half old, half
+// new.
+
+typedef enum {
+    OUTPUT_PPM,
+    OUTPUT_PFM,
+} OutputFormat;
+
+typedef struct {
+    int fd;
+    OutputFormat format;
+    long data_offset;     // header size
+    _Atomic int failed;   // a write failed; set from any thread, read on close
+    char path[4096];
+    char tmp[4096];       // the name written to: path itself, or a temporary
+} OutputFile;
+
+// Opens path for writing in place, choosing the format from its extension,
+// and writes the header. Returns 0 on success, -1 on error (message on
+// stderr).
+int output_open(OutputFile *f, const char *path);
+
+// Writes rows [y0, y1) of a g_width x g_height frame. fb holds the 8-bit pixels
+// and hdr the linear path colour (1.0 is ONE) of the whole frame; the one the
+// file's format does not use may be NULL. Safe to call from several threads
+// at once for different rows. Returns 0 on success, -1 on error.
+int output_write_rows(OutputFile *f, const Color *fb, const float (*hdr)[3], int y0, int y1);
+
+// Closes the file. Returns 0 if every write succeeded, -1 otherwise (the
+// incomplete file is then removed).
+int output_close(OutputFile *f);
+
+// Writes a whole frame under a temporary name and renames it over path.
+int output_write_frame(const char *path, const Color *fb, const float (*hdr)[3]);
+
+// Does path need the HDR buffer?
+int output_needs_hdr(const char *path);
+
+#endif
@@ -0,0 +1,866 @@
+/* packet.c
+ * SIMD ray-packet kernels for the host build (C-sim / render driver only).
+ *
+ * Lanes hold 4.12 values widened to int32 (8 x int32 per AVX2 register). Each
+ * helper below reproduces one scalar operation of trace_path.c exactly:
+ *   - mul() of two fp_t fits in 32 bits, so it is a mullo + arithmetic shift;
+ *   - mul() of wider values needs the 64-bit product; only its low 32 bits
+ *     after the shift are kept, which a logical 64-bit shift gives directly;
+ *   - div_fp() is done in double: the numerator is below 2^53, so the
+ *     truncated quotient is exact, and it is wrapped to int32 like the scalar
+ *     (int32_t) cast;
+ *   - inv_sqrt_fp() repeats the integer normalise / table / Newton steps,
+ *     with the table entry gathered;
+ *   - every (fp_t) cast is a sign extension of the low 16 bits;
+ *   - branches (as in sphere_blocks()) become masks over all of them.
+ * trace_path_packet() runs the shading of path_hit() / path_bounce() the same
+ * way, one sample per lane, so the whole path stays in registers between the
+ * intersection kernels.
+ * Build with -mavx2 (or -march=native) to enable the vector path.
+ */
+
+#include <string.h>
+
+#include "packet.h"
+
+// The lane helpers assume the default 16-bit 4.12 format with wrap-around;
+// other fixed-point formats (see trace_path.h) take the scalar fallback.
+#if defined(__AVX2__) && FP_BITS == 16 && FRAC_BITS == 12 && !defined(FP_SATURATE)
+#define PACKET_SIMD
+#include <immintrin.h>
+#endif
+
+void packet_set_ray(RayPacket *p, int lane, Ray r)
+{
+    p->ox[lane] = r.orig.x; p->oy[lane] = r.orig.y; p->oz[lane] = r.orig.z;
+    p->dx[lane] = r.dir.x;  p->dy[lane] = r.dir.y;  p->dz[lane] = r.dir.z;
+}
+
+#ifdef PACKET_SIMD
+
+typedef __m256i v8i;
+
+#define LOADV(a)    _mm256_loadu_si256((const __m256i *)(a))
+#define STOREV(a, v) _mm256_storeu_si256((__m256i *)(a), (v))
+#define SET1(v)     _mm256_set1_epi32(v)
+
+// (fp_t) cast: keep the low 16 bits, sign-extended
+static inline v8i v_fp(v8i a)
+{
+    return _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+}
+
+// mul() for operands that fit in fp_t
+static inline v8i v_mul16(v8i a, v8i b)
+{
+    return _mm256_srai_epi32(_mm256_mullo_epi32(a, b), FRAC_BITS);
+}
+
+// mul() by a per-primitive constant; axis-aligned normals make most of these free
+static inline v8i v_mul_k(int32_t k, v8i x)
+{
+    if (k == 0)    return _mm256_setzero_si256();
+    if (k == ONE)  return x;
+    if (k == -ONE) return _mm256_sub_epi32(_mm256_setzero_si256(), x);
+    return v_mul16(SET1(k), x);
+}
+
+static inline v8i v_dot_k(Vec3 k, v8i x, v8i y, v8i z)
+{
+    return _mm256_add_epi32(_mm256_add_epi32(v_mul_k(k.x, x), v_mul_k(k.y, y)), v_mul_k(k.z, z));
+}
+
+// mul() for full int32 operands
+static inline v8i v_mul32(v8i a, v8i b)
+{
+    v8i even = _mm256_srli_epi64(_mm256_mul_epi32(a, b), FRAC_BITS);
+    v8i odd  = _mm256_srli_epi64(_mm256_mul_epi32(_mm256_srli_epi64(a, 32),
+                                                  _mm256_srli_epi64(b, 32)), FRAC_BITS);
+    return _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+}
+
+// Exact (int64)(a << FRAC_BITS) / b for four lanes, still in double.
+static inline __m256d v_div4(__m128i a, __m128i b)
+{
+    return _mm256_div_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(a), _mm256_set1_pd(ONE)),
+                         _mm256_cvtepi32_pd(b));
+}
+
+// Truncate and wrap to int32 the way the scalar (int32_t) cast of the int64
+// quotient does. Only needed when a quotient falls outside the int32 range.
+static inline __m128i v_wrap4(__m256d q)
+{
+    const __m256d two32 = _mm256_set1_pd(4294967296.0);
+    q = _mm256_round_pd(q, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    q = _mm256_sub_pd(q, _mm256_mul_pd(two32, _mm256_floor_pd(_mm256_mul_pd(q, _mm256_set1_pd(1.0 / 4294967296.0)))));
+    __m256d big = _mm256_cmp_pd(q, _mm256_set1_pd(2147483648.0), _CMP_GE_OQ);
+    return _mm256_cvttpd_epi32(_mm256_sub_pd(q, _mm256_and_pd(big, two32)));
+}
+
+// div_fp()
+static inline v8i v_div(v8i a, v8i b)
+{
+    __m256d qlo = v_div4(_mm256_castsi256_si128(a), _mm256_castsi256_si128(b));
+    __m256d qhi = v_div4(_mm256_extracti128_si256(a, 1), _mm256_extracti128_si256(b, 1));
+    // cvttpd truncates like integer division and returns INT_MIN when out of range
+    v8i q = _mm256_set_m128i(_mm256_cvttpd_epi32(qhi), _mm256_cvttpd_epi32(qlo));
+    if (!_mm256_testz_si256(_mm256_cmpeq_epi32(q, SET1(INT32_MIN)), SET1(-1)))
+        q = _mm256_set_m128i(v_wrap4(qhi), v_wrap4(qlo));
+    return _mm256_andnot_si256(_mm256_cmpeq_epi32(b, _mm256_setzero_si256()), q);
+}
+
+// (uint64)a * b + round >> s, low 32 bits, for unsigned 32-bit lanes
+static inline v8i v_mulshr_u32(v8i a, v8i b, long long round, int s)
+{
+    const __m128i cnt = _mm_cvtsi32_si128(s);
+    const v8i r = _mm256_set1_epi64x(round);
+    v8i even = _mm256_srl_epi64(_mm256_add_epi64(_mm256_mul_epu32(a, b), r), cnt);
+    v8i odd  = _mm256_srl_epi64(_mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32),
+                                                                  _mm256_srli_epi64(b, 32)), r), cnt);
+    return _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+}
+
+// inv_sqrt_fp()
+static inline v8i v_inv_sqrt(v8i x)
+{
+    const v8i zero = _mm256_setzero_si256();
+    v8i pos = _mm256_cmpgt_epi32(x, zero);
+    v8i m = _mm256_blendv_epi8(SET1(1 << 30), x, pos);     // keeps x <= 0 lanes in the table
+
+    // The leading zeros, from the exponent of m as a float. Below 2^24 the
+    // conversion is exact; above, m >> 8 is converted instead, so it never
+    // rounds up into the next power of two.
+    v8i big = _mm256_cmpgt_epi32(m, SET1((1 << 24) - 1));
+    v8i f = _mm256_castps_si256(_mm256_cvtepi32_ps(_mm256_blendv_epi8(m, _mm256_srli_epi32(m, 8), big)));
+    v8i log2 = _mm256_add_epi32(_mm256_sub_epi32(_mm256_srli_epi32(f, 23), SET1(127)), _mm256_and_si256(big, SET1(8)));
+    v8i sh = _mm256_andnot_si256(SET1(1), _mm256_sub_epi32(SET1(31), log2));  // even, as FRAC_BITS is
+    m = _mm256_sllv_epi32(m, sh);
+
+    // The 16-bit table entry, gathered as the high half of the word that
+    // starts one entry earlier (the low half for entry 0), so the read stays
+    // inside the table
+    v8i idx = _mm256_sub_epi32(_mm256_srli_epi32(m, 25), SET1(32));
+    v8i above = _mm256_cmpgt_epi32(idx, zero);
+    v8i word = _mm256_i32gather_epi32((const int *)g_inv_sqrt_lut, _mm256_add_epi32(idx, above), 2);
+    v8i y = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_and_si256(above, SET1(16))), SET1(0xFFFF));
+
+    v8i h = v_mulshr_u32(_mm256_srli_epi32(m, 2), _mm256_mullo_epi32(y, y), 0, 30);
+    y = v_mulshr_u32(y, _mm256_sub_epi32(SET1(3 << 28), h), 1 << 28, 29);
+
+    v8i r = _mm256_srlv_epi32(_mm256_slli_epi32(y, 3), _mm256_srli_epi32(_mm256_sub_epi32(SET1(30), sh), 1));
+    return _mm256_and_si256(pos, r);
+}
+
+// sqrt_fp()
+static inline v8i v_sqrt(v8i n)
+{
+    v8i r = v_mul32(n, v_inv_sqrt(n));
+    return _mm256_and_si256(_mm256_cmpgt_epi32(n, _mm256_setzero_si256()), r);
+}
+
+static inline v8i v_dot16(v8i ax, v8i ay, v8i az, v8i bx, v8i by, v8i bz)
+{
+    return _mm256_add_epi32(_mm256_add_epi32(v_mul16(ax, bx), v_mul16(ay, by)), v_mul16(az, bz));
+}
+
+typedef struct {
+    v8i ox, oy, oz, dx, dy, dz;
+    v8i a, inv_2a;      // sphere terms that only depend on the ray direction
+    v8i ix, iy, iz;     // ray_inv()
+} VRay;
+
+// inv_2a is only needed by intersect_sphere(), not by the shadow test
+static inline VRay load_ray(const RayPacket *p, int need_inv_2a)
+{
+    VRay r = { LOADV(p->ox), LOADV(p->oy), LOADV(p->oz),
+               LOADV(p->dx), LOADV(p->dy), LOADV(p->dz),
+               _mm256_setzero_si256(), _mm256_setzero_si256(),
+               _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256() };
+    r.a = v_dot16(r.dx, r.dy, r.dz, r.dx, r.dy, r.dz);
+    if (need_inv_2a)
+        r.inv_2a = v_div(SET1(ONE), _mm256_slli_epi32(r.a, 1));
+    if (g_num_spheres > 0 && g_bvh[0].count == 0) {
+        r.ix = v_div(SET1(ONE), r.dx);
+        r.iy = v_div(SET1(ONE), r.dy);
+        r.iz = v_div(SET1(ONE), r.dz);
+    }
+    return r;
+}
+
+// clip_slab() on eight rays; returns the lanes that fell outside a parallel slab
+static inline v8i v_clip_slab(v8i o, v8i d, v8i inv, fp_t lo, fp_t hi, v8i *tmin, v8i *tmax)
+{
+    v8i parallel = _mm256_cmpeq_epi32(d, _mm256_setzero_si256());
+    v8i t1 = v_mul32(_mm256_sub_epi32(SET1(lo), o), inv);
+    v8i t2 = v_mul32(_mm256_sub_epi32(SET1(hi), o), inv);
+    v8i near = _mm256_blendv_epi8(_mm256_min_epi32(t1, t2), *tmin, parallel);
+    v8i far  = _mm256_blendv_epi8(_mm256_max_epi32(t1, t2), *tmax, parallel);
+    *tmin = _mm256_max_epi32(*tmin, near);
+    *tmax = _mm256_min_epi32(*tmax, far);
+    v8i outside = _mm256_or_si256(_mm256_cmpgt_epi32(SET1(lo), o), _mm256_cmpgt_epi32(o, SET1(hi)));
+    return _mm256_and_si256(parallel, outside);
+}
+
+// intersect_box() on eight rays
+static v8i v_intersect_box(const VRay *r, const BvhNode *n)
+{
+    v8i tmin = _mm256_setzero_si256(), tmax = SET1(FP_INF);
+    v8i miss = v_clip_slab(r->ox, r->dx, r->ix, n->min.x, n->max.x, &tmin, &tmax);
+    miss = _mm256_or_si256(miss, v_clip_slab(r->oy, r->dy, r->iy, n->min.y, n->max.y, &tmin, &tmax));
+    miss = _mm256_or_si256(miss, v_clip_slab(r->oz, r->dz, r->iz, n->min.z, n->max.z, &tmin, &tmax));
+    miss = _mm256_or_si256(miss, _mm256_cmpgt_epi32(tmin, tmax));
+    return _mm256_blendv_epi8(tmin, SET1(FP_INF), miss);
+}
+
+// intersect_sphere() on eight rays
+static v8i v_intersect_sphere(const VRay *r, const Sphere *s)
+{
+    const v8i inf = SET1(FP_INF), eps = SET1(FP_EPS);
+    int32_t r_sq = (int32_t)(((int64_t)s->radius * s->radius) >> FRAC_BITS);
+
+    v8i ocx = v_fp(_mm256_sub_epi32(r->ox, SET1(s->center.x)));
+    v8i ocy = v_fp(_mm256_sub_epi32(r->oy, SET1(s->center.y)));
+    v8i ocz = v_fp(_mm256_sub_epi32(r->oz, SET1(s->center.z)));
+
+    v8i a = r->a;
+    v8i b = _mm256_slli_epi32(v_dot16(ocx, ocy, ocz, r->dx, r->dy, r->dz), 1);
+    v8i c = _mm256_sub_epi32(v_dot16(ocx, ocy, ocz, ocx, ocy, ocz), SET1(r_sq));
+    v8i disc = _mm256_sub_epi32(v_mul32(b, b), _mm256_slli_epi32(v_mul32(a, c), 2));
+    v8i miss = _mm256_cmpgt_epi32(_mm256_setzero_si256(), disc);
+    if (_mm256_testc_si256(miss, SET1(-1)))
+        return inf;
+
+    v8i sqrt_d = v_sqrt(disc);
+    v8i inv_2a = r->inv_2a;
+    v8i neg_b = _mm256_sub_epi32(_mm256_setzero_si256(), b);
+
+    v8i t  = v_mul32(_mm256_sub_epi32(neg_b, sqrt_d), inv_2a);
+    v8i t2 = v_mul32(_mm256_add_epi32(neg_b, sqrt_d), inv_2a);
+    v8i res = _mm256_blendv_epi8(inf, t2, _mm256_cmpgt_epi32(t2, eps));
+    res = _mm256_blendv_epi8(res, t, _mm256_cmpgt_epi32(t, eps));
+    return _mm256_blendv_epi8(res, inf, miss);
+}
+
+// sphere_blocks() on eight rays
+static v8i v_sphere_blocks(const VRay *r, const Sphere *s, v8i max_t)
+{
+    const v8i zero = _mm256_setzero_si256();
+    int32_t r_sq = (int32_t)(((int64_t)s->radius * s->radius) >> FRAC_BITS);
+
+    v8i ocx = v_fp(_mm256_sub_epi32(r->ox, SET1(s->center.x)));
+    v8i ocy = v_fp(_mm256_sub_epi32(r->oy, SET1(s->center.y)));
+    v8i ocz = v_fp(_mm256_sub_epi32(r->oz, SET1(s->center.z)));
+
+    v8i a = r->a;
+    v8i b = _mm256_slli_epi32(v_dot16(ocx, ocy, ocz, r->dx, r->dy, r->dz), 1);
+    v8i c = _mm256_sub_epi32(v_dot16(ocx, ocy, ocz, ocx, ocy, ocz), SET1(r_sq));
+    v8i a_max = v_mul32(a, max_t);
+    v8i f_max = _mm256_add_epi32(v_mul32(_mm256_add_epi32(a_max, b), max_t), c);
+    v8i disc = _mm256_sub_epi32(v_mul32(b, b), _mm256_slli_epi32(v_mul32(a, c), 2));
+
+    // The branches of the scalar test, as masks
+    v8i inside = _mm256_cmpgt_epi32(zero, c);
+    v8i leaves = _mm256_cmpgt_epi32(f_max, zero);
+    v8i ahead = _mm256_cmpgt_epi32(zero, b);
+    v8i max_in = _mm256_cmpgt_epi32(zero, f_max);
+    v8i near = _mm256_cmpgt_epi32(_mm256_slli_epi32(a_max, 1), _mm256_sub_epi32(zero, b));
+    v8i real = _mm256_cmpgt_epi32(disc, SET1(-1));
+    v8i outside_hit = _mm256_and_si256(ahead, _mm256_or_si256(max_in, _mm256_and_si256(near, real)));
+    return _mm256_blendv_epi8(outside_hit, leaves, inside);
+}
+
+// dot(n, p - o) for a plane point p, the numerator of intersect_plane()
+static inline v8i v_plane_num(const VRay *r, const Plane *p)
+{
+    // vec_scale(p.normal, p.dist) is the same for every ray
+    int32_t px = (fp_t)(((int32_t)p->normal.x * p->dist) >> FRAC_BITS);
+    int32_t py = (fp_t)(((int32_t)p->normal.y * p->dist) >> FRAC_BITS);
+    int32_t pz = (fp_t)(((int32_t)p->normal.z * p->dist) >> FRAC_BITS);
+
+    v8i dx = v_fp(_mm256_sub_epi32(SET1(px), r->ox));
+    v8i dy = v_fp(_mm256_sub_epi32(SET1(py), r->oy));
+    v8i dz = v_fp(_mm256_sub_epi32(SET1(pz), r->oz));
+    return v_dot_k(p->normal, dx, dy, dz);
+}
+
+// plane_blocks() on eight rays
+static v8i v_plane_blocks(const VRay *r, const Plane *p, v8i max_t)
+{
+    const v8i zero = _mm256_setzero_si256();
+    v8i denom = v_dot_k(p->normal, r->dx, r->dy, r->dz);
+    v8i num = v_plane_num(r, p);
+    v8i rest = _mm256_sub_epi32(num, v_mul32(max_t, denom));
+    return _mm256_or_si256(_mm256_and_si256(_mm256_cmpgt_epi32(num, zero), _mm256_cmpgt_epi32(zero, rest)),
+                           _mm256_and_si256(_mm256_cmpgt_epi32(zero, num), _mm256_cmpgt_epi32(rest, zero)));
+}
+
+// intersect_plane() on eight rays
+static v8i v_intersect_plane(const VRay *r, const Plane *p)
+{
+    const v8i inf = SET1(FP_INF), eps = SET1(FP_EPS);
+    v8i denom = v_dot_k(p->normal, r->dx, r->dy, r->dz);
+    v8i num = v_plane_num(r, p);
+
+    // Plane behind every ray: num and denom have opposite signs (or num is 0),
+    // so t <= 0 without dividing. |num| < 2^20, so with |denom| >= 2 the
+    // quotient cannot wrap around to a positive int32.
+    v8i zero = _mm256_setzero_si256();
+    v8i behind = _mm256_or_si256(_mm256_cmpeq_epi32(num, zero),
+                                 _mm256_and_si256(_mm256_cmpgt_epi32(zero, _mm256_xor_si256(num, denom)),
+                                                  _mm256_cmpgt_epi32(_mm256_abs_epi32(denom), SET1(1))));
+    behind = _mm256_or_si256(behind, _mm256_cmpeq_epi32(denom, zero));
+    if (_mm256_testc_si256(behind, SET1(-1)))
+        return inf;
+
+    v8i t = v_div(num, denom);
+
+    // parallel (denom == 0) or t <= FP_EPS
+    v8i miss = _mm256_or_si256(_mm256_cmpeq_epi32(denom, zero),
+                               _mm256_andnot_si256(_mm256_cmpgt_epi32(t, eps), SET1(-1)));
+    t = _mm256_blendv_epi8(t, inf, miss);
+
+    if (p->material.is_light) {
+        // Hit point as in the scalar code, then the is_on_light() rectangle test
+        v8i s = v_fp(t);
+        v8i hx = v_fp(_mm256_add_epi32(r->ox, v_fp(v_mul16(r->dx, s))));
+        v8i hz = v_fp(_mm256_add_epi32(r->oz, v_fp(v_mul16(r->dz, s))));
+        v8i off = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpgt_epi32(SET1(LIGHT_X_MIN), hx), _mm256_cmpgt_epi32(hx, SET1(LIGHT_X_MAX))),
+            _mm256_or_si256(_mm256_cmpgt_epi32(SET1(LIGHT_Z_MIN), hz), _mm256_cmpgt_epi32(hz, SET1(LIGHT_Z_MAX))));
+        t = _mm256_blendv_epi8(t, inf, off);
+    }
+    return t;
+}
+
+// The BVH walk of intersect_spheres()/spheres_block() for a whole packet.
+// A node is visited while any lane still wants it; the other lanes are masked
+// out, so every lane makes exactly the decisions the scalar walk would.
+typedef struct {
+    uint16_t node[BVH_STACK_SIZE];
+    v8i mask[BVH_STACK_SIZE];
+    int sp;
+} NodeStack;
+
+void intersect_scene_packet(const RayPacket *p, HitPacket *out)
+{
+    VRay r = load_ray(p, 1);
+    v8i best = SET1(FP_INF), type = SET1(-1), index = SET1(-1);
+    const v8i inf = SET1(FP_INF);
+
+    // Spheres first, like intersect_scene: boxes beyond the lane's nearest hit
+    // are skipped, and ties go to the lower sphere index
+    NodeStack st;
+    st.sp = 0;
+    if (g_num_spheres > 0) {
+        st.node[0] = 0;
+        st.mask[0] = SET1(-1);
+        st.sp = 1;
+    }
+    while (st.sp > 0) {
+        --st.sp;
+        const BvhNode *n = &g_bvh[st.node[st.sp]];
+        v8i visit = st.mask[st.sp];
+        if (n != &g_bvh[0] || n->count == 0) {  // a single-leaf tree is not box-tested
+            v8i t_box = v_intersect_box(&r, n);
+            visit = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi32(t_box, inf),
+                                                        _mm256_cmpgt_epi32(t_box, best)),
+                                        visit);
+        }
+        if (_mm256_testz_si256(visit, visit))
+            continue;
+
+        if (n->count == 0) {
+            st.node[st.sp] = n->first + 1; st.mask[st.sp++] = visit;
+            st.node[st.sp] = n->first;     st.mask[st.sp++] = visit;
+            continue;
+        }
+        for (int i = n->first; i < n->first + n->count; ++i) {
+            v8i t = v_intersect_sphere(&r, &g_spheres[i]);
+            v8i tie = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi32(t, best),
+                                                        _mm256_cmpgt_epi32(inf, t)),
+                                       _mm256_cmpgt_epi32(index, SET1(i)));
+            v8i closer = _mm256_and_si256(visit, _mm256_or_si256(_mm256_cmpgt_epi32(best, t), tie));
+            best  = _mm256_blendv_epi8(best, t, closer);
+            type  = _mm256_blendv_epi8(type, SET1(0), closer);
+            index = _mm256_blendv_epi8(index, SET1(i), closer);
+        }
+    }
+
+    // Then planes, strict '<' so a sphere wins a tie
+    for (int j = 0; j < g_num_planes; ++j) {
+        v8i t = v_intersect_plane(&r, &g_planes[j]);
+        v8i closer = _mm256_cmpgt_epi32(best, t);
+        best  = _mm256_blendv_epi8(best, t, closer);
+        type  = _mm256_blendv_epi8(type, SET1(1), closer);
+        index = _mm256_blendv_epi8(index, SET1(j), closer);
+    }
+    STOREV(out->t, best);
+    STOREV(out->hit_type, type);
+    STOREV(out->hit_index, index);
+}
+
+unsigned occluded_packet(const RayPacket *p, const int32_t max_t[PACKET_WIDTH])
+{
+    VRay r = load_ray(p, 0);
+    v8i m = LOADV(max_t);
+    v8i occ = _mm256_setzero_si256();
+    // Lanes with max_t <= 0 can never be blocked; the query ends once every
+    // other lane is (testc: occ covers live), as occluded() does at its first
+    // blocker
+    v8i live = _mm256_cmpgt_epi32(m, _mm256_setzero_si256());
+
+    NodeStack st;
+    st.sp = 0;
+    if (g_num_spheres > 0) {
+        st.node[0] = 0;
+        st.mask[0] = SET1(-1);
+        st.sp = 1;
+    }
+    while (st.sp > 0 && !_mm256_testc_si256(occ, live)) {
+        --st.sp;
+        const BvhNode *n = &g_bvh[st.node[st.sp]];
+        v8i visit = _mm256_andnot_si256(occ, st.mask[st.sp]);
+        if (n != &g_bvh[0] || n->count == 0)    // a single-leaf tree is not box-tested
+            visit = _mm256_and_si256(visit, _mm256_cmpgt_epi32(m, v_intersect_box(&r, n)));
+        if (_mm256_testz_si256(visit, visit))
+            continue;
+
+        if (n->count == 0) {
+            st.node[st.sp] = n->first + 1; st.mask[st.sp++] = visit;
+            st.node[st.sp] = n->first;     st.mask[st.sp++] = visit;
+            continue;
+        }
+        for (int i = n->first; i < n->first + n->count; ++i)
+            occ = _mm256_or_si256(occ, _mm256_and_si256(visit, v_sphere_blocks(&r, &g_spheres[i], m)));
+    }
+
+    for (int j = 0; j < g_num_planes && !_mm256_testc_si256(occ, live); ++j) {
+        if (g_planes[j].material.is_light) continue; // Don't treat the emissive plane as occluder
+        occ = _mm256_or_si256(occ, v_plane_blocks(&r, &g_planes[j], m));
+    }
+    return (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(occ));
+}
+
+#else /* scalar fallback */
+
+static Ray get_ray(const RayPacket *p, int lane)
+{
+    Ray r = { { (fp_t)p->ox[lane], (fp_t)p->oy[lane], (fp_t)p->oz[lane] },
+              { (fp_t)p->dx[lane], (fp_t)p->dy[lane], (fp_t)p->dz[lane] } };
+    return r;
+}
+
+void intersect_scene_packet(const RayPacket *p, HitPacket *out)
+{
+    for (int i = 0; i < PACKET_WIDTH; ++i) {
+        Intersection inter = intersect_scene(get_ray(p, i));
+        out->t[i] = inter.t;
+        out->hit_type[i] = inter.hit_type;
+        out->hit_index[i] = inter.hit_index;
+    }
+}
+
+unsigned occluded_packet(const RayPacket *p, const int32_t max_t[PACKET_WIDTH])
+{
+    unsigned mask = 0;
+    for (int i = 0; i < PACKET_WIDTH; ++i)
+        if (occluded(get_ray(p, i), max_t[i]))
+            mask |= 1u << i;
+    return mask;
+}
+
+#endif
+
+#if defined(PACKET_SIMD) && !defined(TRACE_STATS)
+
+// Shading stages on eight paths, for trace_path_packet. As with the
+// intersection kernels every step is the scalar one of trace_path.c, so the
+// lanes come out bit-identical to path_hit() and path_bounce(). The
+// instrumented build (-DTRACE_STATS) keeps the scalar stages, which count.
+
+typedef struct {
+    v8i x, y, z;
+} V3;
+
+static inline V3 v3_set(Vec3 v)
+{
+    return (V3){ SET1(v.x), SET1(v.y), SET1(v.z) };
+}
+
+static inline V3 v3_add(V3 a, V3 b)
+{
+    return (V3){ v_fp(_mm256_add_epi32(a.x, b.x)), v_fp(_mm256_add_epi32(a.y, b.y)), v_fp(_mm256_add_epi32(a.z, b.z)) };
+}
+
+static inline V3 v3_sub(V3 a, V3 b)
+{
+    return (V3){ v_fp(_mm256_sub_epi32(a.x, b.x)), v_fp(_mm256_sub_epi32(a.y, b.y)), v_fp(_mm256_sub_epi32(a.z, b.z)) };
+}
+
+static inline V3 v3_mul(V3 a, V3 b)
+{
+    return (V3){ v_fp(v_mul16(a.x, b.x)), v_fp(v_mul16(a.y, b.y)), v_fp(v_mul16(a.z, b.z)) };
+}
+
+// vec_scale(): the scale is narrowed to fp_t first
+static inline V3 v3_scale(V3 v, v8i s)
+{
+    s = v_fp(s);
+    return (V3){ v_fp(v_mul16(v.x, s)), v_fp(v_mul16(v.y, s)), v_fp(v_mul16(v.z, s)) };
+}
+
+static inline v8i v3_dot(V3 a, V3 b)
+{
+    return v_dot16(a.x, a.y, a.z, b.x, b.y, b.z);
+}
+
+static inline V3 v3_blend(V3 a, V3 b, v8i mask)
+{
+    return (V3){ _mm256_blendv_epi8(a.x, b.x, mask), _mm256_blendv_epi8(a.y, b.y, mask),
+                 _mm256_blendv_epi8(a.z, b.z, mask) };
+}
+
+// rand_hash(). The seed of a packet is the same in every lane, so the hashes
+// of it are taken once, in scalar code.
+static inline uint32_t key_hash(uint32_t v)
+{
+    uint32_t state = v * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+    return (word >> 22) ^ word;
+}
+
+// reverse_bits(): bits within each byte, then a byte swap for the last two steps
+static inline v8i v_reverse_bits(v8i v)
+{
+    const v8i m1 = SET1(0x55555555), m2 = SET1(0x33333333), m4 = SET1(0x0F0F0F0F);
+    v = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 1), m1), _mm256_slli_epi32(_mm256_and_si256(v, m1), 1));
+    v = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 2), m2), _mm256_slli_epi32(_mm256_and_si256(v, m2), 2));
+    v = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 4), m4), _mm256_slli_epi32(_mm256_and_si256(v, m4), 4));
+    return _mm256_shuffle_epi8(v, _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                                   3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+}
+
+// lk_permute()
+static inline v8i v_lk_permute(v8i v, v8i seed)
+{
+    v = _mm256_add_epi32(v, seed);
+    v = _mm256_xor_si256(v, _mm256_mullo_epi32(v, SET1(0x6c50b47c)));
+    v = _mm256_xor_si256(v, _mm256_mullo_epi32(v, SET1((int32_t)0xb82f1e52u)));
+    v = _mm256_xor_si256(v, _mm256_mullo_epi32(v, SET1((int32_t)0xc7afe638u)));
+    v = _mm256_xor_si256(v, _mm256_mullo_epi32(v, SET1((int32_t)0x8d22f6e6u)));
+    return v;
+}
+
+// PathKey of a packet: one pixel, so one seed, and a sample index per lane,
+// kept bit-reversed as sobol_index() wants it
+typedef struct {
+    uint32_t seed;
+    v8i rev_index;
+} VKey;
+
+// sobol_index()
+static inline v8i v_sobol_index(VKey key, int bounce, int dim, uint32_t *seed)
+{
+    *seed = key_hash(key.seed + (uint32_t)(bounce * RAND_DIMS + dim) * 0x9E3779B9u);
+    return v_reverse_bits(v_lk_permute(key.rev_index, SET1((int32_t)*seed)));
+}
+
+static inline v8i v_sample_1d(VKey key, int bounce, int dim)
+{
+    uint32_t seed;
+    v8i i = v_sobol_index(key, bounce, dim, &seed);
+    return v_reverse_bits(v_lk_permute(i, SET1((int32_t)key_hash(seed))));
+}
+
+static inline void v_sample_2d(VKey key, int bounce, int dim, v8i u[2])
+{
+    uint32_t seed;
+    v8i i = v_sobol_index(key, bounce, dim, &seed);
+    v8i y = i;
+    y = _mm256_xor_si256(y, _mm256_and_si256(_mm256_srli_epi32(y, 1), SET1(0x55555555)));
+    y = _mm256_xor_si256(y, _mm256_and_si256(_mm256_srli_epi32(y, 2), SET1(0x33333333)));
+    y = _mm256_xor_si256(y, _mm256_and_si256(_mm256_srli_epi32(y, 4), SET1(0x0F0F0F0F)));
+    y = _mm256_xor_si256(y, _mm256_and_si256(_mm256_srli_epi32(y, 8), SET1(0x00FF00FF)));
+    y = _mm256_xor_si256(y, _mm256_srli_epi32(y, 16));
+    u[0] = v_reverse_bits(v_lk_permute(i, SET1((int32_t)key_hash(seed))));
+    u[1] = v_reverse_bits(v_lk_permute(y, SET1((int32_t)key_hash(seed + 1))));
+}
+
+// cos_sin_turn(). Both entries are gathered as 32-bit words from the 16-bit
+// table, at offsets that stay inside it: cos from the low half at i, sin from
+// the high half at QUARTER_WAVE_SIZE - i - 1.
+static inline void v_cos_sin_turn(v8i angle, v8i *c, v8i *s)
+{
+    v8i a = _mm256_srli_epi32(_mm256_add_epi32(angle, SET1(1 << (32 - 3 - QUARTER_WAVE_BITS))), 32 - 2 - QUARTER_WAVE_BITS);
+    v8i quadrant = _mm256_srli_epi32(a, QUARTER_WAVE_BITS);
+    v8i i = _mm256_and_si256(a, SET1(QUARTER_WAVE_SIZE - 1));
+    v8i ci = _mm256_and_si256(_mm256_i32gather_epi32((const int *)g_cos_lut, i, 2), SET1(0xFFFF));
+    v8i si = _mm256_srli_epi32(_mm256_i32gather_epi32((const int *)g_cos_lut,
+                                                      _mm256_sub_epi32(SET1(QUARTER_WAVE_SIZE - 1), i), 2), 16);
+    ci = _mm256_srli_epi32(ci, 15 - FRAC_BITS);
+    si = _mm256_srli_epi32(si, 15 - FRAC_BITS);
+
+    // Quadrants 1 and 3 swap the pair; 1 and 2 negate cos, 2 and 3 negate sin
+    const v8i zero = _mm256_setzero_si256();
+    v8i swap = _mm256_cmpeq_epi32(_mm256_and_si256(quadrant, SET1(1)), SET1(1));
+    v8i neg_c = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_add_epi32(quadrant, SET1(1)), SET1(2)), SET1(2));
+    v8i neg_s = _mm256_cmpeq_epi32(_mm256_and_si256(quadrant, SET1(2)), SET1(2));
+    v8i c0 = _mm256_blendv_epi8(ci, si, swap), s0 = _mm256_blendv_epi8(si, ci, swap);
+    *c = _mm256_blendv_epi8(c0, _mm256_sub_epi32(zero, c0), neg_c);
+    *s = _mm256_blendv_epi8(s0, _mm256_sub_epi32(zero, s0), neg_s);
+}
+
+// cosine_direction()
+static V3 v_cosine_direction(VKey key, int bounce, V3 n)
+{
+    v8i u[2];
+    v_sample_2d(key, bounce, RAND_DIM_BOUNCE, u);
+    v8i r_sq = _mm256_srli_epi32(u[0], 32 - FRAC_BITS);
+    v8i r = v_sqrt(r_sq);
+    v8i h = v_sqrt(_mm256_sub_epi32(SET1(ONE), r_sq));
+    v8i c, s;
+    v_cos_sin_turn(u[1], &c, &s);
+
+    // sign = n.z >= 0 ? 1 : -1, applied with sign_epi32
+    v8i sign = _mm256_or_si256(_mm256_srai_epi32(n.z, 31), SET1(1));
+    v8i a = v_div(SET1(-ONE), _mm256_add_epi32(_mm256_sign_epi32(SET1(ONE), sign), n.z));
+    v8i b = v_mul32(v_mul16(n.x, n.y), a);
+    V3 t  = { v_fp(_mm256_add_epi32(SET1(ONE), _mm256_sign_epi32(v_mul32(v_mul16(n.x, n.x), a), sign))),
+              v_fp(_mm256_sign_epi32(b, sign)),
+              v_fp(_mm256_sign_epi32(_mm256_sub_epi32(_mm256_setzero_si256(), n.x), sign)) };
+    V3 bt = { v_fp(b),
+              v_fp(_mm256_add_epi32(_mm256_sign_epi32(SET1(ONE), sign), v_mul32(v_mul16(n.y, n.y), a))),
+              v_fp(_mm256_sub_epi32(_mm256_setzero_si256(), n.y)) };
+
+    return v3_add(v3_add(v3_scale(t, v_mul16(r, c)), v3_scale(bt, v_mul16(r, s))), v3_scale(n, h));
+}
+
+// PathState and BounceState per lane
+typedef struct {
+    V3 orig, dir;
+    V3 color, attenuation;
+} VPath;
+
+typedef struct {
+    V3 hit_point, hit_normal, surface_color, light_dir;
+    v8i dist_sq, light_dist;
+    V3 shadow_orig;
+} VBounce;
+
+// path_hit() on the lanes in alive; returns the lanes that go on to a shadow ray
+static v8i v_path_hit(VPath *ps, const HitPacket *hp, int b, VKey key, v8i alive, VBounce *bs)
+{
+    const v8i zero = _mm256_setzero_si256();
+    int32_t color[3][PACKET_WIDTH], point[3][PACKET_WIDTH], light[PACKET_WIDTH], sphere[PACKET_WIDTH];
+
+    // hit_surface(): fetch the primitive of each lane. Sphere and plane are
+    // picked with selects rather than branches, which would mispredict on
+    // every packet that mixes the two; a miss reads plane 0 and is masked off.
+    for (int i = 0; i < PACKET_WIDTH; ++i) {
+        int is_sph = hp->hit_type[i] == 0, is_pl = hp->hit_type[i] == 1;
+        const Sphere *sp = &g_spheres[is_sph ? hp->hit_index[i] : 0];
+        const Plane *pl = &g_planes[is_pl ? hp->hit_index[i] : 0];
+        const Material *m = is_sph ? &sp->material : &pl->material;
+        const Vec3 *p = is_sph ? &sp->center : &pl->normal;
+        color[0][i] = m->color.x;
+        color[1][i] = m->color.y;
+        color[2][i] = m->color.z;
+        light[i] = -(m->is_light != 0);
+        sphere[i] = -is_sph;
+        point[0][i] = p->x; point[1][i] = p->y; point[2][i] = p->z;
+    }
+    alive = _mm256_andnot_si256(_mm256_cmpeq_epi32(LOADV(hp->hit_type), SET1(-1)), alive);
+
+    V3 mat = { LOADV(color[0]), LOADV(color[1]), LOADV(color[2]) };
+    V3 p = { LOADV(point[0]), LOADV(point[1]), LOADV(point[2]) };
+    v8i is_sphere = LOADV(sphere), is_light = LOADV(light);
+    V3 hit_point = v3_add(ps->orig, v3_scale(ps->dir, LOADV(hp->t)));
+    V3 oc = v3_sub(hit_point, p);
+    V3 normal = v3_blend(p, v3_scale(oc, v_inv_sqrt(v3_dot(oc, oc))), is_sphere);
+
+    // Off the light rectangle the light's plane is grey
+    v8i off = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpgt_epi32(SET1(LIGHT_X_MIN), hit_point.x), _mm256_cmpgt_epi32(hit_point.x, SET1(LIGHT_X_MAX))),
+        _mm256_or_si256(_mm256_cmpgt_epi32(SET1(LIGHT_Z_MIN), hit_point.z), _mm256_cmpgt_epi32(hit_point.z, SET1(LIGHT_Z_MAX))));
+    v8i grey = _mm256_and_si256(is_light, off);
+    mat = v3_blend(mat, v3_set((Vec3){ F(0.2), F(0.2), F(0.2) }), grey);
+    is_light = _mm256_andnot_si256(grey, is_light);
+
+    // The light ends the path; camera rays take its emission
+    v8i lit = _mm256_and_si256(alive, is_light);
+    if (b == 0)
+        ps->color = v3_blend(ps->color, v3_add(ps->color, mat), lit);
+    alive = _mm256_andnot_si256(lit, alive);
+
+    // Point on the light for the shadow ray
+    v8i u[2];
+    v_sample_2d(key, b, RAND_DIM_LIGHT, u);
+    v8i rand1 = _mm256_srli_epi32(u[0], 32 - FRAC_BITS);
+    v8i rand2 = _mm256_srli_epi32(u[1], 32 - FRAC_BITS);
+    V3 light_point = { v_fp(_mm256_add_epi32(SET1(F(-1.0)), v_mul16(SET1(F(2.0)), rand1))), SET1(F(2.99)),
+                       v_fp(_mm256_add_epi32(SET1(F(-3.2)), v_mul16(SET1(F(0.4)), rand2))) };
+    V3 light_vec = v3_sub(light_point, hit_point);
+
+    bs->hit_point = hit_point;
+    bs->hit_normal = normal;
+    bs->surface_color = mat;
+    bs->dist_sq = v3_dot(light_vec, light_vec);
+    v8i inv_dist = v_inv_sqrt(bs->dist_sq);
+    bs->light_dir = v3_scale(light_vec, inv_dist);
+    bs->light_dist = _mm256_blendv_epi8(zero, v_mul32(bs->dist_sq, inv_dist), alive);
+    bs->shadow_orig = v3_add(hit_point, v3_scale(normal, SET1(F(0.01))));
+    return alive;
+}
+
+// path_bounce() on the lanes in alive; returns the lanes that bounce on
+static v8i v_path_bounce(VPath *ps, const VBounce *bs, v8i alive, v8i occluded, int b, VKey key)
+{
+    const v8i zero = _mm256_setzero_si256();
+
+    // Direct light where the shadow ray got through and the surface and the
+    // light (normal 0, -ONE, 0) face each other
+    v8i cos_theta = v3_dot(bs->hit_normal, bs->light_dir);
+    v8i cos_alpha = v_mul16(SET1(-ONE), v3_scale(bs->light_dir, SET1(-ONE)).y);
+    v8i facing = _mm256_andnot_si256(occluded, alive);
+    facing = _mm256_and_si256(facing, _mm256_and_si256(_mm256_cmpgt_epi32(cos_theta, zero),
+                                                       _mm256_cmpgt_epi32(cos_alpha, zero)));
+    if (!_mm256_testz_si256(facing, facing)) {
+        v8i geom_term = v_div(v_mul32(cos_theta, cos_alpha), bs->dist_sq);
+        V3 direct = v3_mul(ps->attenuation, bs->surface_color);
+        direct = v3_mul(direct, v3_set(g_planes[g_light_plane].material.color));
+        direct = v3_scale(direct, geom_term);
+        direct = v3_scale(direct, SET1(F(2.0 * 0.4)));
+        direct = v3_scale(direct, SET1(F(0.3183)));
+        ps->color = v3_blend(ps->color, v3_add(ps->color, direct), facing);
+    }
+
+    ps->attenuation = v3_mul(ps->attenuation, bs->surface_color);
+
+    // Throughput-based termination
+    V3 att = ps->attenuation;
+    v8i q = _mm256_max_epi32(_mm256_max_epi32(att.x, att.y), att.z);
+    alive = _mm256_and_si256(alive, _mm256_cmpgt_epi32(q, zero));
+    if (b + 1 >= RR_START_BOUNCE && b + 1 < MAX_BOUNCES) {
+        v8i rr = _mm256_and_si256(alive, _mm256_cmpgt_epi32(SET1(ONE), q));
+        q = _mm256_max_epi32(q, SET1(RR_MIN_SURVIVAL));
+        v8i u = _mm256_srli_epi32(v_sample_1d(key, b, RAND_DIM_RR), 32 - FRAC_BITS);
+        v8i ended = _mm256_andnot_si256(_mm256_cmpgt_epi32(q, u), rr);
+        alive = _mm256_andnot_si256(ended, alive);
+        ps->attenuation = v3_blend(att, v3_scale(att, v_div(SET1(ONE), q)), _mm256_andnot_si256(ended, rr));
+    }
+
+    // The next ray leaves from the shadow ray's origin
+    ps->orig = bs->shadow_orig;
+    ps->dir = v_cosine_direction(key, b, bs->hit_normal);
+    return alive;
+}
+
+static void store_rays(RayPacket *p, V3 orig, V3 dir)
+{
+    STOREV(p->ox, orig.x); STOREV(p->oy, orig.y); STOREV(p->oz, orig.z);
+    STOREV(p->dx, dir.x);  STOREV(p->dy, dir.y);  STOREV(p->dz, dir.z);
+}
+
+Color trace_path_packet(int16_t x, int16_t y)
+{
+    Ray cam = camera_ray(x, y);
+    const v8i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const v8i lane_bit = _mm256_sllv_epi32(SET1(1), lane);
+    v8i acc_r = _mm256_setzero_si256(), acc_g = acc_r, acc_b = acc_r;
+
+    for (int s0 = 0; s0 < NUM_SAMPLES; s0 += PACKET_WIDTH) {
+        // Every lane of a pixel shares the key's seed; lanes past NUM_SAMPLES stay dead
+        VKey key = { rand_path_key(x, y, s0).seed, v_reverse_bits(_mm256_add_epi32(SET1(s0), lane)) };
+        v8i alive = _mm256_cmpgt_epi32(SET1(NUM_SAMPLES - s0), lane);
+        VPath ps = { v3_set(cam.orig), v3_set(cam.dir), v3_set((Vec3){ 0, 0, 0 }), v3_set((Vec3){ ONE, ONE, ONE }) };
+        RayPacket rp;
+
+        for (int b = 0; b < MAX_BOUNCES && !_mm256_testz_si256(alive, alive); ++b) {
+            HitPacket hp;
+            VBounce bs;
+            int32_t max_t[PACKET_WIDTH];
+
+            store_rays(&rp, ps.orig, ps.dir);
+            intersect_scene_packet(&rp, &hp);
+            alive = v_path_hit(&ps, &hp, b, key, alive, &bs);
+
+            store_rays(&rp, bs.shadow_orig, bs.light_dir);
+            STOREV(max_t, bs.light_dist);
+            v8i occ = SET1((int32_t)occluded_packet(&rp, max_t));
+            occ = _mm256_cmpeq_epi32(_mm256_and_si256(occ, lane_bit), lane_bit);
+            alive = v_path_bounce(&ps, &bs, alive, occ, b, key);
+        }
+
+        acc_r = _mm256_add_epi32(acc_r, ps.color.x);
+        acc_g = _mm256_add_epi32(acc_g, ps.color.y);
+        acc_b = _mm256_add_epi32(acc_b, ps.color.z);
+    }
+
+    int32_t sum[3][PACKET_WIDTH];
+    STOREV(sum[0], acc_r); STOREV(sum[1], acc_g); STOREV(sum[2], acc_b);
+    for (int i = 1; i < PACKET_WIDTH; ++i)
+        for (int k = 0; k < 3; ++k)
+            sum[k][0] += sum[k][i];
+    return resolve_color(sum[0][0], sum[1][0], sum[2][0], NUM_SAMPLES);
+}
+
+#else
+
+Color trace_path_packet(int16_t x, int16_t y)
+{
+    Ray cam = camera_ray(x, y);
+    int32_t acc_r = 0, acc_g = 0, acc_b = 0;
+
+    for (int s0 = 0; s0 < NUM_SAMPLES; s0 += PACKET_WIDTH) {
+        int n = NUM_SAMPLES - s0 < PACKET_WIDTH ? NUM_SAMPLES - s0 : PACKET_WIDTH;
+        PathState ps[PACKET_WIDTH];
+        BounceState bs[PACKET_WIDTH];
+        PathKey key[PACKET_WIDTH];
+        unsigned alive = 0;
+        RayPacket rp;
+        memset(&rp, 0, sizeof(rp));
+
+        for (int i = 0; i < n; ++i) {
+            key[i] = rand_path_key(x, y, s0 + i);
+            ps[i] = (PathState){cam, {F(0), F(0), F(0)}, {ONE, ONE, ONE}};
+            alive |= 1u << i;
+        }
+
+        for (int b = 0; b < MAX_BOUNCES && alive; ++b) {
+            HitPacket hp;
+            int32_t max_t[PACKET_WIDTH] = {0};
+
+            for (int i = 0; i < n; ++i)
+                if (alive & (1u << i))
+                    packet_set_ray(&rp, i, ps[i].ray);
+            intersect_scene_packet(&rp, &hp);
+
+            for (int i = 0; i < n; ++i) {
+                if (!(alive & (1u << i)))
+                    continue;
+                Intersection inter = { hp.t[i], hp.hit_type[i], hp.hit_index[i], hp.hit_type[i] != -1 };
+                if (!path_hit(&ps[i], inter, b, key[i], &bs[i])) {
+                    alive &= ~(1u << i);
+                    continue;
+                }
+                packet_set_ray(&rp, i, bs[i].shadow_ray);
+                max_t[i] = bs[i].light_dist;
+            }
+
+            unsigned occ = occluded_packet(&rp, max_t);
+            for (int i = 0; i < n; ++i)
+                if ((alive & (1u << i)) && !path_bounce(&ps[i], &bs[i], (occ >> i) & 1, b, key[i]))
+                    alive &= ~(1u << i);
+        }
+
+        for (int i = 0; i < n; ++i) {
+            acc_r += ps[i].color.x;
+            acc_g += ps[i].color.y;
+            acc_b += ps[i].color.z;
+        }
+    }
+
+    return resolve_color(acc_r, acc_g, acc_b, NUM_SAMPLES);
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "trace_path.h"
+
+// Host-side ray packets. Eight rays are traced together in structure-of-arrays
+// form; with AVX2 every fixed-point operation of intersect_sphere,
+// intersect_plane and occluded(), and of the shading in trace_path_packet,
+// runs on all eight lanes at once. Without
+// AVX2 the same entry points fall back to the scalar kernels, so both builds
+// give bit-identical results to trace_path.
+
+#define PACKET_WIDTH 8
+
+// 4.12 values widened to 32 bits, one lane per ray.
+typedef struct {
+    int32_t ox[PACKET_WIDTH], oy[PACKET_WIDTH], oz[PACKET_WIDTH];
+    int32_t dx[PACKET_WIDTH], dy[PACKET_WIDTH], dz[PACKET_WIDTH];
+} RayPacket;
+
+typedef struct {
+    int32_t t[PACKET_WIDTH];
+    int32_t hit_type[PACKET_WIDTH];   // -1 on a miss, as in intersect_scene
+    int32_t hit_index[PACKET_WIDTH];
+} HitPacket;
+
+void packet_set_ray(RayPacket *p, int lane, Ray r);
+
+// Nearest hit per lane, same tie-breaking as LOOP_K in intersect_scene.
+void intersect_scene_packet(const RayPacket *p, HitPacket *out);
+
+// Bit i set if lane i is blocked before max_t[i] (see occluded).
+unsigned occluded_packet(const RayPacket *p, const int32_t max_t[PACKET_WIDTH]);
+
+// Same result as trace_path(x, y), with NUM_SAMPLES samples traced
+// PACKET_WIDTH at a time.
+Color trace_path_packet(int16_t x, int16_t y);
+
+#endif
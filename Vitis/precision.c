@@ -0,0 +1,222 @@
+/* precision.c
+ * Image error of the fixed-point kernel against the double-precision
+ * reference (reference.c), for choosing FP_BITS / FRAC_BITS.
+ *
+ * Renders the scene with trace_path in the format this file is built with
+ * and with the reference, then reports as JSON on stdout:
+ *   - psnr_db: PSNR of the 8-bit RGB images;
+ *   - ssim: mean SSIM of the luma, 11x11 Gaussian window (sigma 1.5);
+ *   - mean/max_abs_error and pixels_above_threshold, in display levels
+ *     (largest channel difference per pixel);
+ *   - hdr_rmse: RMS difference of the mean path radiance before tone mapping,
+ *     which also sees errors hidden by clamping to white.
+ * and writes fixed.ppm, reference.ppm and error.pgm (per-pixel largest channel
+ * difference, multiplied by -g).
+ * Build (one binary per format):
+ *     gcc -std=c99 -O2 -pthread [-DFP_BITS=16 -DFRAC_BITS=12] [-DFP_SATURATE] \
+ *         precision.c reference.c render.c scene.c trace_path.c -o precision -lm
+ * Run:
+ *     ./precision [-s scene] [-t threads] [-g gain] [-e threshold]
+ *         -s  scene file (default scenes/cornell.scene); with -DCOMPILED_SCENE
+ *             it must be the file the scene was compiled from
+ *         -t  worker threads (default: every online core)
+ *         -g  error map gain (default 8)
+ *         -e  error in display levels that counts a pixel as wrong (default 4)
+ * Sweep, e.g.:
+ *     for f in 9 10 11 12; do gcc -DFRAC_BITS=$f ... -o precision && ./precision > prec_$f.json; done
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "trace_path.h"
+#include "reference.h"
+#include "render.h"
+#include "scene.h"
+
+#define SSIM_RADIUS 5
+#define SSIM_SIGMA 1.5
+
+typedef struct {
+    Color *fixed, *ref;
+    double (*fixed_hdr)[3], (*ref_hdr)[3];
+} Frames;
+
+static void trace_both(int16_t x, int16_t y, void *ctx)
+{
+    Frames *f = ctx;
+    int i = y * g_width + x;
+    int32_t sum[3];
+
+    // trace_path_sum + resolve_color is exactly trace_path, with the raw sums kept
+    trace_path_sum(x, y, 0, NUM_SAMPLES, sum);
+    f->fixed[i] = resolve_color(sum[0], sum[1], sum[2], NUM_SAMPLES);
+    for (int k = 0; k < 3; ++k)
+        f->fixed_hdr[i][k] = (double)sum[k] / NUM_SAMPLES / ONE;
+
+    ref_trace_path(x, y, f->ref_hdr[i]);
+    f->ref[i] = (Color){ ref_to_u8(f->ref_hdr[i][0]), ref_to_u8(f->ref_hdr[i][1]), ref_to_u8(f->ref_hdr[i][2]) };
+}
+
+static int write_ppm(const char *path, const Color *fb)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp) { perror(path); return -1; }
+    fprintf(fp, "P3\n%d %d\n255\n", g_width, g_height);
+    for (int y = 0; y < g_height; ++y) {
+        for (int x = 0; x < g_width; ++x)
+            fprintf(fp, "%d %d %d  ", fb[y * g_width + x].r, fb[y * g_width + x].g, fb[y * g_width + x].b);
+        fputc('\n', fp);
+    }
+    if (fclose(fp) != 0) { perror(path); return -1; }
+    return 0;
+}
+
+static int write_pgm(const char *path, const uint8_t *img)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp) { perror(path); return -1; }
+    fprintf(fp, "P2\n%d %d\n255\n", g_width, g_height);
+    for (int y = 0; y < g_height; ++y) {
+        for (int x = 0; x < g_width; ++x)
+            fprintf(fp, "%d ", img[y * g_width + x]);
+        fputc('\n', fp);
+    }
+    if (fclose(fp) != 0) { perror(path); return -1; }
+    return 0;
+}
+
+static double luma(Color c)
+{
+    return 0.299 * c.r + 0.587 * c.g + 0.114 * c.b;
+}
+
+// Mean SSIM of the luma over every pixel, with the window clipped at the
+// image border and renormalised
+static double ssim(const Color *a, const Color *b)
+{
+    const double c1 = (0.01 * 255) * (0.01 * 255), c2 = (0.03 * 255) * (0.03 * 255);
+    double w[2 * SSIM_RADIUS + 1];
+    for (int k = -SSIM_RADIUS; k <= SSIM_RADIUS; ++k)
+        w[k + SSIM_RADIUS] = exp(-(k * k) / (2 * SSIM_SIGMA * SSIM_SIGMA));
+
+    double total = 0;
+    for (int y = 0; y < g_height; ++y)
+        for (int x = 0; x < g_width; ++x) {
+            double sw = 0, ma = 0, mb = 0, aa = 0, bb = 0, ab = 0;
+            for (int dy = -SSIM_RADIUS; dy <= SSIM_RADIUS; ++dy) {
+                int yy = y + dy;
+                if (yy < 0 || yy >= g_height) continue;
+                for (int dx = -SSIM_RADIUS; dx <= SSIM_RADIUS; ++dx) {
+                    int xx = x + dx;
+                    if (xx < 0 || xx >= g_width) continue;
+                    double wk = w[dy + SSIM_RADIUS] * w[dx + SSIM_RADIUS];
+                    double la = luma(a[yy * g_width + xx]), lb = luma(b[yy * g_width + xx]);
+                    sw += wk;
+                    ma += wk * la;
+                    mb += wk * lb;
+                    aa += wk * la * la;
+                    bb += wk * lb * lb;
+                    ab += wk * la * lb;
+                }
+            }
+            ma /= sw; mb /= sw;
+            double va = aa / sw - ma * ma, vb = bb / sw - mb * mb, cov = ab / sw - ma * mb;
+            total += ((2 * ma * mb + c1) * (2 * cov + c2)) / ((ma * ma + mb * mb + c1) * (va + vb + c2));
+        }
+    return total / (g_width * g_height);
+}
+
+int main(int argc, char **argv)
+{
+    const char *scene_path = "scenes/cornell.scene";
+    int threads = 0, gain = 8, threshold = 4;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:t:g:e:")) != -1) {
+        switch (opt) {
+        case 's': scene_path = optarg; break;
+        case 't': threads = atoi(optarg); break;
+        case 'g': gain = atoi(optarg); break;
+        case 'e': threshold = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-s scene] [-t threads] [-g gain] [-e threshold]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    static SceneDesc desc;
+    if (scene_parse(scene_path, &desc) != 0) return 1;
+#ifndef COMPILED_SCENE
+    if (scene_load(scene_path) != 0) return 1;
+#endif
+    ref_set_scene(&desc);
+
+    Frames f = {
+        malloc(g_width * g_height * sizeof(Color)), malloc(g_width * g_height * sizeof(Color)),
+        malloc(g_width * g_height * sizeof(*f.fixed_hdr)), malloc(g_width * g_height * sizeof(*f.ref_hdr)),
+    };
+    uint8_t *err = malloc(g_width * g_height);
+    if (!f.fixed || !f.ref || !f.fixed_hdr || !f.ref_hdr || !err) { perror("malloc"); return 1; }
+
+    if (render_pixels(threads, trace_both, &f) != 0) {
+        fprintf(stderr, "render_pixels failed\n");
+        return 1;
+    }
+
+    double sq = 0, abs_sum = 0, hdr_sq = 0;
+    int max_abs = 0;
+    long above = 0;
+    for (int i = 0; i < g_width * g_height; ++i) {
+        int d[3] = { f.fixed[i].r - f.ref[i].r, f.fixed[i].g - f.ref[i].g, f.fixed[i].b - f.ref[i].b };
+        int worst = 0;
+        for (int k = 0; k < 3; ++k) {
+            sq += d[k] * d[k];
+            if (abs(d[k]) > worst) worst = abs(d[k]);
+            double h = f.fixed_hdr[i][k] - f.ref_hdr[i][k];
+            hdr_sq += h * h;
+        }
+        abs_sum += worst;
+        if (worst > max_abs) max_abs = worst;
+        above += worst > threshold;
+        err[i] = (uint8_t)(worst * gain > 255 ? 255 : worst * gain);
+    }
+    double mse = sq / (3.0 * g_width * g_height);
+    double psnr = mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : INFINITY;
+
+    int ret = 0;
+    if (write_ppm("fixed.ppm", f.fixed) != 0 || write_ppm("reference.ppm", f.ref) != 0
+        || write_pgm("error.pgm", err) != 0)
+        ret = 1;
+
+    printf("{\n");
+    printf("  \"format\": {\"fp_bits\": %d, \"frac_bits\": %d, \"saturate\": %s},\n",
+           FP_BITS, FRAC_BITS,
+#ifdef FP_SATURATE
+           "true"
+#else
+           "false"
+#endif
+           );
+    printf("  \"scene\": \"%s\",\n", scene_path);
+    printf("  \"num_samples\": %d,\n", NUM_SAMPLES);
+    if (isinf(psnr))
+        printf("  \"psnr_db\": null,\n");   // identical images; JSON has no infinity
+    else
+        printf("  \"psnr_db\": %.3f,\n", psnr);
+    printf("  \"ssim\": %.5f,\n", ssim(f.fixed, f.ref));
+    printf("  \"mean_abs_error\": %.4f,\n", abs_sum / (g_width * g_height));
+    printf("  \"max_abs_error\": %d,\n", max_abs);
+    printf("  \"threshold\": %d,\n", threshold);
+    printf("  \"pixels_above_threshold\": %ld,\n", above);
+    printf("  \"hdr_rmse\": %.6f\n", sqrt(hdr_sq / (3.0 * g_width * g_height)));
+    printf("}\n");
+
+    free(f.fixed); free(f.ref); free(f.fixed_hdr); free(f.ref_hdr); free(err);
+    return ret;
+}
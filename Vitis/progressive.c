@@ -0,0 +1,216 @@
+/* progressive.c
+ * Progressive accumulation buffer for the host testbench (see progressive.h).
+ *
+ * Checkpoint layout: a text header
+ *     "RSACC 2 <width> <height> <samples> <scene> <config>\n"
+ * followed by g_width * g_height * 3 int64_t sums. <scene> is a hash of the
+ * scene arrays (8 hex digits) and <config> names the kernel settings that
+ * change what a sample adds, e.g. "fp16.12-b3-rr3.1024-d3"; a checkpoint is
+ * only resumed when both match the running build and scene.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "progressive.h"
+#include "render.h"
+
+#define ACCUM_MAGIC "RSACC"
+#define ACCUM_VERSION 2
+#define NUM_PIXELS (g_width * g_height)
+#define CONFIG_LEN 64
+
+#ifdef FP_SATURATE
+#define FP_MODE "s"
+#else
+#define FP_MODE ""
+#endif
+
+typedef struct {
+    Accum *a;
+    int first, count;
+} PassCtx;
+
+int accum_init(Accum *a)
+{
+    a->sum = calloc(NUM_PIXELS, sizeof(*a->sum));
+    a->samples = 0;
+    return a->sum ? 0 : -1;
+}
+
+void accum_free(Accum *a)
+{
+    free(a->sum);
+    a->sum = NULL;
+}
+
+// Each pixel is visited by exactly one worker, so no locking is needed
+static void pass_pixel(int16_t x, int16_t y, void *ctx)
+{
+    PassCtx *p = (PassCtx *)ctx;
+    int32_t s[3];
+    trace_path_sum(x, y, p->first, p->count, s);
+
+    int64_t *dst = p->a->sum[y * g_width + x];
+    dst[0] += s[0];
+    dst[1] += s[1];
+    dst[2] += s[2];
+}
+
+int accum_pass(Accum *a, int num_threads, int samples)
+{
+    PassCtx p = { a, (int)a->samples, samples };
+    if (render_pixels(num_threads, pass_pixel, &p) != 0)
+        return -1;
+    a->samples += samples;
+    return 0;
+}
+
+void accum_resolve(const Accum *a, Color *fb)
+{
+    for (int i = 0; i < NUM_PIXELS; ++i) {
+        const int64_t *s = a->sum[i];
+        fb[i] = resolve_color((int32_t)(s[0] / a->samples), (int32_t)(s[1] / a->samples),
+                              (int32_t)(s[2] / a->samples), 1);
+    }
+}
+
+void accum_resolve_hdr(const Accum *a, float (*hdr)[3])
+{
+    const double scale = 1.0 / ((double)a->samples * ONE);
+    for (int i = 0; i < NUM_PIXELS; ++i)
+        for (int k = 0; k < 3; ++k)
+            hdr[i][k] = (float)(a->sum[i][k] * scale);
+}
+
+// FNV-1a over the scene, one field at a time so struct padding is left out
+static uint32_t hash_word(uint32_t h, int32_t v)
+{
+    for (int i = 0; i < 4; ++i) {
+        h ^= (uint8_t)((uint32_t)v >> (8 * i));
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t hash_vec(uint32_t h, Vec3 v)
+{
+    return hash_word(hash_word(hash_word(h, v.x), v.y), v.z);
+}
+
+static uint32_t hash_material(uint32_t h, Material m)
+{
+    return hash_word(hash_vec(h, m.color), m.is_light);
+}
+
+static uint32_t scene_hash(void)
+{
+    uint32_t h = 2166136261u;
+    h = hash_word(h, g_num_spheres);
+    for (int i = 0; i < g_num_spheres; ++i)
+        h = hash_material(hash_word(hash_vec(h, g_spheres[i].center), g_spheres[i].radius),
+                          g_spheres[i].material);
+    h = hash_word(h, g_num_planes);
+    for (int i = 0; i < g_num_planes; ++i)
+        h = hash_material(hash_word(hash_vec(h, g_planes[i].normal), g_planes[i].dist),
+                          g_planes[i].material);
+    return hash_word(h, g_light_plane);
+}
+
+// Fixed-point format, bounce limit, Russian roulette and sampler dimensions
+static void kernel_config(char *buf, size_t len)
+{
+    snprintf(buf, len, "fp%d.%d%s-b%d-rr%d.%d-d%d", FP_BITS, FRAC_BITS, FP_MODE,
+             MAX_BOUNCES, RR_START_BOUNCE, (int)RR_MIN_SURVIVAL, RAND_DIMS);
+}
+
+int accum_save(const Accum *a, const char *path)
+{
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        fprintf(stderr, "%s: path too long\n", path);
+        return -1;
+    }
+
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) { perror(tmp); return -1; }
+
+    char config[CONFIG_LEN];
+    kernel_config(config, sizeof(config));
+    fprintf(fp, "%s %d %d %d %u %08x %s\n", ACCUM_MAGIC, ACCUM_VERSION, g_width, g_height,
+            a->samples, (unsigned)scene_hash(), config);
+    size_t n = fwrite(a->sum, sizeof(*a->sum), NUM_PIXELS, fp);
+    if (fclose(fp) != 0 || n != (size_t)NUM_PIXELS) {
+        perror(tmp);
+        remove(tmp);
+        return -1;
+    }
+    if (rename(tmp, path) != 0) {
+        perror(path);
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int accum_load(Accum *a, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) { perror(path); return -1; }
+
+    char magic[8];
+    int version, w, h;
+    if (fscanf(fp, "%7s %d", magic, &version) != 2 || strcmp(magic, ACCUM_MAGIC) != 0) {
+        fprintf(stderr, "%s: not a checkpoint\n", path);
+        fclose(fp);
+        return -1;
+    }
+    if (version != ACCUM_VERSION) {
+        fprintf(stderr, "%s: checkpoint is version %d; expected version %d\n",
+                path, version, ACCUM_VERSION);
+        fclose(fp);
+        return -1;
+    }
+    unsigned samples, scene;
+    char config[CONFIG_LEN], expected[CONFIG_LEN];
+    if (fscanf(fp, "%d %d %u %x %63s", &w, &h, &samples, &scene, config) != 5
+        || fgetc(fp) != '\n') {
+        fprintf(stderr, "%s: not a checkpoint\n", path);
+        fclose(fp);
+        return -1;
+    }
+    kernel_config(expected, sizeof(expected));
+    if (w != g_width || h != g_height) {
+        fprintf(stderr, "%s: checkpoint is %dx%d; expected %dx%d\n", path, w, h, g_width, g_height);
+        fclose(fp);
+        return -1;
+    }
+    if (scene != (unsigned)scene_hash()) {
+        fprintf(stderr, "%s: checkpoint was rendered from a different scene\n", path);
+        fclose(fp);
+        return -1;
+    }
+    if (strcmp(config, expected) != 0) {
+        fprintf(stderr, "%s: checkpoint kernel config is %s; this build is %s\n", path, config, expected);
+        fclose(fp);
+        return -1;
+    }
+
+    int64_t (*sum)[3] = malloc(NUM_PIXELS * sizeof(*sum));
+    if (!sum) { perror("malloc"); fclose(fp); return -1; }
+    if (fread(sum, sizeof(*sum), NUM_PIXELS, fp) != (size_t)NUM_PIXELS) {
+        fprintf(stderr, "%s: truncated checkpoint\n", path);
+        free(sum);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    free(a->sum);
+    a->sum = sum;
+    a->samples = samples;
+    return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include "trace_path.h"
+
+// Host-side progressive rendering. Instead of squashing each pixel to 8 bits
+// straight away, the raw 4.12 path colours are summed into a wide per-pixel
+// buffer, one pass of samples at a time. A preview can be tone mapped from it
+// after any pass, and the buffer can be saved to disk and resumed later.
+//
+// Pass k of n samples traces sample indices [k*n, (k+1)*n), so P passes of n
+// give exactly the image trace_path gives with NUM_SAMPLES = P*n, however the
+// run was split up or resumed.
+
+typedef struct {
+    int64_t (*sum)[3];  // g_width * g_height row-major r, g, b sums (4.12)
+    uint32_t samples;   // samples per pixel accumulated so far
+} Accum;
+
+// Allocates an empty buffer. Returns 0 on success, -1 if out of memory.
+int accum_init(Accum *a);
+void accum_free(Accum *a);
+
+// Traces `samples` more samples for every pixel and adds them in. Returns 0
+// on success, -1 on error.
+int accum_pass(Accum *a, int num_threads, int samples);
+
+// Tone maps the current average into fb (g_width * g_height), with the same
+// mapping trace_path uses. a->samples must be non-zero.
+void accum_resolve(const Accum *a, Color *fb);
+// The current average as linear colour (1.0 is ONE), for HDR output.
+void accum_resolve_hdr(const Accum *a, float (*hdr)[3]);
+
+// Checkpoints. The file is written under a temporary name and renamed, so an
+// interrupted save leaves the previous checkpoint intact. Sums are stored in
+// host byte order. The header records the resolution, a hash of the scene and
+// the kernel config (fixed-point format, MAX_BOUNCES, Russian roulette,
+// RAND_DIMS); a load refuses a checkpoint whose values differ from this build
+// and scene. Both return 0 on success, -1 on error (message on stderr); a
+// failed load leaves the buffer untouched.
+int accum_save(const Accum *a, const char *path);
+int accum_load(Accum *a, const char *path);
+
+#endif
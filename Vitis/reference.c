@@ -0,0 +1,235 @@
+/* reference.c
+ * Double-precision version of trace_path for measuring fixed-point error.
+ *
+ * Each stage mirrors the kernel one for one (camera_ray, intersect_scene,
+ * path_hit, occluded, path_bounce), including its modelling choices:
+ * the 0.01 surface offset, the light rectangle and the 1/pi of 0.3183. It
+ * draws the same sample_2d() points, but maps them with exact roots and
+ * trigonometry, so only the number format differs. Spheres are tested one by
+ * one; there is no BVH.
+ */
+
+#include <math.h>
+
+#include "reference.h"
+
+#define REF_EPS (1.0 / 4096)        // FP_EPS at 4.12
+#define REF_SURFACE_OFFSET 0.01
+// Light rectangle and sample area; keep in step with LIGHT_* and path_hit()
+#define REF_LIGHT_X_MIN -1.0
+#define REF_LIGHT_X_MAX 1.0
+#define REF_LIGHT_Y 2.99
+#define REF_LIGHT_Z_MIN -3.2
+#define REF_LIGHT_Z_MAX -2.8
+#define REF_INV_PI 0.3183
+#define REF_RR_MIN_SURVIVAL 0.25    // RR_MIN_SURVIVAL
+#define REF_TWO_PI 6.283185307179586
+
+typedef struct {
+    double x, y, z;
+} DVec3;
+
+typedef struct {
+    DVec3 orig, dir;
+} DRay;
+
+static const SceneDesc *s_scene;
+
+static DVec3 dv(const double v[3]) { return (DVec3){ v[0], v[1], v[2] }; }
+static DVec3 dadd(DVec3 a, DVec3 b) { return (DVec3){ a.x + b.x, a.y + b.y, a.z + b.z }; }
+static DVec3 dsub(DVec3 a, DVec3 b) { return (DVec3){ a.x - b.x, a.y - b.y, a.z - b.z }; }
+static DVec3 dmul(DVec3 a, DVec3 b) { return (DVec3){ a.x * b.x, a.y * b.y, a.z * b.z }; }
+static DVec3 dscale(DVec3 v, double s) { return (DVec3){ v.x * s, v.y * s, v.z * s }; }
+static double ddot(DVec3 a, DVec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+static DVec3 dnorm(DVec3 v)
+{
+    double len = sqrt(ddot(v, v));
+    return len > 0 ? dscale(v, 1.0 / len) : v;
+}
+
+void ref_set_scene(const SceneDesc *scene)
+{
+    s_scene = scene;
+}
+
+static int on_light(DVec3 p)
+{
+    return p.x >= REF_LIGHT_X_MIN && p.x <= REF_LIGHT_X_MAX && p.z >= REF_LIGHT_Z_MIN && p.z <= REF_LIGHT_Z_MAX;
+}
+
+static double hit_sphere(DRay r, const SphereDesc *s)
+{
+    DVec3 oc = dsub(r.orig, dv(s->center));
+    double a = ddot(r.dir, r.dir);
+    double b = 2 * ddot(oc, r.dir);
+    double c = ddot(oc, oc) - s->radius * s->radius;
+    double disc = b * b - 4 * a * c;
+    if (disc < 0) return INFINITY;
+    double sq = sqrt(disc);
+    double t = (-b - sq) / (2 * a);
+    if (t > REF_EPS) return t;
+    t = (-b + sq) / (2 * a);
+    return t > REF_EPS ? t : INFINITY;
+}
+
+static double hit_plane(DRay r, const PlaneDesc *p)
+{
+    DVec3 n = dv(p->normal);
+    double denom = ddot(n, r.dir);
+    if (fabs(denom) < REF_EPS) return INFINITY;
+    double t = ddot(n, dsub(dscale(n, p->dist), r.orig)) / denom;
+    if (t <= REF_EPS) return INFINITY;
+    if (p->is_light && !on_light(dadd(r.orig, dscale(r.dir, t)))) return INFINITY;
+    return t;
+}
+
+// Nearest hit, spheres then planes with strict '<' like intersect_scene.
+// Returns the distance (INFINITY on a miss) and the primitive in *type/*index.
+static double nearest(DRay r, int *type, int *index)
+{
+    double best = INFINITY;
+    *type = -1;
+    for (int i = 0; i < s_scene->num_spheres; ++i) {
+        double t = hit_sphere(r, &s_scene->spheres[i]);
+        if (t < best) { best = t; *type = 0; *index = i; }
+    }
+    for (int j = 0; j < s_scene->num_planes; ++j) {
+        double t = hit_plane(r, &s_scene->planes[j]);
+        if (t < best) { best = t; *type = 1; *index = j; }
+    }
+    return best;
+}
+
+// Points on the floor are exactly as far from the ceiling as from the light
+// along the shadow ray (the ray starts 0.01 up, the light hangs 0.01 below the
+// ceiling), so t^2 == dist_sq ties are common. Exact arithmetic, which the
+// reference stands for, resolves them as unoccluded; the margin keeps double
+// rounding from deciding them.
+#define REF_SHADOW_MARGIN (1 - 1e-9)
+
+static int ref_occluded(DRay r, double dist_sq)
+{
+    dist_sq *= REF_SHADOW_MARGIN;
+    for (int i = 0; i < s_scene->num_spheres; ++i) {
+        double t = hit_sphere(r, &s_scene->spheres[i]);
+        if (t * t < dist_sq) return 1;
+    }
+    for (int j = 0; j < s_scene->num_planes; ++j) {
+        if (s_scene->planes[j].is_light) continue;
+        double t = hit_plane(r, &s_scene->planes[j]);
+        if (t * t < dist_sq) return 1;
+    }
+    return 0;
+}
+
+static void rand_unit_2d(PathKey key, int bounce, int dim, double u[2])
+{
+    uint32_t v[2];
+    sample_2d(key, bounce, dim, v);
+    u[0] = v[0] * (1.0 / 4294967296.0);
+    u[1] = v[1] * (1.0 / 4294967296.0);
+}
+
+// cosine_direction() with exact roots and trigonometry
+static DVec3 cosine_dir(PathKey key, int bounce, DVec3 n)
+{
+    double u[2];
+    rand_unit_2d(key, bounce, RAND_DIM_BOUNCE, u);
+    double r = sqrt(u[0]), h = sqrt(1 - u[0]), phi = REF_TWO_PI * u[1];
+    double sign = n.z >= 0 ? 1 : -1;
+    double a = -1 / (sign + n.z), b = n.x * n.y * a;
+    DVec3 t = { 1 + sign * n.x * n.x * a, sign * b, -sign * n.x };
+    DVec3 bt = { b, sign + n.y * n.y * a, -n.y };
+    return dadd(dadd(dscale(t, r * cos(phi)), dscale(bt, r * sin(phi))), dscale(n, h));
+}
+
+static DVec3 trace_sample(DRay ray, int16_t x, int16_t y, int sample)
+{
+    PathKey key = rand_path_key(x, y, sample);
+    DVec3 color = { 0, 0, 0 }, attenuation = { 1, 1, 1 };
+    DVec3 light_color = dv(s_scene->planes[s_scene->light_plane].color);
+
+    for (int b = 0; b < MAX_BOUNCES; ++b) {
+        int type, index;
+        double t = nearest(ray, &type, &index);
+        if (type < 0)
+            break;
+
+        DVec3 p = dadd(ray.orig, dscale(ray.dir, t));
+        DVec3 n, surface;
+        if (type == 0) {
+            const SphereDesc *s = &s_scene->spheres[index];
+            n = dnorm(dsub(p, dv(s->center)));
+            surface = dv(s->color);
+        } else {
+            const PlaneDesc *pl = &s_scene->planes[index];
+            n = dv(pl->normal);
+            surface = dv(pl->color);
+            if (pl->is_light) {
+                // Emission for camera rays only, then the path ends
+                if (on_light(p)) {
+                    if (b == 0) color = dadd(color, surface);
+                    break;
+                }
+                surface = (DVec3){ 0.2, 0.2, 0.2 };
+            }
+        }
+
+        double u[2];
+        rand_unit_2d(key, b, RAND_DIM_LIGHT, u);
+        DVec3 light_point = { REF_LIGHT_X_MIN + (REF_LIGHT_X_MAX - REF_LIGHT_X_MIN) * u[0],
+                              REF_LIGHT_Y,
+                              REF_LIGHT_Z_MIN + (REF_LIGHT_Z_MAX - REF_LIGHT_Z_MIN) * u[1] };
+        DVec3 light_vec = dsub(light_point, p);
+        double dist_sq = ddot(light_vec, light_vec);
+        DVec3 light_dir = dnorm(light_vec);
+        DVec3 offset_p = dadd(p, dscale(n, REF_SURFACE_OFFSET));
+
+        if (!ref_occluded((DRay){ offset_p, light_dir }, dist_sq)) {
+            double cos_theta = ddot(n, light_dir);
+            double cos_alpha = light_dir.y;     // light normal is (0, -1, 0)
+            if (cos_theta > 0 && cos_alpha > 0) {
+                double area = (REF_LIGHT_X_MAX - REF_LIGHT_X_MIN) * (REF_LIGHT_Z_MAX - REF_LIGHT_Z_MIN);
+                double g = cos_theta * cos_alpha / dist_sq * area * REF_INV_PI;
+                color = dadd(color, dscale(dmul(dmul(attenuation, surface), light_color), g));
+            }
+        }
+
+        attenuation = dmul(attenuation, surface);
+
+        // Russian roulette, drawing the same number as path_bounce
+        double q = fmax(attenuation.x, fmax(attenuation.y, attenuation.z));
+        if (q <= 0)
+            break;
+        if (b + 1 >= RR_START_BOUNCE && b + 1 < MAX_BOUNCES && q < 1) {
+            q = fmax(q, REF_RR_MIN_SURVIVAL);
+            if (sample_1d(key, b, RAND_DIM_RR) * (1.0 / 4294967296.0) >= q)
+                break;
+            attenuation = dscale(attenuation, 1 / q);
+        }
+        ray = (DRay){ offset_p, cosine_dir(key, b, n) };
+    }
+    return color;
+}
+
+void ref_trace_path(int16_t x, int16_t y, double rgb[3])
+{
+    // Square pixels, FOV vertical, as camera_ray
+    double aspect = (double)g_width / g_height;
+    DRay cam = { { 0, 0.8, 2 }, { (2.0 * x / g_height - aspect) * FOV_SCALE, (1 - 2.0 * y / g_height) * FOV_SCALE, -1 } };
+    cam.dir = dnorm(cam.dir);
+
+    DVec3 sum = { 0, 0, 0 };
+    for (int sample = 0; sample < NUM_SAMPLES; ++sample)
+        sum = dadd(sum, trace_sample(cam, x, y, sample));
+    rgb[0] = sum.x / NUM_SAMPLES;
+    rgb[1] = sum.y / NUM_SAMPLES;
+    rgb[2] = sum.z / NUM_SAMPLES;
+}
+
+uint8_t ref_to_u8(double v)
+{
+    double d = v * (1 << BRIGHTNESS_SHIFT) * 255 + 0.5;
+    return d >= 255 ? 255 : (d <= 0 ? 0 : (uint8_t)d);
+}
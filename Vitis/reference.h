@@ -0,0 +1,23 @@
+#ifndef REFERENCE_H
+#define REFERENCE_H
+
+#include "trace_path.h"
+#include "scene.h"
+
+// Double-precision reference renderer. Traces the same paths as trace_path:
+// same camera, light samples and bounce directions (it draws the kernel's own
+// random numbers), but with no fixed-point rounding or overflow, and with the
+// scene in the exact values of the scene file. The difference between the two
+// images is the error of the fixed-point format alone. Host builds only.
+
+// Scene to trace; must stay alive while rendering.
+void ref_set_scene(const SceneDesc *scene);
+
+// Mean path radiance of pixel (x, y) over NUM_SAMPLES samples, before tone
+// mapping (the value trace_path averages before fp_to_u8).
+void ref_trace_path(int16_t x, int16_t y, double rgb[3]);
+
+// Display value of a radiance, rounded (fp_to_u8 truncates).
+uint8_t ref_to_u8(double v);
+
+#endif
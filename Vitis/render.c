@@ -0,0 +1,281 @@
+/* render.c
+ * Multithreaded tile renderer for the host build of trace_path.
+ *
+ * The frame is cut into TILE_SIZE x TILE_SIZE tiles, taken in Morton (Z)
+ * order: a run of consecutive tiles is then a compact patch of the frame
+ * rather than a strip, so the rays a worker traces one after another start
+ * close together and keep hitting the same BVH nodes. Each worker starts with
+ * a contiguous run of tiles in its own deque and traces them front to back;
+ * once its deque is empty it steals the back half of another worker's run.
+ * The random numbers inside trace_path are keyed on the pixel, so the image
+ * is bit-identical whatever the thread count, order or steal order.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "render.h"
+
+#define TILES_X ((g_width  + TILE_SIZE - 1) / TILE_SIZE)
+#define TILES_Y ((g_height + TILE_SIZE - 1) / TILE_SIZE)
+#define NUM_TILES (TILES_X * TILES_Y)
+
+// Which pixels of each tile a pass traces
+enum { PASS_ALL, PASS_COARSE, PASS_FINE };
+
+// Range of positions [head, tail) in the tile order still owned by one worker.
+typedef struct {
+    pthread_mutex_t lock;
+    int head, tail;
+} TileDeque;
+
+typedef struct {
+    TileDeque *deques;
+    int num_workers;
+    PixelFn pixel;
+    BandFn band_done;
+    void *ctx;
+    const int *order;           // tile indices in the order they are handed out
+    int pass;
+    pthread_mutex_t band_lock;
+    int *band_left;             // tiles of each band not yet traced
+} RenderJob;
+
+// render_frame on top of render_pixels: trace a pixel into the framebuffer.
+typedef struct {
+    Color *fb;
+    TraceFn trace;
+} FrameCtx;
+
+typedef struct {
+    RenderJob *job;
+    int id;
+} Worker;
+
+int render_default_threads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+// Tile indices in Morton order: the bits of the tile's column and row
+// interleaved, over the smallest power-of-two square that covers the frame,
+// leaving out the tiles past its edges.
+static int *morton_order(void)
+{
+    int side = 1;
+    while (side < TILES_X || side < TILES_Y)
+        side <<= 1;
+    int *order = malloc(NUM_TILES * sizeof(*order));
+    if (!order)
+        return NULL;
+    int n = 0;
+    for (long m = 0; m < (long)side * side; ++m) {
+        int tx = 0, ty = 0;
+        for (int b = 0; (1 << b) < side; ++b) {
+            tx |= (int)((m >> (2 * b)) & 1) << b;
+            ty |= (int)((m >> (2 * b + 1)) & 1) << b;
+        }
+        if (tx < TILES_X && ty < TILES_Y)
+            order[n++] = ty * TILES_X + tx;
+    }
+    return order;
+}
+
+static void render_tile(const RenderJob *job, int tile)
+{
+    int x0 = (tile % TILES_X) * TILE_SIZE;
+    int y0 = (tile / TILES_X) * TILE_SIZE;
+    int x1 = x0 + TILE_SIZE < g_width  ? x0 + TILE_SIZE : g_width;
+    int y1 = y0 + TILE_SIZE < g_height ? y0 + TILE_SIZE : g_height;
+
+    if (job->pass == PASS_COARSE) {
+        for (int y = y0; y < y1; y += PREVIEW_STEP)
+            for (int x = x0; x < x1; x += PREVIEW_STEP)
+                job->pixel(x, y, job->ctx);
+        return;
+    }
+    for (int y = y0; y < y1; ++y)
+        for (int x = x0; x < x1; ++x)
+            if (job->pass == PASS_ALL || x % PREVIEW_STEP != 0 || y % PREVIEW_STEP != 0)
+                job->pixel(x, y, job->ctx);
+}
+
+// Owner side: take the next tile from the front of our own run.
+static int pop_local(TileDeque *d)
+{
+    int pos = -1;
+    pthread_mutex_lock(&d->lock);
+    if (d->head < d->tail)
+        pos = d->head++;
+    pthread_mutex_unlock(&d->lock);
+    return pos;
+}
+
+// Thief side: move the back half of a victim's run into our own deque and
+// return the first position of it. Returns -1 once every deque is empty.
+static int steal(RenderJob *job, int self)
+{
+    for (int i = 1; i < job->num_workers; ++i) {
+        TileDeque *victim = &job->deques[(self + i) % job->num_workers];
+        int lo, hi;
+
+        pthread_mutex_lock(&victim->lock);
+        hi = victim->tail;
+        lo = hi - (hi - victim->head + 1) / 2;
+        victim->tail = lo;
+        pthread_mutex_unlock(&victim->lock);
+
+        if (lo < hi) {
+            TileDeque *own = &job->deques[self];
+            pthread_mutex_lock(&own->lock);
+            own->head = lo + 1;
+            own->tail = hi;
+            pthread_mutex_unlock(&own->lock);
+            return lo;
+        }
+    }
+    return -1;
+}
+
+static void *worker_main(void *arg)
+{
+    Worker *w = (Worker *)arg;
+    RenderJob *job = w->job;
+
+    for (;;) {
+        int pos = pop_local(&job->deques[w->id]);
+        if (pos < 0)
+            pos = steal(job, w->id);
+        if (pos < 0)
+            break;  // no work is ever added, so empty everywhere means done
+        int tile = job->order[pos];
+        render_tile(job, tile);
+
+        if (job->band_done) {
+            int band = tile / TILES_X;
+            pthread_mutex_lock(&job->band_lock);
+            int left = --job->band_left[band];
+            pthread_mutex_unlock(&job->band_lock);
+            if (left == 0) {
+                int y1 = (band + 1) * TILE_SIZE;
+                job->band_done(band * TILE_SIZE, y1 < g_height ? y1 : g_height, job->ctx);
+            }
+        }
+    }
+    return NULL;
+}
+
+int render_pixels(int num_threads, PixelFn pixel, void *ctx)
+{
+    return render_pixels_banded(num_threads, pixel, NULL, ctx);
+}
+
+// One pass over every tile of the job on the pool
+static int run_pass(RenderJob *job, int num_threads)
+{
+    TileDeque *deques = malloc(num_threads * sizeof(*deques));
+    Worker *workers = malloc(num_threads * sizeof(*workers));
+    pthread_t *threads = malloc(num_threads * sizeof(*threads));
+    if (!deques || !workers || !threads) {
+        free(deques); free(workers); free(threads);
+        return -1;
+    }
+    job->deques = deques;
+    job->num_workers = num_threads;
+    for (int b = 0; b < TILES_Y; ++b)
+        job->band_left[b] = TILES_X;
+
+    // Hand out contiguous runs of tiles so neighbouring tiles share a worker.
+    for (int i = 0; i < num_threads; ++i) {
+        pthread_mutex_init(&deques[i].lock, NULL);
+        deques[i].head = (int)((long)NUM_TILES * i / num_threads);
+        deques[i].tail = (int)((long)NUM_TILES * (i + 1) / num_threads);
+        workers[i].job = job;
+        workers[i].id = i;
+    }
+
+    // Worker 0 runs on the calling thread. If a thread fails to start, its
+    // tiles are simply stolen by the ones that did.
+    int started = 1;
+    for (; started < num_threads; ++started)
+        if (pthread_create(&threads[started], NULL, worker_main, &workers[started]) != 0)
+            break;
+    worker_main(&workers[0]);
+    for (int i = 1; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < num_threads; ++i)
+        pthread_mutex_destroy(&deques[i].lock);
+    free(deques); free(workers); free(threads);
+    return 0;
+}
+
+static int render_passes(int num_threads, PixelFn pixel, PreviewFn preview_done, BandFn band_done, void *ctx)
+{
+    if (num_threads <= 0)
+        num_threads = render_default_threads();
+    if (num_threads > NUM_TILES)
+        num_threads = NUM_TILES;
+
+    int *order = morton_order();
+    int *band_left = malloc(TILES_Y * sizeof(*band_left));
+    if (!order || !band_left) {
+        free(order); free(band_left);
+        return -1;
+    }
+
+    RenderJob job = {
+        .pixel = pixel,
+        .band_done = band_done,
+        .ctx = ctx,
+        .order = order,
+        .pass = PASS_ALL,
+        .band_left = band_left,
+    };
+    pthread_mutex_init(&job.band_lock, NULL);
+    int ret;
+    if (preview_done) {
+        // Bands are only done once the fine pass has been through them
+        job.pass = PASS_COARSE;
+        job.band_done = NULL;
+        ret = run_pass(&job, num_threads);
+        if (ret == 0) {
+            preview_done(ctx);
+            job.pass = PASS_FINE;
+            job.band_done = band_done;
+            ret = run_pass(&job, num_threads);
+        }
+    } else {
+        ret = run_pass(&job, num_threads);
+    }
+    pthread_mutex_destroy(&job.band_lock);
+    free(order);
+    free(band_left);
+    return ret;
+}
+
+int render_pixels_banded(int num_threads, PixelFn pixel, BandFn band_done, void *ctx)
+{
+    return render_passes(num_threads, pixel, NULL, band_done, ctx);
+}
+
+int render_pixels_preview(int num_threads, PixelFn pixel, PreviewFn preview_done, BandFn band_done, void *ctx)
+{
+    return render_passes(num_threads, pixel, preview_done, band_done, ctx);
+}
+
+static void frame_pixel(int16_t x, int16_t y, void *ctx)
+{
+    FrameCtx *f = (FrameCtx *)ctx;
+    f->fb[y * g_width + x] = f->trace(x, y);
+}
+
+int render_frame(Color *fb, int num_threads, TraceFn trace)
+{
+    FrameCtx f = { fb, trace };
+    return render_pixels(num_threads, frame_pixel, &f);
+}
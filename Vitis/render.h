@@ -0,0 +1,48 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "trace_path.h"
+
+// Host-side render driver. Splits the frame into tiles and runs trace_path on
+// a work-stealing thread pool. Not synthesised — C-sim / host builds only.
+
+#define TILE_SIZE 16
+// Spacing of the coarse preview's pixels; divides TILE_SIZE
+#define PREVIEW_STEP 4
+
+// Per-pixel tracer: trace_path, or trace_path_packet from packet.h.
+typedef Color (*TraceFn)(int16_t x, int16_t y);
+
+// Renders a g_width x g_height frame into fb (row-major) with the given tracer.
+// num_threads <= 0 uses every online core. Returns 0 on success, -1 if out of
+// memory.
+int render_frame(Color *fb, int num_threads, TraceFn trace);
+
+// Per-pixel work item for render_pixels; ctx is passed through unchanged.
+typedef void (*PixelFn)(int16_t x, int16_t y, void *ctx);
+
+// Calls pixel() exactly once for every pixel of the frame, spread over the
+// same tile pool as render_frame. Same return values as render_frame.
+int render_pixels(int num_threads, PixelFn pixel, void *ctx);
+
+// Called for every band of rows [y0, y1) (one row of tiles) as soon as all of
+// its pixels are done, on the worker that finished its last tile. Bands
+// complete in any order, and different bands can be in it at the same time.
+typedef void (*BandFn)(int y0, int y1, void *ctx);
+
+// render_pixels that also calls band_done, if not NULL, as bands complete.
+int render_pixels_banded(int num_threads, PixelFn pixel, BandFn band_done, void *ctx);
+
+// Called once the coarse pass of render_pixels_preview is done, before any
+// other pixel is traced.
+typedef void (*PreviewFn)(void *ctx);
+
+// render_pixels_banded in two passes: first every pixel whose x and y are
+// multiples of PREVIEW_STEP (1/16 of the frame, spread over all of it), then
+// preview_done, then the rest. Still calls pixel() once for every pixel.
+int render_pixels_preview(int num_threads, PixelFn pixel, PreviewFn preview_done, BandFn band_done, void *ctx);
+
+// Number of online cores, at least 1.
+int render_default_threads(void);
+
+#endif
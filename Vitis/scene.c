@@ -0,0 +1,217 @@
+/* scene.c
+ * Scene file loader and BVH builder for the host testbench.
+ *
+ * The BVH is built once per scene: spheres are split at the median centroid
+ * along the longest axis until at most BVH_LEAF_SIZE remain, and g_spheres is
+ * reordered so every leaf covers a contiguous range. Nodes are written into
+ * the flat g_bvh table with both children of a node next to each other, which
+ * is what the kernel's stack traversal expects.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scene.h"
+
+// Parsed scene, only copied into the kernel arrays once the whole file is valid
+static SceneDesc s_desc;
+static Sphere s_spheres[MAX_SPHERES];
+static Plane s_planes[MAX_PLANES];
+
+static int to_fp(double v, fp_t *out)
+{
+    double q = v * ONE;
+    if (!(q > FP_MIN - 0.5 && q < FP_MAX + 0.5))    // also rejects NaN
+        return -1;
+    *out = (fp_t)lround(q);
+    return 0;
+}
+
+static int to_vec(const double v[3], Vec3 *out)
+{
+    return to_fp(v[0], &out->x) | to_fp(v[1], &out->y) | to_fp(v[2], &out->z);
+}
+
+int scene_parse(const char *path, SceneDesc *desc)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp) { perror(path); return -1; }
+
+    desc->num_spheres = desc->num_planes = 0;
+    desc->light_plane = -1;
+    char line[256];
+    int lineno = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        ++lineno;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        char kind[16], flag[16] = "";
+        double a[3], w, c[3];
+        int n = sscanf(line, "%15s %lf %lf %lf %lf %lf %lf %lf %15s",
+                       kind, &a[0], &a[1], &a[2], &w, &c[0], &c[1], &c[2], flag);
+        if (n <= 0)
+            continue;   // blank or comment-only line
+        if (n < 8) {
+            fprintf(stderr, "%s:%d: expected <kind> x y z w r g b\n", path, lineno);
+            goto fail;
+        }
+
+        if (strcmp(kind, "sphere") == 0) {
+            if (n == 9) {
+                fprintf(stderr, "%s:%d: only planes can be lights\n", path, lineno);
+                goto fail;
+            }
+            if (desc->num_spheres == MAX_SPHERES) {
+                fprintf(stderr, "%s:%d: more than %d spheres\n", path, lineno, MAX_SPHERES);
+                goto fail;
+            }
+            if (!(w > 0)) {
+                fprintf(stderr, "%s:%d: sphere radius must be positive\n", path, lineno);
+                goto fail;
+            }
+            SphereDesc *s = &desc->spheres[desc->num_spheres++];
+            memcpy(s->center, a, sizeof(a));
+            s->radius = w;
+            memcpy(s->color, c, sizeof(c));
+            s->line = lineno;
+        } else if (strcmp(kind, "plane") == 0) {
+            if (n == 9 && strcmp(flag, "light") != 0) {
+                fprintf(stderr, "%s:%d: unknown flag '%s'\n", path, lineno, flag);
+                goto fail;
+            }
+            if (desc->num_planes == MAX_PLANES) {
+                fprintf(stderr, "%s:%d: more than %d planes\n", path, lineno, MAX_PLANES);
+                goto fail;
+            }
+            PlaneDesc *p = &desc->planes[desc->num_planes];
+            memcpy(p->normal, a, sizeof(a));
+            p->dist = w;
+            memcpy(p->color, c, sizeof(c));
+            p->is_light = (n == 9);
+            p->line = lineno;
+            if (p->is_light && desc->light_plane < 0)
+                desc->light_plane = desc->num_planes;
+            ++desc->num_planes;
+        } else {
+            fprintf(stderr, "%s:%d: unknown primitive '%s'\n", path, lineno, kind);
+            goto fail;
+        }
+    }
+    fclose(fp);
+
+    if (desc->light_plane < 0) {
+        fprintf(stderr, "%s: no plane is marked 'light'\n", path);
+        return -1;
+    }
+    return 0;
+
+fail:
+    fclose(fp);
+    return -1;
+}
+
+int scene_load(const char *path)
+{
+    if (scene_parse(path, &s_desc) != 0)
+        return -1;
+
+    for (int i = 0; i < s_desc.num_spheres; ++i) {
+        const SphereDesc *d = &s_desc.spheres[i];
+        Sphere *s = &s_spheres[i];
+        s->material.is_light = 0;
+        if (to_vec(d->color, &s->material.color) != 0 || to_vec(d->center, &s->center) != 0
+            || to_fp(d->radius, &s->radius) != 0) {
+            fprintf(stderr, "%s:%d: sphere out of fixed-point range\n", path, d->line);
+            return -1;
+        }
+    }
+    for (int j = 0; j < s_desc.num_planes; ++j) {
+        const PlaneDesc *d = &s_desc.planes[j];
+        Plane *p = &s_planes[j];
+        p->material.is_light = d->is_light;
+        if (to_vec(d->color, &p->material.color) != 0 || to_vec(d->normal, &p->normal) != 0
+            || to_fp(d->dist, &p->dist) != 0) {
+            fprintf(stderr, "%s:%d: plane out of fixed-point range\n", path, d->line);
+            return -1;
+        }
+    }
+
+    memcpy(g_spheres, s_spheres, s_desc.num_spheres * sizeof(Sphere));
+    memcpy(g_planes, s_planes, s_desc.num_planes * sizeof(Plane));
+    g_num_spheres = s_desc.num_spheres;
+    g_num_planes = s_desc.num_planes;
+    g_light_plane = s_desc.light_plane;
+    scene_build_bvh();
+    return 0;
+}
+
+static int s_sort_axis;
+
+static fp_t axis_of(Vec3 v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+static int cmp_centroid(const void *a, const void *b)
+{
+    fp_t ca = axis_of(((const Sphere *)a)->center, s_sort_axis);
+    fp_t cb = axis_of(((const Sphere *)b)->center, s_sort_axis);
+    return (ca > cb) - (ca < cb);
+}
+
+static fp_t clamp_fp(int64_t v)
+{
+    return (fp_t)(v < FP_MIN ? FP_MIN : (v > FP_MAX ? FP_MAX : v));
+}
+
+static void build_node(int node, int lo, int hi, int *num_nodes)
+{
+    BvhNode *n = &g_bvh[node];
+    int64_t bmin[3] = { FP_MAX, FP_MAX, FP_MAX }, bmax[3] = { FP_MIN, FP_MIN, FP_MIN };
+    int64_t cmin[3] = { FP_MAX, FP_MAX, FP_MAX }, cmax[3] = { FP_MIN, FP_MIN, FP_MIN };
+
+    for (int i = lo; i < hi; ++i) {
+        const Sphere *s = &g_spheres[i];
+        for (int k = 0; k < 3; ++k) {
+            int64_t c = axis_of(s->center, k);
+            if (c - s->radius < bmin[k]) bmin[k] = c - s->radius;
+            if (c + s->radius > bmax[k]) bmax[k] = c + s->radius;
+            if (c < cmin[k]) cmin[k] = c;
+            if (c > cmax[k]) cmax[k] = c;
+        }
+    }
+    n->min = (Vec3){ clamp_fp(bmin[0] - BVH_PAD), clamp_fp(bmin[1] - BVH_PAD), clamp_fp(bmin[2] - BVH_PAD) };
+    n->max = (Vec3){ clamp_fp(bmax[0] + BVH_PAD), clamp_fp(bmax[1] + BVH_PAD), clamp_fp(bmax[2] + BVH_PAD) };
+
+    if (hi - lo <= BVH_LEAF_SIZE) {
+        n->first = (uint16_t)lo;
+        n->count = (uint16_t)(hi - lo);
+        return;
+    }
+
+    int axis = 0;
+    for (int k = 1; k < 3; ++k)
+        if (cmax[k] - cmin[k] > cmax[axis] - cmin[axis])
+            axis = k;
+    s_sort_axis = axis;
+    qsort(&g_spheres[lo], hi - lo, sizeof(Sphere), cmp_centroid);
+
+    // Median split keeps the tree depth at log2(n), well inside BVH_STACK_SIZE
+    int mid = lo + (hi - lo) / 2;
+    int left = *num_nodes;
+    *num_nodes += 2;
+    n->first = (uint16_t)left;
+    n->count = 0;
+    build_node(left, lo, mid, num_nodes);
+    build_node(left + 1, mid, hi, num_nodes);
+}
+
+void scene_build_bvh(void)
+{
+    int num_nodes = 1;
+    build_node(0, 0, g_num_spheres, &num_nodes);
+}
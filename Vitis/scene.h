@@ -0,0 +1,51 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "trace_path.h"
+
+// Host-side scene loading. Fills the kernel's scene arrays (g_spheres,
+// g_planes, g_bvh) from a text file so scenes can change without a rebuild.
+//
+// File format, one primitive per line, '#' starts a comment:
+//     sphere  cx cy cz  radius  r g b
+//     plane   nx ny nz  dist    r g b  [light]
+// Values are in scene units and must fit the fixed-point format (|v| < 8 at
+// the default 4.12). A plane is the set of points p with dot(normal, p) =
+// dist. The first plane marked "light" is the area light; its emission is the
+// colour, and its shape is the ceiling rectangle tested by is_on_light().
+
+#define BVH_LEAF_SIZE 2
+#define BVH_PAD 16      // bounds padding in ulps, covers rounding in the slab test
+
+// A scene file as written, in scene units; the fixed-point arrays are built
+// from it. The float reference renderer (reference.h) draws it directly.
+typedef struct {
+    double center[3], radius, color[3];
+    int line;           // line in the scene file, for messages
+} SphereDesc;
+
+typedef struct {
+    double normal[3], dist, color[3];
+    int is_light;
+    int line;
+} PlaneDesc;
+
+typedef struct {
+    SphereDesc spheres[MAX_SPHERES];
+    PlaneDesc planes[MAX_PLANES];
+    int num_spheres, num_planes;
+    int light_plane;
+} SceneDesc;
+
+// Parses a scene file into desc without converting it to fixed point.
+// Returns 0 on success, -1 on error (with a message on stderr).
+int scene_parse(const char *path, SceneDesc *desc);
+
+// Loads a scene file and builds its BVH. Returns 0 on success, -1 on error
+// (with a message on stderr); on error the current scene is left untouched.
+int scene_load(const char *path);
+
+// Rebuilds g_bvh over the current spheres. Reorders g_spheres.
+void scene_build_bvh(void);
+
+#endif
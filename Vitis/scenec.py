@@ -0,0 +1,485 @@
+"""Scene compiler: turns a scene file into specialised C for trace_path.c.
+
+    python3 scenec.py scenes/cornell.scene -o scene_compiled.h
+    gcc -DCOMPILED_SCENE ... trace_path.c ...
+
+The scene file format is the one scene.c reads (see scene.h). The output
+defines the scene arrays plus intersect_scene() and occluded() with
+every per-primitive constant folded in:
+
+  * spheres: centre and radius^2 are literals; dot(dir, dir) and 1/(2a) are
+    computed once per ray instead of once per sphere;
+  * axis-aligned planes: the dot products collapse to one component, the
+    plane point is a literal and the divide becomes a multiply by 1/dir on
+    that axis, which is computed once per ray and shared by both planes on
+    the axis;
+  * the is_on_light() test is only emitted for emissive planes, and emissive
+    planes are left out of the shadow test at compile time.
+
+Other planes get the generic test with their constants folded. Sphere and
+sphere-only results are bit-identical to the generic kernel; axis-aligned
+plane distances can differ by an ulp because of the reciprocal. occluded()
+uses the divide-free any-hit tests and matches the generic one exactly.
+
+The spheres go through the same BVH scene.c builds (median split down to
+BVH_LEAF_SIZE), emitted as g_bvh with g_spheres in leaf order. Up to
+--max-folded spheres the walk is unrolled at compile time: every box is a
+slab test on literal bounds and every leaf calls its spheres' folded tests,
+visited in the kernel's order, so nothing is tested that the generic walk
+would skip. Above that the folded code would outgrow the device, so the
+spheres fall back to the generic stack walk over g_bvh and only the planes
+are folded.
+
+For a fixed-point format other than the default 16-bit 4.12 (see FP_BITS and
+FRAC_BITS in trace_path.h), pass the same values with --fp-bits/--frac-bits;
+the output refuses to build with any other format.
+"""
+
+import argparse
+import sys
+
+# Fixed-point format; set from the command line in main()
+FP_BITS = 16
+FRAC_BITS = 12
+ONE = 1 << FRAC_BITS
+AXES = "xyz"
+
+# scene.h
+BVH_LEAF_SIZE = 2
+BVH_PAD = 16
+
+
+class SceneError(Exception):
+    pass
+
+
+def to_fp(v, what, lineno):
+    """Fixed-point value, rounded half away from zero like F() and scene.c."""
+    q = int(abs(v) * ONE + 0.5) * (1 if v >= 0 else -1)
+    if not -(1 << (FP_BITS - 1)) <= q < 1 << (FP_BITS - 1):
+        raise SceneError(f"line {lineno}: {what} out of fixed-point range")
+    return q
+
+
+def fp_mul(a, b):
+    return (a * b) >> FRAC_BITS
+
+
+def fp_narrow(v):
+    """FP_NARROW() without FP_SATURATE: wrap to FP_BITS."""
+    half = 1 << (FP_BITS - 1)
+    return (v + half) % (2 * half) - half
+
+
+def parse(path):
+    spheres, planes = [], []
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            tok = line.split("#", 1)[0].split()
+            if not tok:
+                continue
+            if len(tok) not in (8, 9):
+                raise SceneError(f"line {lineno}: expected <kind> x y z w r g b")
+            kind, vals, flag = tok[0], [float(t) for t in tok[1:8]], tok[8:]
+            vec = [to_fp(v, kind, lineno) for v in vals[:3]]
+            w = to_fp(vals[3], kind, lineno)
+            color = [to_fp(v, "colour", lineno) for v in vals[4:7]]
+            if kind == "sphere":
+                if flag:
+                    raise SceneError(f"line {lineno}: only planes can be lights")
+                if w <= 0:
+                    raise SceneError(f"line {lineno}: sphere radius must be positive")
+                spheres.append({"center": vec, "radius": w, "color": color})
+            elif kind == "plane":
+                if flag and flag != ["light"]:
+                    raise SceneError(f"line {lineno}: unknown flag '{flag[0]}'")
+                planes.append({"normal": vec, "dist": w, "color": color,
+                               "light": bool(flag)})
+            else:
+                raise SceneError(f"line {lineno}: unknown primitive '{kind}'")
+    lights = [j for j, p in enumerate(planes) if p["light"]]
+    if not lights:
+        raise SceneError("no plane is marked 'light'")
+    return spheres, planes, lights[0]
+
+
+def build_bvh(spheres):
+    """scene_build_bvh(): returns (nodes, spheres in leaf order).
+
+    Nodes are dicts with min, max, first and count laid out as in g_bvh;
+    sorted() is stable like the host's qsort, so equal centroids keep their
+    order and the tree is the one the generic kernel walks.
+    """
+    fp_max = (1 << (FP_BITS - 1)) - 1
+    fp_min = -fp_max - 1
+    clamp = lambda v: max(fp_min, min(fp_max, v))
+    spheres = list(spheres)
+    nodes = [None] * max(1, 2 * len(spheres))
+
+    def build(node, lo, hi, num_nodes):
+        bmin, bmax = [fp_max] * 3, [fp_min] * 3
+        cmin, cmax = [fp_max] * 3, [fp_min] * 3
+        for s in spheres[lo:hi]:
+            for k, c in enumerate(s["center"]):
+                bmin[k] = min(bmin[k], c - s["radius"])
+                bmax[k] = max(bmax[k], c + s["radius"])
+                cmin[k], cmax[k] = min(cmin[k], c), max(cmax[k], c)
+        n = {"min": [clamp(v - BVH_PAD) for v in bmin], "max": [clamp(v + BVH_PAD) for v in bmax]}
+        nodes[node] = n
+        if hi - lo <= BVH_LEAF_SIZE:
+            n["first"], n["count"] = lo, hi - lo
+            return num_nodes
+        axis = 0
+        for k in (1, 2):
+            if cmax[k] - cmin[k] > cmax[axis] - cmin[axis]:
+                axis = k
+        spheres[lo:hi] = sorted(spheres[lo:hi], key=lambda s: s["center"][axis])
+        mid = lo + (hi - lo) // 2
+        left = num_nodes
+        n["first"], n["count"] = left, 0
+        num_nodes = build(left, lo, mid, num_nodes + 2)
+        return build(left + 1, mid, hi, num_nodes)
+
+    num_nodes = build(0, 0, len(spheres), 1)
+    return nodes[:num_nodes], spheres
+
+
+def vec(v):
+    return "{.x = %d, .y = %d, .z = %d}" % tuple(v)
+
+
+def axis_of(normal):
+    """(axis, sign) if the normal is exactly +-ONE along one axis, else None."""
+    nz = [(k, c) for k, c in enumerate(normal) if c != 0]
+    if len(nz) == 1 and abs(nz[0][1]) == ONE:
+        return nz[0][0], (1 if nz[0][1] > 0 else -1)
+    return None
+
+
+def emit_sphere(i, s):
+    cx, cy, cz = s["center"]
+    r_sq = fp_mul(s["radius"], s["radius"])
+    return f"""static int32_t scene_sphere_{i}(Ray r, const SceneRay *sr) {{
+    #pragma HLS inline
+    STAT_INC(sphere_tests);
+    Vec3 oc = {{FP_NARROW(r.orig.x - ({cx})), FP_NARROW(r.orig.y - ({cy})), FP_NARROW(r.orig.z - ({cz}))}};
+    int32_t b = 2 * vec_dot(oc, r.dir);
+    int32_t c = vec_dot(oc, oc) - {r_sq};
+    int32_t discriminant = mul(b, b) - 4 * mul(sr->a, c);
+    if (discriminant < 0) return FP_INF;
+    int32_t sqrt_d = sqrt_fp(discriminant);
+    int32_t t  = mul(-b - sqrt_d, sr->inv_2a);
+    if (t > FP_EPS) return t;
+    int32_t t2 = mul(-b + sqrt_d, sr->inv_2a);
+    if (t2 > FP_EPS) return t2;
+    return FP_INF;
+}}
+"""
+
+
+def emit_sphere_blocks(i, s):
+    cx, cy, cz = s["center"]
+    r_sq = fp_mul(s["radius"], s["radius"])
+    return f"""static int scene_sphere_blocks_{i}(Ray r, int32_t a, int32_t max_t) {{
+    #pragma HLS inline
+    STAT_INC(sphere_tests);
+    Vec3 oc = {{FP_NARROW(r.orig.x - ({cx})), FP_NARROW(r.orig.y - ({cy})), FP_NARROW(r.orig.z - ({cz}))}};
+    int32_t b = 2 * vec_dot(oc, r.dir);
+    int32_t c = vec_dot(oc, oc) - {r_sq};
+    int32_t f_max = mul(mul(a, max_t) + b, max_t) + c;
+    if (c < 0) return f_max > 0;
+    if (b >= 0) return 0;
+    if (f_max < 0) return 1;
+    if (-b >= 2 * mul(a, max_t)) return 0;
+    return mul(b, b) - 4 * mul(a, c) >= 0;
+}}
+"""
+
+
+def emit_light_check(light):
+    if not light:
+        return ""
+    return """    // Emissive: only the light rectangle counts (is_on_light() needs x and z)
+    fp_t hx = FP_NARROW(r.orig.x + FP_NARROW(mul(r.dir.x, FP_NARROW(t))));
+    fp_t hz = FP_NARROW(r.orig.z + FP_NARROW(mul(r.dir.z, FP_NARROW(t))));
+    if (hx < LIGHT_X_MIN || hx > LIGHT_X_MAX || hz < LIGHT_Z_MIN || hz > LIGHT_Z_MAX) return FP_INF;
+"""
+
+
+def emit_plane(j, p, inv):
+    n, dist = p["normal"], p["dist"]
+    # vec_scale(p.normal, p.dist): a point on the plane
+    pt = [fp_narrow(fp_mul(c, fp_narrow(dist))) for c in n]
+    aa = axis_of(n)
+    if aa is not None:
+        a = AXES[aa[0]]
+        # dot(n, pt - o) / dot(n, dir) = (pt - o).a / dir.a: the sign cancels
+        body = f"""    if (r.dir.{a} == 0) return FP_INF; // parallel
+    int32_t t = mul(FP_NARROW({pt[aa[0]]} - r.orig.{a}), {inv % a});
+    if (t <= FP_EPS) return FP_INF;
+"""
+    else:
+        body = f"""    (void)sr;
+    const Vec3 n = {vec(n)};
+    int32_t denom = vec_dot(n, r.dir);
+    if (denom > -FP_EPS && denom < FP_EPS) return FP_INF; // Parallel
+    Vec3 d = {{FP_NARROW({pt[0]} - r.orig.x), FP_NARROW({pt[1]} - r.orig.y), FP_NARROW({pt[2]} - r.orig.z)}};
+    int32_t t = div_fp(vec_dot(n, d), denom);
+    if (t <= FP_EPS) return FP_INF;
+"""
+    kind = "axis-aligned" if aa is not None else "general"
+    out = f"""// plane {j}: {kind}{", emissive" if p["light"] else ""}
+static int32_t scene_plane_{j}(Ray r, const SceneRay *sr) {{
+    #pragma HLS inline
+    STAT_INC(plane_tests);
+{body}{emit_light_check(p["light"])}    return t;
+}}
+"""
+    if p["light"]:
+        return out  # never an occluder
+    if aa is not None:
+        # dot(n, v) is +-v.a; mul() by +-ONE is exact, so this is plane_blocks()
+        a, sign = AXES[aa[0]], "-" if aa[1] < 0 else ""
+        terms = f"""    int32_t denom = {sign}r.dir.{a};
+    int32_t num = {sign}FP_NARROW({pt[aa[0]]} - r.orig.{a});
+"""
+    else:
+        terms = f"""    const Vec3 n = {vec(n)};
+    int32_t denom = vec_dot(n, r.dir);
+    Vec3 d = {{FP_NARROW({pt[0]} - r.orig.x), FP_NARROW({pt[1]} - r.orig.y), FP_NARROW({pt[2]} - r.orig.z)}};
+    int32_t num = vec_dot(n, d);
+"""
+    return out + f"""
+static int scene_plane_blocks_{j}(Ray r, int32_t max_t) {{
+    #pragma HLS inline
+    STAT_INC(plane_tests);
+{terms}    int32_t rest = num - mul(max_t, denom);
+    return (num > 0 && rest < 0) || (num < 0 && rest > 0);
+}}
+"""
+
+
+def emit_box(k, n):
+    """intersect_box() on one node's literal bounds."""
+    clips = "".join(
+        f"    if (!clip_slab(r.orig.{a}, r.dir.{a}, inv.{a}, {n['min'][i]}, {n['max'][i]}, &tmin, &tmax)) return FP_INF;\n"
+        for i, a in enumerate(AXES))
+    return f"""static int32_t scene_box_{k}(Ray r, RayInv inv) {{
+    #pragma HLS inline
+    STAT_INC(box_tests);
+    int32_t tmin = 0, tmax = FP_INF;
+{clips}    return tmin;
+}}
+"""
+
+
+def emit_walk(nodes, k, leaf, enter, depth=1):
+    """The BVH walk unrolled from node k: its box test guards the left then
+    the right subtree, the order the kernel's stack pops them in. A root that
+    is a leaf has no box test, as in the kernel. leaf(i) is the test of
+    sphere i, enter(k) the condition to open box k."""
+    n = nodes[k]
+    inner = depth if k == 0 and n["count"] else depth + 1
+    if n["count"]:
+        body = "".join("    " * inner + line + "\n"
+                       for i in range(n["first"], n["first"] + n["count"]) for line in leaf(i).splitlines())
+    else:
+        body = "".join(emit_walk(nodes, c, leaf, enter, inner) for c in (n["first"], n["first"] + 1))
+    if inner == depth:
+        return body
+    ind = "    " * depth
+    return f"{ind}if ({enter(k)}) {{\n{body}{ind}}}\n"
+
+
+# Generic sphere walk for scenes above --max-folded: intersect_spheres() and
+# spheres_block() over the emitted g_bvh, with 1/dir shared with the planes
+GENERIC_WALK = """// Too many spheres to fold (--max-folded): the kernel's stack walk over g_bvh
+static void scene_spheres(Ray r, RayInv inv, Intersection *result) {
+    uint16_t stack[BVH_STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = 0;
+
+    LOOP_BVH:
+    while (sp > 0) {
+        #pragma HLS pipeline off
+        const BvhNode *n = &g_bvh[stack[--sp]];
+        int32_t t_box = intersect_box(r, inv, n);
+        if (t_box == FP_INF || t_box > result->t) continue;
+
+        if (n->count == 0) {
+            stack[sp++] = n->first + 1;
+            stack[sp++] = n->first;
+            continue;
+        }
+        for (int i = n->first; i < n->first + n->count; ++i) {
+            #pragma HLS pipeline off
+            int32_t t = intersect_sphere(r, g_spheres[i]);
+            if (t < result->t || (t == result->t && t != FP_INF && i < result->hit_index)) {
+                result->t = t;
+                result->hit_type = 0;
+                result->hit_index = i;
+            }
+        }
+    }
+}
+
+static int scene_spheres_block(Ray ray, RayInv inv, int32_t max_t) {
+    uint16_t stack[BVH_STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = 0;
+
+    LOOP_BVH_SHADOW:
+    while (sp > 0) {
+        #pragma HLS pipeline off
+        const BvhNode *n = &g_bvh[stack[--sp]];
+        int32_t t_box = intersect_box(ray, inv, n);
+        if (t_box == FP_INF || t_box >= max_t) continue;
+
+        if (n->count == 0) {
+            stack[sp++] = n->first + 1;
+            stack[sp++] = n->first;
+            continue;
+        }
+        for (int i = n->first; i < n->first + n->count; ++i) {
+            #pragma HLS pipeline off
+            if (sphere_blocks(ray, g_spheres[i], max_t)) return 1;
+        }
+    }
+    return 0;
+}
+
+"""
+
+
+def emit(spheres, planes, light_plane, src, max_folded):
+    nodes, spheres = build_bvh(spheres)
+    # A single-leaf tree is tested without a box, as in the kernel
+    boxes = bool(spheres) and nodes[0]["count"] == 0
+    folded = len(spheres) <= max(max_folded, BVH_LEAF_SIZE)
+    out = [f"""/* Generated by scenec.py from {src} -- do not edit.
+ * Included by trace_path.c when built with -DCOMPILED_SCENE.
+ */
+
+#if FP_BITS != {FP_BITS} || FRAC_BITS != {FRAC_BITS}
+#error "scene compiled for FP_BITS={FP_BITS} FRAC_BITS={FRAC_BITS}; rerun scenec.py with --fp-bits/--frac-bits"
+#endif
+
+int g_num_spheres = {len(spheres)};
+int g_num_planes = {len(planes)};
+int g_light_plane = {light_plane};
+
+Sphere g_spheres[MAX_SPHERES] = {{
+"""]
+    for s in spheres:
+        out.append("    {.center = %s, .radius = %d, .material = {.color = %s, .is_light = 0}},\n"
+                   % (vec(s["center"]), s["radius"], vec(s["color"])))
+    out.append("};\n\nPlane g_planes[MAX_PLANES] = {\n")
+    for p in planes:
+        out.append("    {.normal = %s, .dist = %d, .material = {.color = %s, .is_light = %d}},\n"
+                   % (vec(p["normal"]), p["dist"], vec(p["color"]), p["light"]))
+    out.append("};\n\n// Flattened BVH, the same tree scene_build_bvh() builds\nBvhNode g_bvh[MAX_BVH_NODES] = {\n")
+    for n in nodes:
+        out.append("    {.min = %s, .max = %s, .first = %d, .count = %d},\n"
+                   % (vec(n["min"]), vec(n["max"]), n["first"], n["count"]))
+    out.append("};\n\n")
+
+    # Per-ray terms, shared by every primitive test. With boxes to test the
+    # planes take their 1/dir from the full reciprocal.
+    inv_axes = sorted({AXES[aa[0]] for aa in (axis_of(p["normal"]) for p in planes) if aa})
+    fields = ["int32_t a, inv_2a;      // sphere: dot(dir, dir), 1 / (2a)"] if spheres and folded else []
+    if boxes:
+        fields += ["RayInv inv;             // 1 / dir, boxes and axis-aligned planes"]
+    else:
+        fields += [f"int32_t inv_{a};          // 1 / dir.{a}" for a in inv_axes]
+    out.append("// Per-ray terms shared by every primitive test\ntypedef struct {\n")
+    out.extend(f"    {f}\n" for f in fields or ["int32_t unused;"])
+    out.append("} SceneRay;\n\nstatic SceneRay scene_ray(Ray r) {\n    SceneRay sr;\n")
+    if spheres and folded:
+        out.append("    sr.a = vec_dot(r.dir, r.dir);\n    sr.inv_2a = div_fp(ONE, 2 * sr.a);\n")
+    if boxes:
+        out.append("    sr.inv = ray_inv(r.dir);\n")
+    else:
+        for a in inv_axes:
+            out.append(f"    sr.inv_{a} = div_fp(ONE, r.dir.{a});\n")
+    if not fields:
+        out.append("    sr.unused = 0;\n    (void)r;\n")
+    out.append("    return sr;\n}\n\n")
+
+    if folded:
+        for i, s in enumerate(spheres):
+            out.append(emit_sphere(i, s) + "\n" + emit_sphere_blocks(i, s) + "\n")
+        if boxes:
+            for k, n in enumerate(nodes):
+                out.append(emit_box(k, n) + "\n")
+    elif spheres:
+        out.append(GENERIC_WALK)
+    inv = "sr->inv.%s" if boxes else "sr->inv_%s"
+    for j, p in enumerate(planes):
+        out.append(emit_plane(j, p, inv) + "\n")
+
+    # Nearest hit: spheres then planes, strict '<', same as the generic kernel.
+    # Leaves are emitted in sphere order, so '<' also gives a tie to the lower
+    # index as intersect_leaf() does.
+    out.append("""Intersection intersect_scene(Ray r) {
+    SceneRay sr = scene_ray(r);
+    Intersection result = {FP_INF, -1, -1, 0};
+    int32_t t;
+""")
+    if spheres and folded:
+        out.append(emit_walk(
+            nodes, 0,
+            lambda i: (f"t = scene_sphere_{i}(r, &sr);\n"
+                       f"if (t < result.t) {{ result.t = t; result.hit_type = 0; result.hit_index = {i}; }}"),
+            lambda k: f"(t = scene_box_{k}(r, sr.inv)) != FP_INF && t <= result.t"))
+    elif spheres:
+        out.append("    scene_spheres(r, sr.inv, &result);\n")
+    for j in range(len(planes)):
+        out.append(f"    t = scene_plane_{j}(r, &sr);\n"
+                   f"    if (t < result.t) {{ result.t = t; result.hit_type = 1; result.hit_index = {j}; }}\n")
+    out.append("""    result.hit = result.hit_type != -1;
+    return result;
+}
+
+int occluded(Ray ray, int32_t max_t) {
+""")
+    if spheres and folded:
+        out.append("    int32_t a = vec_dot(ray.dir, ray.dir);\n")
+        if boxes:
+            out.append("    RayInv inv = ray_inv(ray.dir);\n    int32_t t;\n")
+        out.append(emit_walk(
+            nodes, 0,
+            lambda i: f"if (scene_sphere_blocks_{i}(ray, a, max_t)) return 1;",
+            lambda k: f"(t = scene_box_{k}(ray, inv)) != FP_INF && t < max_t"))
+    elif spheres:
+        out.append("    if (scene_spheres_block(ray, ray_inv(ray.dir), max_t)) return 1;\n")
+    for j, p in enumerate(planes):
+        if p["light"]:
+            continue  # Don't treat the emissive plane as occluder
+        out.append(f"    if (scene_plane_blocks_{j}(ray, max_t)) return 1;\n")
+    out.append("    return 0;\n}\n")
+    return "".join(out)
+
+
+def main():
+    global FP_BITS, FRAC_BITS, ONE
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("scene", help="scene file (see scene.h)")
+    ap.add_argument("-o", "--output", default="scene_compiled.h")
+    ap.add_argument("--fp-bits", type=int, default=FP_BITS, help="FP_BITS the kernel is built with")
+    ap.add_argument("--frac-bits", type=int, default=FRAC_BITS, help="FRAC_BITS the kernel is built with")
+    ap.add_argument("--max-folded", type=int, default=32,
+                    help="most spheres to fold; larger scenes use the generic BVH walk (default 32)")
+    args = ap.parse_args()
+    FP_BITS, FRAC_BITS, ONE = args.fp_bits, args.frac_bits, 1 << args.frac_bits
+    try:
+        spheres, planes, light = parse(args.scene)
+    except (SceneError, ValueError) as e:
+        sys.exit(f"{args.scene}: {e}")
+    with open(args.output, "w") as f:
+        f.write(emit(spheres, planes, light, args.scene, args.max_folded))
+    folded = "folded" if len(spheres) <= max(args.max_folded, BVH_LEAF_SIZE) else "generic BVH walk"
+    print(f"Wrote {args.output} ({len(spheres)} spheres, {folded}; {len(planes)} planes)")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,161 @@
+/* stats.c
+ * Per-pixel collection and reporting of the TRACE_STATS counters (see
+ * stats.h). Only part of the instrumented build.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "stats.h"
+#include "output.h"
+
+#ifndef TRACE_STATS
+#error "stats.c is only built with -DTRACE_STATS"
+#endif
+
+#define NUM_PIXELS (g_width * g_height)
+// TraceStats is nothing but uint64_t counters, so it can be walked as an array
+#define NUM_COUNTERS (sizeof(TraceStats) / sizeof(uint64_t))
+
+typedef struct {
+    Color *fb;
+    TraceFn trace;
+    TraceStats *pixels;
+} StatsCtx;
+
+// Each pixel is visited by exactly one worker, and the counters are the
+// worker's own, so the difference around the call is this pixel's cost
+static void stats_pixel(int16_t x, int16_t y, void *ctx)
+{
+    StatsCtx *s = (StatsCtx *)ctx;
+    TraceStats before = g_trace_stats;
+    s->fb[y * g_width + x] = s->trace(x, y);
+
+    const uint64_t *b = (const uint64_t *)&before, *a = (const uint64_t *)&g_trace_stats;
+    uint64_t *d = (uint64_t *)&s->pixels[y * g_width + x];
+    for (size_t k = 0; k < NUM_COUNTERS; ++k)
+        d[k] = a[k] - b[k];
+}
+
+int stats_render(Color *fb, int num_threads, TraceFn trace, StatsFrame *sf)
+{
+    sf->pixels = calloc(NUM_PIXELS, sizeof(*sf->pixels));
+    if (!sf->pixels) return -1;
+
+    StatsCtx s = { fb, trace, sf->pixels };
+    if (render_pixels(num_threads, stats_pixel, &s) != 0) {
+        stats_free(sf);
+        return -1;
+    }
+
+    uint64_t *t = (uint64_t *)&sf->total;
+    for (size_t k = 0; k < NUM_COUNTERS; ++k) t[k] = 0;
+    for (int i = 0; i < NUM_PIXELS; ++i) {
+        const uint64_t *p = (const uint64_t *)&sf->pixels[i];
+        for (size_t k = 0; k < NUM_COUNTERS; ++k)
+            t[k] += p[k];
+    }
+    return 0;
+}
+
+void stats_free(StatsFrame *sf)
+{
+    free(sf->pixels);
+    sf->pixels = NULL;
+}
+
+static uint64_t pixel_rays(const TraceStats *s) { return s->camera_rays + s->bounce_rays + s->shadow_rays; }
+static uint64_t pixel_tests(const TraceStats *s) { return s->sphere_tests + s->plane_tests + s->box_tests; }
+static uint64_t pixel_occluded(const TraceStats *s) { return s->shadow_occluded; }
+static uint64_t pixel_overflow(const TraceStats *s) { return s->fp_overflow; }
+
+// Heatmap of one per-pixel quantity, black -> red -> yellow -> white up to
+// the frame maximum. Returns the maximum, or -1 on error.
+static long write_heatmap(const StatsFrame *sf, uint64_t (*value)(const TraceStats *), const char *path)
+{
+    uint64_t max = 0;
+    for (int i = 0; i < NUM_PIXELS; ++i)
+        if (value(&sf->pixels[i]) > max) max = value(&sf->pixels[i]);
+
+    Color *img = malloc(NUM_PIXELS * sizeof(*img));
+    if (!img) { perror("malloc"); return -1; }
+    for (int i = 0; i < NUM_PIXELS; ++i) {
+        // 0..765 along the colour ramp
+        int v = max ? (int)(value(&sf->pixels[i]) * 765 / max) : 0;
+        int r = v > 255 ? 255 : v;
+        int g = v < 255 ? 0 : (v > 510 ? 255 : v - 255);
+        int b = v < 510 ? 0 : v - 510;
+        img[i] = (Color){ (uint8_t)r, (uint8_t)g, (uint8_t)b };
+    }
+    int ret = output_write_frame(path, img, NULL);
+    free(img);
+    if (ret != 0) return -1;
+    return (long)max;
+}
+
+static double ratio(uint64_t a, uint64_t b)
+{
+    return b ? (double)a / b : 0;
+}
+
+int stats_write(const StatsFrame *sf, const char *json_path, const char *prefix)
+{
+    static const struct {
+        const char *name;
+        uint64_t (*value)(const TraceStats *);
+    } maps[] = {
+        { "rays", pixel_rays },
+        { "tests", pixel_tests },
+        { "occluded", pixel_occluded },
+        { "overflow", pixel_overflow },
+    };
+    const int num_maps = sizeof(maps) / sizeof(maps[0]);
+    long max[sizeof(maps) / sizeof(maps[0])];
+
+    for (int m = 0; m < num_maps; ++m) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s%s.ppm", prefix, maps[m].name);
+        if ((max[m] = write_heatmap(sf, maps[m].value, path)) < 0)
+            return -1;
+    }
+
+    const TraceStats *t = &sf->total;
+    uint64_t rays = t->camera_rays + t->bounce_rays + t->shadow_rays;
+    uint64_t tests = t->sphere_tests + t->plane_tests + t->box_tests;
+
+    FILE *fp = fopen(json_path, "w");
+    if (!fp) { perror(json_path); return -1; }
+    fprintf(fp, "{\n  \"pixels\": %d,\n  \"totals\": {\n", NUM_PIXELS);
+    fprintf(fp, "    \"camera_rays\": %llu,\n    \"bounce_rays\": %llu,\n    \"shadow_rays\": %llu,\n",
+            (unsigned long long)t->camera_rays, (unsigned long long)t->bounce_rays,
+            (unsigned long long)t->shadow_rays);
+    fprintf(fp, "    \"escaped_by_bounce\": [");
+    for (int b = 0; b < MAX_BOUNCES; ++b)
+        fprintf(fp, "%s%llu", b ? ", " : "", (unsigned long long)t->escaped[b]);
+    fprintf(fp, "],\n    \"light_hits\": %llu,\n    \"roulette_ended\": %llu,\n    \"shadow_occluded\": %llu,\n",
+            (unsigned long long)t->light_hits, (unsigned long long)t->roulette_ended,
+            (unsigned long long)t->shadow_occluded);
+    fprintf(fp, "    \"sphere_tests\": %llu,\n    \"plane_tests\": %llu,\n    \"box_tests\": %llu,\n",
+            (unsigned long long)t->sphere_tests, (unsigned long long)t->plane_tests,
+            (unsigned long long)t->box_tests);
+    fprintf(fp, "    \"fp_overflow\": %llu,\n    \"u8_saturated\": %llu\n  },\n",
+            (unsigned long long)t->fp_overflow, (unsigned long long)t->u8_saturated);
+
+    fprintf(fp, "  \"rates\": {\n");
+    fprintf(fp, "    \"rays_per_pixel\": %.3f,\n", ratio(rays, NUM_PIXELS));
+    fprintf(fp, "    \"tests_per_ray\": %.3f,\n", ratio(tests, t->camera_rays + t->bounce_rays + t->shadow_rays));
+    fprintf(fp, "    \"bounces_per_path\": %.3f,\n", ratio(t->camera_rays + t->bounce_rays, t->camera_rays));
+    fprintf(fp, "    \"escaped_fraction_by_bounce\": [");
+    for (int b = 0; b < MAX_BOUNCES; ++b)
+        fprintf(fp, "%s%.5f", b ? ", " : "", ratio(t->escaped[b], t->camera_rays));
+    fprintf(fp, "],\n    \"shadow_occluded_fraction\": %.5f,\n", ratio(t->shadow_occluded, t->shadow_rays));
+    fprintf(fp, "    \"fp_overflow_per_ray\": %.6f\n  },\n", ratio(t->fp_overflow, rays));
+
+    fprintf(fp, "  \"heatmaps\": {\n");
+    for (int m = 0; m < num_maps; ++m)
+        fprintf(fp, "    \"%s\": {\"file\": \"%s%s.ppm\", \"max\": %ld}%s\n",
+                maps[m].name, prefix, maps[m].name, max[m], m + 1 < num_maps ? "," : "");
+    fprintf(fp, "  }\n}\n");
+    if (fclose(fp) != 0) { perror(json_path); return -1; }
+    return 0;
+}
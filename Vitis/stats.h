@@ -0,0 +1,32 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "trace_path.h"
+#include "render.h"
+
+// Host-side reporting for the instrumented build (-DTRACE_STATS). The kernel
+// counts into the calling thread's g_trace_stats (see TraceStats); this module
+// snapshots those counters around every pixel, so each pixel's cost is known
+// whatever thread traced it, and writes them out.
+//
+// The AVX2 packet path (-p) counts path events (rays, escapes, shadow
+// results, overflows) but not its per-primitive tests, which run outside
+// intersect_sphere / intersect_plane.
+
+typedef struct {
+    TraceStats *pixels;     // g_width * g_height row-major, counters of each pixel
+    TraceStats total;
+} StatsFrame;
+
+// Renders a frame like render_frame and records every pixel's counters in sf.
+// Returns 0 on success, -1 if out of memory. Free sf with stats_free.
+int stats_render(Color *fb, int num_threads, TraceFn trace, StatsFrame *sf);
+void stats_free(StatsFrame *sf);
+
+// Writes the totals and derived rates as JSON to json_path, and per-pixel
+// heatmaps (hot colour map, scaled to the frame maximum, which is recorded
+// in the JSON) to <prefix>rays.ppm, <prefix>tests.ppm, <prefix>occluded.ppm
+// and <prefix>overflow.ppm. Returns 0 on success, -1 on error.
+int stats_write(const StatsFrame *sf, const char *json_path, const char *prefix);
+
+#endif
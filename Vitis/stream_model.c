@@ -0,0 +1,269 @@
+/* stream_model.c
+ * Cycle-level model of the two ways of driving the kernel on the FPGA:
+ *   handshake  what top.v does with trace_path: one ap_start / ap_done round
+ *              trip per pixel, every sample and bounce one after the other,
+ *              and image_pulse waiting for the kernel to go idle in between;
+ *   stream     trace_path_stream: path slots through a camera stage, one
+ *              dataflow stage per bounce and a resolve stage, with a FIFO
+ *              between neighbouring stages and one call per
+ *              STREAM_MAX_PIXELS pixels.
+ *
+ * The work is the real frame's. Every path is traced with the kernel's own
+ * stages, the primitive tests of each bounce are counted (TRACE_STATS) and
+ * turned into cycles with the CYCLES_* latencies below, which are estimates
+ * for the 100 MHz (hls_config.cfg: clock=10) Artix-7 build; the latencies of
+ * the csynth report give a closer figure. Both designs are charged the same
+ * per-bounce cycles, so the ratio between them holds up better than either
+ * frame time. It is still a model: trace_path_stream has not been through
+ * csynth or into top.v, and the figures are no measurement of either design.
+ * The UART is left out.
+ *
+ * -v also writes the per-pixel test vectors of the RTL simulation
+ * (Vivado/sim): one line per pixel in scanline order, 12 hex digits, the
+ * pixel's handshake cycles (24 bits, top.v's own handshake left out) and then
+ * its colour packed as ap_return (STREAM_COLOR). The trace_path_0 stand-in
+ * there replays them, so the dispatcher sees the real frame's load.
+ *
+ * Build:
+ *     gcc -std=c99 -O2 -DTRACE_STATS stream_model.c scene.c trace_path.c -o stream_model -lm
+ * Run:
+ *     ./stream_model [-r WxH] [-s scene] [-d depth] [-v vectors.hex]
+ *         -r  frame size (default WIDTH x HEIGHT)
+ *         -s  load a scene file instead of the built-in Cornell box
+ *         -d  path slots per FIFO for the stream design (default
+ *             STREAM_FIFO_DEPTH)
+ *         -v  write the RTL simulation's test vectors
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "trace_path.h"
+#include "scene.h"
+
+#ifndef TRACE_STATS
+#error "stream_model.c counts the kernel's work, build it with -DTRACE_STATS"
+#endif
+
+#define CLOCK_MHZ 100.0
+#define CYCLES_CAMERA 40        // camera_ray: two multiplies and vec_norm
+#define CYCLES_KEY 1            // one path slot written by the camera stage
+#define CYCLES_SHADE 120        // path_hit + path_bounce: normal, light sample, divides, new direction
+#define CYCLES_SPHERE 30        // intersect_sphere / sphere_blocks
+#define CYCLES_PLANE 15         // intersect_plane / plane_blocks
+#define CYCLES_BOX 10           // BVH slab test
+#define CYCLES_PASS 1           // a dead slot handed on by a bounce stage
+#define CYCLES_RESOLVE 20       // per pixel: the divides of resolve_color
+#define CYCLES_HANDSHAKE 4      // ap_done edge, image_pulse, next ap_start
+
+#define NUM_PIXELS (g_width * g_height)
+#define NUM_PATHS (NUM_PIXELS * NUM_SAMPLES)
+#define NUM_STAGES (MAX_BOUNCES + 2)    // camera, bounces, resolve
+
+// s_cost[stage][path]: cycles that stage spends on the path slot, in the
+// order the slots flow (pixel by pixel, samples in order)
+static uint32_t *s_cost[NUM_STAGES];
+// Dead slots of each pixel handed on by bounce stages; the handshake design
+// just stops those paths
+static uint32_t *s_dead;
+
+static uint32_t bounce_cycles(const TraceStats *before, const TraceStats *after)
+{
+    return CYCLES_SHADE
+        + CYCLES_SPHERE * (after->sphere_tests - before->sphere_tests)
+        + CYCLES_PLANE * (after->plane_tests - before->plane_tests)
+        + CYCLES_BOX * (after->box_tests - before->box_tests);
+}
+
+// Traces the frame stage by stage, as trace_path_stream does, and records
+// the cycles of every stage for every path slot. The camera ray is charged
+// to a pixel's first slot and the divides of resolve_color to its last.
+static void measure(void)
+{
+    for (int p = 0; p < NUM_PIXELS; ++p) {
+        int16_t x = p % g_width, y = p / g_width;
+        Ray cam = camera_ray(x, y);
+
+        for (int sample = 0; sample < NUM_SAMPLES; ++sample) {
+            int i = p * NUM_SAMPLES + sample;
+            s_cost[0][i] = CYCLES_KEY + (sample == 0 ? CYCLES_CAMERA : 0);
+            s_cost[NUM_STAGES - 1][i] = 1 + (sample == NUM_SAMPLES - 1 ? CYCLES_RESOLVE : 0);
+
+            PathKey key = rand_path_key(x, y, sample);
+            PathState ps = {cam, {F(0), F(0), F(0)}, {ONE, ONE, ONE}};
+            int alive = 1;
+            for (int b = 0; b < MAX_BOUNCES; ++b) {
+                if (!alive) {
+                    s_cost[1 + b][i] = CYCLES_PASS;
+                    ++s_dead[p];
+                    continue;
+                }
+                TraceStats before = g_trace_stats;
+                BounceState bs;
+                Intersection inter = intersect_scene(ps.ray);
+                if (!path_hit(&ps, inter, b, key, &bs))
+                    alive = 0;
+                else if (!path_bounce(&ps, &bs, occluded(bs.shadow_ray, bs.light_dist), b, key))
+                    alive = 0;
+                s_cost[1 + b][i] = bounce_cycles(&before, &g_trace_stats);
+            }
+        }
+    }
+}
+
+// One trace_path call: the whole path work of the pixel back to back
+static uint64_t pixel_cycles(int p)
+{
+    uint64_t total = 0;
+    for (int s = 0; s < NUM_STAGES; ++s)
+        for (int i = p * NUM_SAMPLES; i < (p + 1) * NUM_SAMPLES; ++i)
+            total += s_cost[s][i];
+    return total - (uint64_t)CYCLES_PASS * s_dead[p];
+}
+
+// Every pixel on its own, with the handshake before the next one
+static uint64_t handshake_cycles(void)
+{
+    uint64_t total = 0;
+    for (int p = 0; p < NUM_PIXELS; ++p)
+        total += pixel_cycles(p) + CYCLES_HANDSHAKE;
+    return total;
+}
+
+// Writes the vectors for Vivado/sim/trace_path_0.v. Returns 0 on success,
+// -1 on error.
+static int write_vectors(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) { perror(path); return -1; }
+    for (int p = 0; p < NUM_PIXELS; ++p) {
+        uint64_t latency = pixel_cycles(p);
+        if (latency > 0xFFFFFF) latency = 0xFFFFFF;
+        Color c = trace_path(p % g_width, p / g_width);
+        fprintf(f, "%06llx%06x\n", (unsigned long long)latency, (unsigned)STREAM_COLOR(c));
+    }
+    if (fclose(f) != 0) { perror(path); return -1; }
+    return 0;
+}
+
+// Dataflow with FIFOs of depth slots: a stage starts slot i once it has
+// finished slot i-1, the stage before has handed slot i over, and there is
+// room for it in the FIFO behind, i.e. the next stage has taken slot
+// i-depth. A new call is started after each STREAM_MAX_PIXELS pixels; with
+// ap_ctrl_chain only the camera stage waits for its handshake.
+// busy[s] gets each stage's total working cycles.
+static uint64_t stream_cycles(int depth, uint64_t busy[NUM_STAGES])
+{
+    // end[s][i % (depth + 1)]: when stage s finished slot i; only the last
+    // depth + 1 slots of each stage are ever looked at
+    uint64_t *end = calloc((size_t)NUM_STAGES * (depth + 1), sizeof(*end));
+    if (!end) { perror("malloc"); exit(1); }
+#define END(s, i) end[(size_t)(s) * (depth + 1) + (size_t)(i) % (depth + 1)]
+
+    for (int s = 0; s < NUM_STAGES; ++s) busy[s] = 0;
+    for (int i = 0; i < NUM_PATHS; ++i) {
+        for (int s = 0; s < NUM_STAGES; ++s) {
+            uint64_t work = s_cost[s][i];
+            if (s == 0 && i % (STREAM_MAX_PIXELS * NUM_SAMPLES) == 0)
+                work += CYCLES_HANDSHAKE;
+            uint64_t start = 0;
+            if (i > 0 && END(s, i - 1) > start) start = END(s, i - 1);
+            if (s > 0 && END(s - 1, i) > start) start = END(s - 1, i);
+            // Stage s+1 has not run slot i-1 yet here, but it has run i-depth
+            if (s + 1 < NUM_STAGES && i >= depth && END(s + 1, i - depth) > start) start = END(s + 1, i - depth);
+            END(s, i) = start + work;
+            busy[s] += work;
+        }
+    }
+    uint64_t total = END(NUM_STAGES - 1, NUM_PATHS - 1);
+#undef END
+    free(end);
+    return total;
+}
+
+static const char *stage_name(int s, char *buf, size_t size)
+{
+    if (s == 0) return "camera";
+    if (s == NUM_STAGES - 1) return "resolve";
+    snprintf(buf, size, "bounce %d", s - 1);
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    int depth = STREAM_FIFO_DEPTH;
+    const char *vectors = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:s:d:v:")) != -1) {
+        switch (opt) {
+        case 'r': {
+            int w, h;
+            if (sscanf(optarg, "%dx%d", &w, &h) != 2 || set_resolution(w, h) != 0) {
+                fprintf(stderr, "%s: -r takes WxH, each side 1-%d and at most 4 times the other\n",
+                        argv[0], MAX_RESOLUTION);
+                return 1;
+            }
+            break;
+        }
+        case 'd': depth = atoi(optarg); break;
+        case 'v': vectors = optarg; break;
+        case 's':
+#ifdef COMPILED_SCENE
+            fprintf(stderr, "%s: built with a compiled scene, -s is not available\n", argv[0]);
+            return 1;
+#else
+            if (scene_load(optarg) != 0) return 1;
+            break;
+#endif
+        default:
+            fprintf(stderr, "usage: %s [-r WxH] [-s scene] [-d depth] [-v vectors.hex]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (depth < 1) {
+        fprintf(stderr, "%s: -d must be at least 1\n", argv[0]);
+        return 1;
+    }
+
+    s_dead = calloc(NUM_PIXELS, sizeof(*s_dead));
+    if (!s_dead) { perror("malloc"); return 1; }
+    for (int s = 0; s < NUM_STAGES; ++s) {
+        s_cost[s] = calloc(NUM_PATHS, sizeof(*s_cost[s]));
+        if (!s_cost[s]) { perror("malloc"); return 1; }
+    }
+    measure();
+
+    uint64_t busy[NUM_STAGES];
+    uint64_t hs = handshake_cycles();
+    uint64_t st = stream_cycles(depth, busy);
+
+    printf("%dx%d, %d samples, %d bounces, FIFOs of %d paths\n", g_width, g_height, NUM_SAMPLES, MAX_BOUNCES, depth);
+    printf("handshake  %12llu cycles  %8.3f s/frame  %10.0f pixels/s\n",
+           (unsigned long long)hs, hs / (CLOCK_MHZ * 1e6), NUM_PIXELS / (hs / (CLOCK_MHZ * 1e6)));
+    printf("stream     %12llu cycles  %8.3f s/frame  %10.0f pixels/s\n",
+           (unsigned long long)st, st / (CLOCK_MHZ * 1e6), NUM_PIXELS / (st / (CLOCK_MHZ * 1e6)));
+    printf("speedup    %.2fx (modelled; trace_path_stream is not in top.v)\n", (double)hs / st);
+    printf("stage utilisation (busy / stream frame):\n");
+    for (int s = 0; s < NUM_STAGES; ++s) {
+        char buf[16];
+        printf("  %-9s %5.1f%%\n", stage_name(s, buf, sizeof(buf)), 100.0 * busy[s] / st);
+    }
+
+    int ret = 0;
+    if (vectors) {
+        if (write_vectors(vectors) == 0)
+            printf("Wrote %s\n", vectors);
+        else
+            ret = 1;
+    }
+
+    for (int s = 0; s < NUM_STAGES; ++s)
+        free(s_cost[s]);
+    free(s_dead);
+    return ret;
+}
@@ -1,153 +1,52 @@
 #include <stdint.h>
 #include <stdlib.h>
-#include <math.h>
 
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
-
-// Path tracing settings
-#define MAX_BOUNCES 3
-#define FOV 60.0
-#define LIGHT_INTENSITY 2.0
-#define BRIGHTNESS_SHIFT 4
-#define NUM_SAMPLES 16
-
-// Scene dimensions
-#define NUM_SPHERES 2
-#define NUM_PLANES 6
-
-#define HEIGHT 256
-#define WIDTH 256
-
-// Fixed-point math settings — 16-bit total (4 integer + 12 fractional)
-typedef int16_t fp_t;
-#define FRAC_BITS 12
-#define ONE (1 << FRAC_BITS)
-// Convert a floating-point value to 4.12 fixed-point (rounded)
-#define F(x) ((fp_t)((x) * ONE + ((x) >= 0 ? 0.5f : -0.5f)))
-#define I(x) ((x) >> FRAC_BITS)
-
-// Handy constants
-#define FP_EPS ((fp_t)1)             // ≈ 0.00024 in real units
-#define FP_INF 0x7FFFFFFF            // Large “infinite” distance sentinel
-
-// Simple vector struct
-typedef struct {
-    fp_t x, y, z;
-} Vec3;
-
-typedef struct {
-    uint8_t r, g, b;
-} Color;
-
-// Ray
-typedef struct {
-    Vec3 orig, dir;
-} Ray;
-
-// Material
-typedef struct {
-    Vec3 color;
-    int is_light;
-} Material;
-
-// Sphere
-typedef struct {
-    Vec3 center;
-    fp_t radius;
-    Material material;
-} Sphere;
+#include "trace_path.h"
 
-// Plane
-typedef struct {
-    Vec3 normal;
-    fp_t dist;
-    Material material;
-} Plane;
+#ifdef TRACE_STATS
+__thread TraceStats g_trace_stats;
+#endif
 
-// Structure to hold intersection results
-typedef struct {
-    int32_t t;            // keep 32-bit for extra head-room during comparisons
-    int hit_type; // 0 for sphere, 1 for plane
-    int hit_index;
-    int hit;      // 1 if an object was hit, 0 otherwise
-} Intersection;
-
-#define UNIT_VECTOR_LUT_SIZE 128
-// 64 pre-computed unit vectors stored at 8.8 precision; they will be left-shifted
-// at runtime to 4.12 to keep the table small and readable.
-static const Vec3 g_unit_vector_lut[UNIT_VECTOR_LUT_SIZE] = {
-    {.x = 148,  .y = 148,  .z = 148 }, {.x = -148, .y = -148, .z = -148},
-    {.x = 210,  .y = 0,    .z = 148 }, {.x = -210, .y = 0,    .z = -148},
-    {.x = 0,    .y = 210,  .z = 148 }, {.x = 0,    .y = -210, .z = -148},
-    {.x = 148,  .y = 210,  .z = 0   }, {.x = -148, .y = -210, .z = 0   },
-    {.x = 256,  .y = 0,    .z = 0   }, {.x = -256, .y = 0,    .z = 0   },
-    {.x = 0,    .y = 256,  .z = 0   }, {.x = 0,    .y = -256, .z = 0   },
-    {.x = 0,    .y = 0,    .z = 256 }, {.x = 0,    .y = 0,    .z = -256},
-    {.x = 182,  .y = 182,  .z = 0   }, {.x = -182, .y = -182, .z = 0   },
-    {.x = 182,  .y = 0,    .z = 182 }, {.x = -182, .y = 0,    .z = -182},
-    {.x = 0,    .y = 182,  .z = 182 }, {.x = 0,    .y = -182, .z = -182},
-    {.x = 102,  .y = 102,  .z = 226 }, {.x = -102, .y = -102, .z = -226},
-    {.x = 102,  .y = 226,  .z = 102 }, {.x = -102, .y = -226, .z = -102},
-    {.x = 226,  .y = 102,  .z = 102 }, {.x = -226, .y = -102, .z = -102},
-    {.x = 128,  .y = 128,  .z = 182 }, {.x = -128, .y = -128, .z = -182},
-    {.x = 128,  .y = 182,  .z = 128 }, {.x = -128, .y = -182, .z = -128},
-    {.x = 182,  .y = 128,  .z = 128 }, {.x = -182, .y = -128, .z = -128},
-    {.x =  48,  .y = 252,  .z =  39 }, {.x =  -48, .y = -252, .z =  -39},
-    {.x = 252,  .y =  39,  .z =  48 }, {.x = -252, .y =  -39, .z =  -48},
-    {.x =  39,  .y =  48,  .z = 252 }, {.x =  -39, .y =  -48, .z = -252},
-    {.x = 156,  .y = 195,  .z =   5 }, {.x = -156, .y = -195, .z =   -5},
-    {.x = 195,  .y =   5,  .z = 156 }, {.x = -195, .y =   -5, .z = -156},
-    {.x =   5,  .y = 156,  .z = 195 }, {.x =   -5, .y = -156, .z = -195},
-    {.x =  70,  .y =  70,  .z = 238 }, {.x =  -70, .y =  -70, .z = -238},
-    {.x =  70,  .y = 238,  .z =  70 }, {.x =  -70, .y = -238, .z =  -70},
-    {.x = 238,  .y =  70,  .z =  70 }, {.x = -238, .y =  -70, .z =  -70},
-    {.x = 217,  .y =  86,  .z =  98 }, {.x = -217, .y =  -86, .z =  -98},
-    {.x =  86,  .y =  98,  .z = 217 }, {.x =  -86, .y =  -98, .z = -217},
-    {.x =  98,  .y = 217,  .z =  86 }, {.x =  -98, .y = -217, .z =  -86},
-    {.x = 239,  .y =  48,  .z =  78 }, {.x = -239, .y =  -48, .z =  -78},
-    {.x =  48,  .y =  78,  .z = 239 }, {.x =  -48, .y =  -78, .z = -239},
-    {.x =  78,  .y = 239,  .z =  48 }, {.x =  -78, .y = -239, .z =  -48},
-    {.x = 180, .y =  34, .z = 193}, {.x = -180, .y =  34, .z = -193},
-    {.x =  34, .y = 193, .z = 180}, {.x =  -34, .y = -193, .z = -180},
-    {.x = 193, .y = 180, .z =  34}, {.x = -193, .y = -180, .z =  -34},
-    {.x =  45, .y = 210, .z = 160}, {.x =  -45, .y = -210, .z = -160},
-    {.x = 210, .y = 160, .z =  45}, {.x = -210, .y = -160, .z =  -45},
-    {.x = 160, .y =  45, .z = 210}, {.x = -160, .y =  -45, .z = -210},
-    {.x = 125, .y = 230, .z =  70}, {.x = -125, .y = -230, .z =  -70},
-    {.x = 230, .y =  70, .z = 125}, {.x = -230, .y =  -70, .z = -125},
-    {.x =  70, .y = 125, .z = 230}, {.x =  -70, .y = -125, .z = -230},
-    {.x = 190, .y = 200, .z =  20}, {.x = -190, .y = -200, .z =  -20},
-    {.x = 200, .y =  20, .z = 190}, {.x = -200, .y =  -20, .z = -190},
-    {.x =  20, .y = 190, .z = 200}, {.x =  -20, .y = -190, .z = -200},
-    {.x =  95, .y = 215, .z = 140}, {.x =  -95, .y = -215, .z = -140},
-    {.x = 215, .y = 140, .z =  95}, {.x = -215, .y = -140, .z =  -95},
-    {.x = 140, .y =  95, .z = 215}, {.x = -140, .y =  -95, .z = -215},
-    {.x =  60, .y = 180, .z = 230}, {.x =  -60, .y = -180, .z = -230},
-    {.x = 180, .y = 230, .z =  60}, {.x = -180, .y = -230, .z =  -60},
-    {.x = 230, .y =  60, .z = 180}, {.x = -230, .y =  -60, .z = -180},
-    {.x = 130, .y = 200, .z = 150}, {.x = -130, .y = -200, .z = -150},
-    {.x = 200, .y = 150, .z = 130}, {.x = -200, .y = -150, .z = -130},
-    {.x = 150, .y = 130, .z = 200}, {.x = -150, .y = -130, .z = -200},
-    {.x =  85, .y = 145, .z = 240}, {.x =  -85, .y = -145, .z = -240},
-    {.x = 145, .y = 240, .z =  85}, {.x = -145, .y = -240, .z =  -85},
-    {.x = 240, .y =  85, .z = 145}, {.x = -240, .y =  -85, .z = -145},
-    {.x = 170, .y = 100, .z = 220}, {.x = -170, .y = -100, .z = -220},
-    {.x = 100, .y = 220, .z = 170}, {.x = -100, .y = -220, .z = -170},
-    {.x = 220, .y = 170, .z = 100}, {.x = -220, .y = -170, .z = -100},
-    {.x =  66, .y = 210, .z = 195}, {.x =  -66, .y = -210, .z = -195},
-    {.x = 210, .y = 195, .z =  66}, {.x = -210, .y = -195, .z =  -66},
-    {.x = 195, .y =  66, .z = 210}, {.x = -195, .y =  -66, .z = -210},
-    {.x = 110, .y = 180, .z = 210}, {.x = -110, .y = -180, .z = -210}
+// cos(pi/2 * i / QUARTER_WAVE_SIZE) in Q15, i = 0..QUARTER_WAVE_SIZE. One
+// quadrant gives sin and cos of every angle in 1/(4 * QUARTER_WAVE_SIZE) turns.
+const uint16_t g_cos_lut[QUARTER_WAVE_SIZE + 1] = {
+    32768, 32767, 32766, 32762, 32758, 32753, 32746, 32738, 32729, 32718, 32706, 32693,
+    32679, 32664, 32647, 32629, 32610, 32590, 32568, 32546, 32522, 32496, 32470, 32442,
+    32413, 32383, 32352, 32319, 32286, 32251, 32214, 32177, 32138, 32099, 32058, 32015,
+    31972, 31927, 31881, 31834, 31786, 31737, 31686, 31634, 31581, 31527, 31471, 31415,
+    31357, 31298, 31238, 31177, 31114, 31050, 30986, 30920, 30853, 30784, 30715, 30644,
+    30572, 30499, 30425, 30350, 30274, 30196, 30118, 30038, 29957, 29875, 29792, 29707,
+    29622, 29535, 29448, 29359, 29269, 29178, 29086, 28993, 28899, 28803, 28707, 28610,
+    28511, 28411, 28311, 28209, 28106, 28002, 27897, 27791, 27684, 27576, 27467, 27357,
+    27246, 27133, 27020, 26906, 26791, 26674, 26557, 26439, 26320, 26199, 26078, 25956,
+    25833, 25708, 25583, 25457, 25330, 25202, 25073, 24943, 24812, 24680, 24548, 24414,
+    24279, 24144, 24008, 23870, 23732, 23593, 23453, 23312, 23170, 23028, 22884, 22740,
+    22595, 22449, 22302, 22154, 22006, 21856, 21706, 21555, 21403, 21251, 21097, 20943,
+    20788, 20632, 20475, 20318, 20160, 20001, 19841, 19681, 19520, 19358, 19195, 19032,
+    18868, 18703, 18538, 18372, 18205, 18037, 17869, 17700, 17531, 17361, 17190, 17018,
+    16846, 16673, 16500, 16326, 16151, 15976, 15800, 15624, 15447, 15269, 15091, 14912,
+    14733, 14553, 14373, 14192, 14010, 13828, 13646, 13463, 13279, 13095, 12910, 12725,
+    12540, 12354, 12167, 11980, 11793, 11605, 11417, 11228, 11039, 10850, 10660, 10469,
+    10279, 10088,  9896,  9704,  9512,  9319,  9127,  8933,  8740,  8546,  8351,  8157,
+     7962,  7767,  7571,  7376,  7180,  6983,  6787,  6590,  6393,  6195,  5998,  5800,
+     5602,  5404,  5205,  5007,  4808,  4609,  4410,  4211,  4011,  3812,  3612,  3412,
+     3212,  3012,  2811,  2611,  2411,  2210,  2009,  1809,  1608,  1407,  1206,  1005,
+      804,   603,   402,   201,     0
 };
 
-static const Sphere g_spheres[NUM_SPHERES] = {
+#ifndef COMPILED_SCENE
+// Default scene: the Cornell box. The host testbench may overwrite it with
+// scene_load() before rendering.
+int g_num_spheres = 2;
+int g_num_planes = 6;
+int g_light_plane = 1;
+
+Sphere g_spheres[MAX_SPHERES] = {
     {.center = {.x = F(-0.6), .y = F(0.0), .z = F(-2.8)}, .radius = F(0.7), .material = {.color = {.x = F(1.0), .y = F(0.7), .z = F(0.2)}, .is_light = 0}}, // Large yellow sphere
     {.center = {.x = F(0.6), .y = F(-0.5), .z = F(-3.2)}, .radius = F(0.5), .material = {.color = {.x = F(0.5), .y = F(0.5), .z = F(0.5)}, .is_light = 0}}  // Small grey sphere
 };
 
-static const Plane g_planes[NUM_PLANES] = {
+Plane g_planes[MAX_PLANES] = {
     {.normal = {.x = F(0), .y = F(1), .z = F(0)}, .dist = F(-1), .material = {.color = {.x = F(0.75), .y = F(0.75), .z = F(0.75)}, .is_light = 0}},   // Floor
     // Emissive light panel – slightly below the ceiling so the ceiling itself can receive light
     {.normal = {.x = F(0), .y = F(-1), .z = F(0)}, .dist = F(-2.99), .material = {.color = {.x = F(LIGHT_INTENSITY), .y = F(LIGHT_INTENSITY), .z = F(LIGHT_INTENSITY)}, .is_light = 1}},
@@ -158,12 +57,12 @@ static const Plane g_planes[NUM_PLANES] = {
     {.normal = {.x = F(0), .y = F(0), .z = F(1)}, .dist = F(-5), .material = {.color = {.x = F(0.75), .y = F(0.75), .z = F(0.75)}, .is_light = 0}},   // Back wall
 };
 
-// Fixed-point multiplication
-// 8.8 fixed-point multiply (fp_t × fp_t → 32-bit)
-
-static int32_t mul(int32_t a, int32_t b) {
-    return (int32_t)(((int64_t)a * (int64_t)b) >> FRAC_BITS);
-}
+// A single leaf holding both spheres, with bounds that every ray enters. For
+// two spheres that is as good as a tree; scene_build_bvh() builds a real one.
+BvhNode g_bvh[MAX_BVH_NODES] = {
+    {.min = {.x = FP_MIN, .y = FP_MIN, .z = FP_MIN}, .max = {.x = FP_MAX, .y = FP_MAX, .z = FP_MAX}, .first = 0, .count = 2},
+};
+#endif
 
 // Fixed-point division
 int32_t div_fp(int32_t a, int32_t b) {
@@ -173,15 +72,53 @@ int32_t div_fp(int32_t a, int32_t b) {
 }
 
 
-// Fast inverse square root for fixed-point numbers
-static int32_t inv_sqrt_fp(int32_t x) {
+// 1/sqrt(M) in Q15 for M in [i/32, (i+1)/32), i = 32..127, chosen so the
+// relative error is the same at both ends of the interval (at most 0.8%).
+const uint16_t g_inv_sqrt_lut[INV_SQRT_LUT_SIZE] = {
+    32516, 32027, 31559, 31112, 30682, 30270, 29875, 29494, 29128, 28775, 28434, 28105,
+    27788, 27481, 27183, 26896, 26617, 26347, 26085, 25830, 25583, 25343, 25109, 24882,
+    24661, 24445, 24235, 24031, 23831, 23637, 23447, 23262, 23081, 22904, 22731, 22562,
+    22397, 22235, 22077, 21922, 21770, 21621, 21476, 21333, 21193, 21056, 20921, 20789,
+    20660, 20533, 20408, 20285, 20165, 20047, 19931, 19816, 19704, 19594, 19485, 19378,
+    19273, 19170, 19068, 18968, 18870, 18773, 18677, 18583, 18490, 18399, 18309, 18220,
+    18133, 18047, 17962, 17878, 17796, 17714, 17634, 17555, 17476, 17399, 17323, 17248,
+    17174, 17100, 17028, 16957, 16886, 16817, 16748, 16680, 16613, 16546, 16481, 16416,
+};
+
+// Inverse square root, integer only (no float cores on the FPGA). x is
+// shifted left by an even amount into [2^30, 2^32), so that the root only
+// moves the exponent; the table seeds 1/sqrt of the mantissa and one Newton
+// step takes it to ~1e-4. Result in 4.12, truncated.
+int32_t inv_sqrt_fp(int32_t x) {
     if (x <= 0) return 0;
-    float x_f = (float)x / (float)ONE;
-    union { float f; uint32_t i; } u;
-    u.f = x_f;
-    u.i = 0x5f3759df - (u.i >> 1);
-    u.f = u.f * (1.5f - 0.5f * x_f * u.f * u.f);
-    return (int32_t)(u.f * (float)ONE);
+
+    // sh + FRAC_BITS must be even for the root of the exponent to be exact
+#if defined(__GNUC__) && !defined(__SYNTHESIS__)
+    int sh = __builtin_clz((uint32_t)x);
+    sh -= (sh ^ FRAC_BITS) & 1;
+    uint32_t m = (uint32_t)x << sh;
+#else
+    uint32_t m = (uint32_t)x;
+    int sh = 0;
+    if ((m >> 16) == 0) { m <<= 16; sh += 16; }
+    if ((m >> 24) == 0) { m <<= 8;  sh += 8; }
+    if ((m >> 28) == 0) { m <<= 4;  sh += 4; }
+    if ((m >> 30) == 0) { m <<= 2;  sh += 2; }
+#if FRAC_BITS & 1
+    if ((m >> 31) == 0) { m <<= 1;  sh += 1; }
+    if ((sh ^ FRAC_BITS) & 1) { m >>= 1; sh -= 1; }    // the bit shifted out is 0
+#endif
+#endif
+
+    // y = 1/sqrt(M) in Q15 for M = m / 2^30; Newton: y *= (3 - M y^2) / 2
+    uint32_t y = g_inv_sqrt_lut[(m >> 25) - 32];
+    uint32_t h = (uint32_t)(((uint64_t)(m >> 2) * (y * y)) >> 30);     // M y^2 in Q28
+    y = (uint32_t)(((uint64_t)y * ((3u << 28) - h) + (1u << 28)) >> 29);
+
+    // x = M * 2^(30 - sh - FRAC_BITS) in real units, so in fixed point
+    // 1/sqrt(x) = y * 2^e with e = (3 FRAC_BITS + sh - 60) / 2 (at 4.12: (sh - 24) / 2)
+    int e = (3 * FRAC_BITS + sh - 60) / 2;
+    return (int32_t)(e >= 0 ? y << e : y >> -e);
 }
 
 // Fixed-point square root
@@ -196,49 +133,117 @@ static inline int fp_to_u8(fp_t v)
     /* scale by 2^BRIGHTNESS_SHIFT, then normalise to 0…255 */
     int32_t disp = v << BRIGHTNESS_SHIFT;
     int val = ((int64_t)disp * 255) >> FRAC_BITS;
+    if (val > 255 || val < 0) STAT_INC(u8_saturated);
     return val > 255 ? 255 : (val < 0 ? 0 : val);
 }
 
 // Random number generation
-static uint32_t rand_state = 12345;
-static uint32_t rand_u32() { // maybe make it generate 3 randon numbers each clock cycle?
-    // xorshift
-    rand_state ^= rand_state << 13;
-    rand_state ^= rand_state >> 17;
-    rand_state ^= rand_state << 5;
-    return rand_state;
+// Stateless, counter-based: every draw is a function of (x, y, sample,
+// bounce, dimension), so any pixel or sample can be traced on any thread or
+// HLS instance, in any order, with the same result. There is no state
+// carried from one draw to the next.
+// Dimensions (RAND_DIM_*) are listed in trace_path.h.
+
+// PCG RXS-M-XS output permutation used as a 32-bit integer hash.
+static uint32_t rand_hash(uint32_t v) {
+    uint32_t state = v * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+    return (word >> 22) ^ word;
 }
 
-int32_t rand_fp() {
-    return (int32_t)((uint64_t)rand_u32() * ONE >> 32);
+// Key for one sample of one pixel; the sampler hashes the seed again per
+// (bounce, dimension).
+PathKey rand_path_key(int16_t x, int16_t y, int sample) {
+    uint32_t pixel = ((uint32_t)(uint16_t)y << 16) | (uint16_t)x;
+    return (PathKey){ rand_hash(pixel), (uint32_t)sample };
 }
 
+// Sampler
+// The 2D draws (light point, bounce direction) come from the first two
+// dimensions of the Sobol sequence, with hash-based Owen scrambling (Burley,
+// "Practical Hash-based Owen Scrambling", JCGT 2020): the pixel's sample
+// index is shuffled and each (bounce, dimension) pair is scrambled with its
+// own seed. Any power-of-two run of samples of a pixel is then stratified
+// over the square in both pairs, while pixels and bounces stay uncorrelated.
+// Only shifts, xors and multiplies; nothing to store but the seed.
+
+static uint32_t reverse_bits(uint32_t v) {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0F0F0F0Fu) | ((v & 0x0F0F0F0Fu) << 4);
+    v = ((v >> 8) & 0x00FF00FFu) | ((v & 0x00FF00FFu) << 8);
+    return (v >> 16) | (v << 16);
+}
 
-Vec3 random_unit_vector() {
-    uint32_t r_val = rand_u32();
-    int lut_idx = r_val & 0x7F;
-    Vec3 base = g_unit_vector_lut[lut_idx];
-    // Convert from 8.8 → 4.12 by left-shifting 4 bits.
-    return (Vec3){ (fp_t)(base.x << (FRAC_BITS - 8)),
-                   (fp_t)(base.y << (FRAC_BITS - 8)),
-                   (fp_t)(base.z << (FRAC_BITS - 8)) };
+// Random permutation in which every bit only depends on the bits below it
+// (Laine-Karras). Applied to a bit-reversed value it is an Owen scramble.
+static uint32_t lk_permute(uint32_t v, uint32_t seed) {
+    v += seed;
+    v ^= v * 0x6c50b47cu;
+    v ^= v * 0xb82f1e52u;
+    v ^= v * 0xc7afe638u;
+    v ^= v * 0x8d22f6e6u;
+    return v;
 }
 
-// Forward declarations
-int is_on_light(Vec3 p);
-int32_t intersect_sphere(Ray r, Sphere s);
-int32_t intersect_plane(Ray r, Plane p);
-Intersection intersect_scene(Ray r);
+// The Sobol points are built bit-reversed, where the output scrambles need no
+// reversal of their own; only the results are turned back. Dimension 0,
+// reversed, is the index itself, here the pixel's shuffled sample index.
+static uint32_t sobol_index(PathKey key, int bounce, int dim, uint32_t *seed) {
+    // Golden-ratio steps keep the (bounce, dimension) seeds apart before the hash
+    *seed = rand_hash(key.seed + (uint32_t)(bounce * RAND_DIMS + dim) * 0x9E3779B9u);
+    return reverse_bits(lk_permute(reverse_bits(key.index), *seed));
+}
 
+uint32_t sample_1d(PathKey key, int bounce, int dim) {
+    uint32_t seed;
+    uint32_t i = sobol_index(key, bounce, dim, &seed);
+    return reverse_bits(lk_permute(i, rand_hash(seed)));
+}
+
+void sample_2d(PathKey key, int bounce, int dim, uint32_t u[2]) {
+    uint32_t seed;
+    uint32_t i = sobol_index(key, bounce, dim, &seed);
+
+    // Dimension 1, reversed, has the direction numbers (1 + x)^k over GF(2)
+    // for index bit k, so it is the index read as a polynomial at x + 1: a
+    // Taylor shift, done on ever larger blocks like reverse_bits().
+    uint32_t y = i;
+    y ^= (y >> 1) & 0x55555555u;
+    y ^= (y >> 2) & 0x33333333u;
+    y ^= (y >> 4) & 0x0F0F0F0Fu;
+    y ^= (y >> 8) & 0x00FF00FFu;
+    y ^= y >> 16;
+    u[0] = reverse_bits(lk_permute(i, rand_hash(seed)));
+    u[1] = reverse_bits(lk_permute(y, rand_hash(seed + 1)));
+}
+
+// Q15 -> FRAC_BITS
+#define Q15_TO_FP(v) (FRAC_BITS <= 15 ? (int32_t)(v) >> (15 - FRAC_BITS) : (int32_t)(v) << (FRAC_BITS - 15))
+
+// cos and sin of a whole-turn angle given as 0.32 fixed point
+static void cos_sin_turn(uint32_t angle, int32_t *c, int32_t *s) {
+    // Nearest table step; a full turn wraps around to 0
+    uint32_t a = (angle + (1u << (32 - 3 - QUARTER_WAVE_BITS))) >> (32 - 2 - QUARTER_WAVE_BITS);
+    int quadrant = a >> QUARTER_WAVE_BITS;
+    int i = a & (QUARTER_WAVE_SIZE - 1);
+    int32_t ci = Q15_TO_FP(g_cos_lut[i]), si = Q15_TO_FP(g_cos_lut[QUARTER_WAVE_SIZE - i]);
+    switch (quadrant) {
+    case 0:  *c = ci;  *s = si;  break;
+    case 1:  *c = -si; *s = ci;  break;
+    case 2:  *c = -ci; *s = -si; break;
+    default: *c = si;  *s = -ci; break;
+    }
+}
 
 // Vector operations
-Vec3 vec_add(Vec3 a, Vec3 b) { return (Vec3){a.x + b.x, a.y + b.y, a.z + b.z}; }
-Vec3 vec_sub(Vec3 a, Vec3 b) { return (Vec3){a.x - b.x, a.y - b.y, a.z - b.z}; }
+Vec3 vec_add(Vec3 a, Vec3 b) { return (Vec3){FP_NARROW(a.x + b.x), FP_NARROW(a.y + b.y), FP_NARROW(a.z + b.z)}; }
+Vec3 vec_sub(Vec3 a, Vec3 b) { return (Vec3){FP_NARROW(a.x - b.x), FP_NARROW(a.y - b.y), FP_NARROW(a.z - b.z)}; }
 int32_t vec_dot(Vec3 a, Vec3 b) { return mul(a.x, b.x) + mul(a.y, b.y) + mul(a.z, b.z); }
-Vec3 vec_mul(Vec3 a, Vec3 b) { return (Vec3){ (fp_t)mul(a.x, b.x), (fp_t)mul(a.y, b.y), (fp_t)mul(a.z, b.z)}; }
+Vec3 vec_mul(Vec3 a, Vec3 b) { return (Vec3){ FP_NARROW(mul(a.x, b.x)), FP_NARROW(mul(a.y, b.y)), FP_NARROW(mul(a.z, b.z))}; }
 Vec3 vec_scale(Vec3 v, int32_t s) {
-    fp_t s_fp = (fp_t)s; // clamp / cast the scalar into fp_t range
-    return (Vec3){ (fp_t)mul(v.x, s_fp), (fp_t)mul(v.y, s_fp), (fp_t)mul(v.z, s_fp)};
+    fp_t s_fp = FP_NARROW(s); // clamp / cast the scalar into fp_t range
+    return (Vec3){ FP_NARROW(mul(v.x, s_fp)), FP_NARROW(mul(v.y, s_fp)), FP_NARROW(mul(v.z, s_fp))};
 }
 int32_t vec_len_sq(Vec3 v) { return vec_dot(v, v); }
 Vec3 vec_norm(Vec3 v) {
@@ -247,47 +252,130 @@ Vec3 vec_norm(Vec3 v) {
     return vec_scale(v, inv_len);
 }
 
-// Returns an Intersection result.
-Intersection intersect_scene(Ray r) {
-    int32_t dists[NUM_SPHERES+NUM_PLANES];
+// Cosine-weighted direction about the unit normal n: a point spread uniformly
+// over the unit disk (radius sqrt(u0), angle u1), lifted onto the hemisphere,
+// in a basis built from n without branches on its orientation (Duff et al.,
+// "Building an Orthonormal Basis, Revisited", JCGT 2017). Unit length up to
+// rounding, so it needs no vec_norm.
+Vec3 cosine_direction(PathKey key, int bounce, Vec3 n) {
+    uint32_t u[2];
+    sample_2d(key, bounce, RAND_DIM_BOUNCE, u);
+    int32_t r_sq = (int32_t)(u[0] >> (32 - FRAC_BITS));
+    int32_t r = sqrt_fp(r_sq);
+    int32_t h = sqrt_fp(ONE - r_sq);     // height above the surface
+    int32_t c, s;
+    cos_sin_turn(u[1], &c, &s);
+
+    int sign = n.z >= 0 ? 1 : -1;
+    int32_t a = div_fp(-ONE, sign * ONE + n.z);
+    int32_t b = mul(mul(n.x, n.y), a);
+    Vec3 t  = { FP_NARROW(ONE + sign * mul(mul(n.x, n.x), a)), FP_NARROW(sign * b), FP_NARROW(-sign * n.x) };
+    Vec3 bt = { FP_NARROW(b), FP_NARROW(sign * ONE + mul(mul(n.y, n.y), a)), FP_NARROW(-n.y) };
+
+    return vec_add(vec_add(vec_scale(t, mul(r, c)), vec_scale(bt, mul(r, s))), vec_scale(n, h));
+}
 
-    // Sphere intersection
+RayInv ray_inv(Vec3 dir) {
+    return (RayInv){div_fp(ONE, dir.x), div_fp(ONE, dir.y), div_fp(ONE, dir.z)};
+}
+
+// Clip [tmin, tmax] against one slab of a box. Returns 0 once it is empty.
+static int clip_slab(fp_t o, fp_t d, int32_t inv, fp_t lo, fp_t hi, int32_t *tmin, int32_t *tmax) {
+    if (d == 0) return o >= lo && o <= hi; // parallel: inside or never
+    int32_t t1 = mul(lo - o, inv);
+    int32_t t2 = mul(hi - o, inv);
+    if (t1 > t2) { int32_t tmp = t1; t1 = t2; t2 = tmp; }
+    if (t1 > *tmin) *tmin = t1;
+    if (t2 < *tmax) *tmax = t2;
+    return *tmin <= *tmax;
+}
+
+int32_t intersect_box(Ray r, RayInv inv, const BvhNode *n) {
+    STAT_INC(box_tests);
+    int32_t tmin = 0, tmax = FP_INF;
+    if (!clip_slab(r.orig.x, r.dir.x, inv.x, n->min.x, n->max.x, &tmin, &tmax)) return FP_INF;
+    if (!clip_slab(r.orig.y, r.dir.y, inv.y, n->min.y, n->max.y, &tmin, &tmax)) return FP_INF;
+    if (!clip_slab(r.orig.z, r.dir.z, inv.z, n->min.z, n->max.z, &tmin, &tmax)) return FP_INF;
+    return tmin;
+}
+
+#ifdef COMPILED_SCENE
+// Scene data, intersect_scene() and occluded() specialised for one
+// scene by scenec.py (constants folded, BVH walk unrolled, axis-aligned
+// plane fast paths)
+#include "scene_compiled.h"
+#else
+// Nearest hit among the spheres of one leaf. Ties go to the lower sphere
+// index, as in a linear scan, so the result does not depend on the order
+// leaves are visited in.
+static void intersect_leaf(Ray r, const BvhNode *n, Intersection *result) {
     LOOP_I:
-    for (size_t i = 0; i < NUM_SPHERES; ++i) {
+    for (int i = n->first; i < n->first + n->count; ++i) {
         #pragma HLS pipeline off
         int32_t t = intersect_sphere(r, g_spheres[i]);
-        dists[i] = t;
+        if (t < result->t || (t == result->t && t != FP_INF && i < result->hit_index)) {
+            result->t = t;
+            result->hit_type = 0;   // sphere
+            result->hit_index = i;
+        }
     }
-    
-    // Plane intersection
-    LOOP_J:
-    for (size_t j = 0; j < NUM_PLANES; ++j) {
+}
+
+// Nearest sphere along r through the BVH. Boxes further than the current
+// nearest hit are skipped.
+static void intersect_spheres(Ray r, Intersection *result) {
+    // A tree that is a single leaf (small scenes) needs no box test or 1/dir
+    if (g_bvh[0].count != 0) {
+        intersect_leaf(r, &g_bvh[0], result);
+        return;
+    }
+
+    RayInv inv = ray_inv(r.dir);
+    uint16_t stack[BVH_STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = 0;
+
+    LOOP_BVH:
+    while (sp > 0) {
         #pragma HLS pipeline off
-        int32_t t = intersect_plane(r, g_planes[j]);
-        dists[j+NUM_SPHERES] = t;
+        const BvhNode *n = &g_bvh[stack[--sp]];
+        int32_t t_box = intersect_box(r, inv, n);
+        if (t_box == FP_INF || t_box > result->t) continue;
+
+        if (n->count == 0) {
+            stack[sp++] = n->first + 1;
+            stack[sp++] = n->first;     // left child is visited first
+            continue;
+        }
+        intersect_leaf(r, n, result);
     }
+}
 
+// Returns an Intersection result.
+Intersection intersect_scene(Ray r) {
     Intersection result;
     result.t = FP_INF;
     result.hit_type = -1;
     result.hit_index = -1;
     result.hit = 0;
 
-    LOOP_K:
-    for (size_t k = 0; k < NUM_SPHERES+NUM_PLANES; ++k) {
+    // Sphere intersection
+    if (g_num_spheres > 0) intersect_spheres(r, &result);
+
+    // Plane intersection. Planes are unbounded, so they stay a flat list and
+    // are tested after the spheres; on a tie the sphere wins.
+    LOOP_J:
+    for (int j = 0; j < g_num_planes; ++j) {
         #pragma HLS pipeline off
-        if (dists[k] < result.t) {
-            result.t = dists[k];
-            if (k < NUM_SPHERES) {          // correct test
-                result.hit_type  = 0;       // sphere
-                result.hit_index = k;
-            } else {
-                result.hit_type  = 1;       // plane
-                result.hit_index = k - NUM_SPHERES;
-            }
+        #pragma HLS loop_tripcount max=MAX_PLANES
+        int32_t t = intersect_plane(r, g_planes[j]);
+        if (t < result.t) {
+            result.t = t;
+            result.hit_type  = 1;       // plane
+            result.hit_index = j;
         }
     }
-    
+
     if (result.hit_type != -1) {
         result.hit = 1;
     }
@@ -295,9 +383,62 @@ Intersection intersect_scene(Ray r) {
     return result;
 }
 
+// Any-hit walk of one leaf; stops at the first sphere in front of max_t.
+static int leaf_blocks(Ray ray, const BvhNode *n, int32_t max_t) {
+    for (int i = n->first; i < n->first + n->count; ++i) {
+        #pragma HLS pipeline off
+        if (sphere_blocks(ray, g_spheres[i], max_t)) return 1;
+    }
+    return 0;
+}
+
+// Does any sphere block the ray before max_t? Boxes that start past max_t
+// are skipped and the walk ends at the first blocker.
+static int spheres_block(Ray ray, int32_t max_t) {
+    if (g_bvh[0].count != 0) return leaf_blocks(ray, &g_bvh[0], max_t);
+
+    RayInv inv = ray_inv(ray.dir);
+    uint16_t stack[BVH_STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = 0;
+
+    LOOP_BVH_SHADOW:
+    while (sp > 0) {
+        #pragma HLS pipeline off
+        const BvhNode *n = &g_bvh[stack[--sp]];
+        int32_t t_box = intersect_box(ray, inv, n);
+        if (t_box == FP_INF || t_box >= max_t) continue;
+
+        if (n->count == 0) {
+            stack[sp++] = n->first + 1;
+            stack[sp++] = n->first;
+            continue;
+        }
+        if (leaf_blocks(ray, n, max_t)) return 1;
+    }
+    return 0;
+}
+
+// Spheres are tested first: they sit inside the room and cast the shadows,
+// while the planes bound it and only block when the ray leaves it.
+int occluded(Ray ray, int32_t max_t) {
+    if (g_num_spheres > 0 && spheres_block(ray, max_t)) return 1;
+    LOOP_J:
+    for (int j = 0; j < g_num_planes; ++j) {
+        #pragma HLS pipeline off
+        #pragma HLS loop_tripcount max=MAX_PLANES
+        if (g_planes[j].material.is_light) continue; // Don't treat the emissive plane as occluder
+        if (plane_blocks(ray, g_planes[j], max_t)) return 1;
+    }
+    return 0;
+}
+
+#endif
+
 // Ray-sphere intersection
 int32_t intersect_sphere(Ray r, Sphere s) {
     //#pragma HLS ALLOCATION function instances=mul limit=2
+    STAT_INC(sphere_tests);
     Vec3 oc = vec_sub(r.orig, s.center);
     int32_t a = vec_dot(r.dir, r.dir);
     int32_t b = 2 * vec_dot(oc, r.dir);
@@ -318,8 +459,38 @@ int32_t intersect_sphere(Ray r, Sphere s) {
     return FP_INF;
 }
 
+// Any-hit sphere test. With f(t) = a t^2 + b t + c for the ray, the sign of
+// c says whether the origin is inside, and f(max_t) and the vertex -b / 2a
+// bracket the roots against max_t, so no root is ever computed.
+int sphere_blocks(Ray r, Sphere s, int32_t max_t) {
+    STAT_INC(sphere_tests);
+    Vec3 oc = vec_sub(r.orig, s.center);
+    int32_t a = vec_dot(r.dir, r.dir);
+    int32_t b = 2 * vec_dot(oc, r.dir);
+    int32_t c = vec_dot(oc, oc) - mul(s.radius, s.radius);
+    int32_t f_max = mul(mul(a, max_t) + b, max_t) + c;
+
+    if (c < 0) return f_max > 0;                    // inside: leaves before max_t?
+    if (b >= 0) return 0;                           // outside, moving away
+    if (f_max < 0) return 1;                        // max_t is inside the sphere
+    if (-b >= 2 * mul(a, max_t)) return 0;          // both roots past max_t
+    return mul(b, b) - 4 * mul(a, c) >= 0;          // both roots before max_t, if real
+}
+
+// Any-hit plane test. num is dot(n, p - o), t = num / denom, and rest is the
+// same for the ray's end point; the plane lies between them iff their signs
+// differ, so the divide is not needed either.
+int plane_blocks(Ray r, Plane p, int32_t max_t) {
+    STAT_INC(plane_tests);
+    int32_t denom = vec_dot(p.normal, r.dir);
+    int32_t num = vec_dot(p.normal, vec_sub(vec_scale(p.normal, p.dist), r.orig));
+    int32_t rest = num - mul(max_t, denom);
+    return (num > 0 && rest < 0) || (num < 0 && rest > 0);
+}
+
 // Ray-plane intersection
 int32_t intersect_plane(Ray r, Plane p) {
+    STAT_INC(plane_tests);
     int32_t denom = vec_dot(p.normal, r.dir);
     if (denom > -FP_EPS && denom < FP_EPS) return FP_INF; // Parallel
     int32_t t = div_fp(vec_dot(p.normal, vec_sub(vec_scale(p.normal, p.dist), r.orig)), denom);
@@ -335,136 +506,434 @@ int32_t intersect_plane(Ray r, Plane p) {
     return t;
 }
 
+// Camera. The unnormalised direction is linear in the pixel position, so it
+// is built from a per-pixel step in Q24 instead of float NDC math:
+// dir = (2p/size - 1) * tan(FOV/2) = p * step - tan(FOV/2). FOV is the
+// vertical field of view; pixels stay square, so a wider frame sees further
+// to the sides (scale_x = tan(FOV/2) * width / height). The steps are
+// integer divides of CAM_SCALE, so the IP can work them out from its frame
+// size arguments and trace exactly the rays the host does.
+#define CAM_FRAC 24
+#define CAM_SCALE ((int32_t)(FOV_SCALE * (1 << CAM_FRAC) + 0.5))
+#define CAM_STEP(height) ((2 * CAM_SCALE + (height) / 2) / (height))
+#define CAM_SCALE_X(width, height) ((int32_t)(((int64_t)CAM_SCALE * (width) + (height) / 2) / (height)))
+
+int g_width = WIDTH;
+int g_height = HEIGHT;
+static int32_t s_cam_step = CAM_STEP(HEIGHT);
+static int32_t s_cam_scale_x = CAM_SCALE_X(WIDTH, HEIGHT);
+
+int set_resolution(int width, int height) {
+    // Past 4:1 the side rays outgrow fp_t at the default 4.12
+    if (width < 1 || width > MAX_RESOLUTION || height < 1 || height > MAX_RESOLUTION
+        || width > 4 * height || height > 4 * width)
+        return -1;
+    g_width = width;
+    g_height = height;
+    s_cam_step = CAM_STEP(height);
+    s_cam_scale_x = CAM_SCALE_X(width, height);
+    return 0;
+}
+
+// Q24 -> fixed point, rounded half away from zero like F()
+static fp_t cam_to_fp(int32_t v) {
+    const int32_t half = 1 << (CAM_FRAC - FRAC_BITS - 1);
+    return FP_NARROW(v >= 0 ? (v + half) >> (CAM_FRAC - FRAC_BITS) : -((-v + half) >> (CAM_FRAC - FRAC_BITS)));
+}
+
+// Camera ray of a pixel for the given steps (CAM_STEP, CAM_SCALE_X)
+static Ray camera_ray_steps(int16_t x, int16_t y, int32_t step, int32_t scale_x) {
+    Ray r = {{F(0), F(0.8), F(2)}, {F(0), F(0), F(-1)}};
+    r.dir.x = cam_to_fp(x * step - scale_x);
+    r.dir.y = cam_to_fp(CAM_SCALE - y * step);
+    r.dir = vec_norm(r.dir);
+    return r;
+}
+
+Ray camera_ray(int16_t x, int16_t y) {
+    return camera_ray_steps(x, y, s_cam_step, s_cam_scale_x);
+}
+
+// Point, normal and material of a hit. is_light is set only on the emitting
+// rectangle; the rest of the light's plane comes back as a grey surface.
+static Material hit_surface(Ray ray, Intersection inter, Vec3 *hit_point, Vec3 *hit_normal) {
+    int32_t t = inter.t;
+    int hit_object_type = inter.hit_type;
+    int hit_object_index = inter.hit_index;
+
+    *hit_point = vec_add(ray.orig, vec_scale(ray.dir, t));
+    Material mat;
+
+    if (hit_object_type == 0) { // Sphere
+        mat = g_spheres[hit_object_index].material;
+        *hit_normal = vec_norm(vec_sub(*hit_point, g_spheres[hit_object_index].center));
+    } else { // Plane
+        mat = g_planes[hit_object_index].material;
+        *hit_normal = g_planes[hit_object_index].normal;
+    }
+
+    if (mat.is_light && !is_on_light(*hit_point)) {
+        // Hit ceiling, but outside the light. Treat as grey.
+        mat.color = (Vec3){F(0.2), F(0.2), F(0.2)};
+        mat.is_light = 0;
+    }
+    return mat;
+}
+
+int path_hit(PathState *ps, Intersection inter, int b, PathKey key, BounceState *bs) {
+    if (b == 0) STAT_INC(camera_rays); else STAT_INC(bounce_rays);
+    if (!inter.hit) {
+        STAT_INC(escaped[b]);
+        ps->attenuation = (Vec3){F(0), F(0), F(0)};
+        return 0;
+    }
+
+    Vec3 hit_point, hit_normal;
+    Material surface_mat = hit_surface(ps->ray, inter, &hit_point, &hit_normal);
+    if (surface_mat.is_light) {
+        // Only add emission for camera rays to avoid float counting with NEE
+        if (b == 0) {
+            ps->color = vec_add(ps->color, surface_mat.color);
+        }
+        // Nothing after this would add light, so end the path here
+        STAT_INC(light_hits);
+        ps->attenuation = (Vec3){F(0), F(0), F(0)};
+        return 0;
+    }
+
+    // Pick a point on the light for the shadow ray
+    uint32_t u[2];
+    sample_2d(key, b, RAND_DIM_LIGHT, u);
+    int32_t rand1 = (int32_t)(u[0] >> (32 - FRAC_BITS)); // 0…ONE
+    int32_t rand2 = (int32_t)(u[1] >> (32 - FRAC_BITS));
+    Vec3 light_point = {FP_NARROW(F(-1.0) + mul(F(2.0), rand1)), F(2.99), FP_NARROW(F(-3.2) + mul(F(0.4), rand2))};
+    Vec3 light_vec = vec_sub(light_point, hit_point);
+
+    bs->hit_point = hit_point;
+    bs->hit_normal = hit_normal;
+    bs->surface_mat = surface_mat;
+    bs->dist_sq = vec_len_sq(light_vec);
+    int32_t inv_dist = inv_sqrt_fp(bs->dist_sq);
+    bs->light_dir = vec_scale(light_vec, inv_dist);     // vec_norm(light_vec)
+    bs->light_dist = mul(bs->dist_sq, inv_dist);
+    bs->shadow_ray = (Ray){vec_add(hit_point, vec_scale(hit_normal, F(0.01))), bs->light_dir};
+    return 1;
+}
+
+int path_bounce(PathState *ps, const BounceState *bs, int occluded, int b, PathKey key) {
+    Vec3 hit_normal = bs->hit_normal;
+    Vec3 light_dir = bs->light_dir;
+
+    STAT_INC(shadow_rays);
+    if (occluded) STAT_INC(shadow_occluded);
+    if (!occluded) {
+        // if it is NOT in a shadow, calculate the direct light contribution
+        int32_t cos_theta = vec_dot(hit_normal, light_dir);
+        Vec3 light_normal = {0, -ONE, 0}; // Light surface normal points down into the box
+        int32_t cos_alpha = vec_dot(light_normal, vec_scale(light_dir, -ONE));
+
+        if (cos_theta > 0 && cos_alpha > 0) { // if the light and surface are facing each other
+            Material light_mat = g_planes[g_light_plane].material;
+            int32_t light_area = F(2.0 * 0.4);
+            int32_t geom_term_num = mul(cos_theta, cos_alpha);
+            int32_t geom_term = div_fp(geom_term_num, bs->dist_sq);
+
+            Vec3 direct_light = vec_mul(ps->attenuation, bs->surface_mat.color);
+            direct_light = vec_mul(direct_light, light_mat.color);
+            direct_light = vec_scale(direct_light, geom_term);
+            direct_light = vec_scale(direct_light, light_area);
+            // Divide by PI for diffuse BRDF
+            direct_light = vec_scale(direct_light, F(0.3183)); 
+            ps->color = vec_add(ps->color, direct_light);
+        }
+    }
+
+    // Attenuate path for next bounce (indirect light)
+    ps->attenuation = vec_mul(ps->attenuation, bs->surface_mat.color);
+
+    // Throughput-based termination (see RR_START_BOUNCE)
+    Vec3 att = ps->attenuation;
+    int32_t q = att.x > att.y ? att.x : att.y;
+    if (att.z > q) q = att.z;
+    if (q <= 0) {
+        STAT_INC(roulette_ended);
+        return 0;
+    }
+    if (b + 1 >= RR_START_BOUNCE && b + 1 < MAX_BOUNCES && q < ONE) {
+        if (q < RR_MIN_SURVIVAL) q = RR_MIN_SURVIVAL;
+        uint32_t u = sample_1d(key, b, RAND_DIM_RR);
+        if ((int32_t)(u >> (32 - FRAC_BITS)) >= q) {
+            STAT_INC(roulette_ended);
+            return 0;
+        }
+        ps->attenuation = vec_scale(att, div_fp(ONE, q));
+    }
+
+    // New random direction for bounced ray
+    ps->ray.orig = vec_add(bs->hit_point, vec_scale(hit_normal, F(0.01)));
+    ps->ray.dir = cosine_direction(key, b, hit_normal);
+    return 1;
+}
+
+Color resolve_color(int32_t acc_r, int32_t acc_g, int32_t acc_b, int n) {
+    return (Color){fp_to_u8(FP_NARROW(acc_r / n)), fp_to_u8(FP_NARROW(acc_g / n)), fp_to_u8(FP_NARROW(acc_b / n))};
+}
+
+// One path from the camera ray cam; returns its colour.
+static Vec3 trace_sample(Ray cam, int16_t x, int16_t y, int sample) {
+    PathKey key = rand_path_key(x, y, sample);
+    PathState ps = {cam, {F(0), F(0), F(0)}, {ONE, ONE, ONE}};
+
+    for (int b = 0; b < MAX_BOUNCES; ++b) {
+        #pragma HLS pipeline off
+        BounceState bs;
+        Intersection inter = intersect_scene(ps.ray);
+        if (!path_hit(&ps, inter, b, key, &bs))
+            break;
+        int blocked = occluded(bs.shadow_ray, bs.light_dist);
+        if (!path_bounce(&ps, &bs, blocked, b, key))
+            break;
+    }
+    return ps.color;
+}
+
+// Every sample of a pixel from its camera ray, which they all share
+static Color trace_pixel(Ray cam, int16_t x, int16_t y) {
+    int32_t acc_r = 0, acc_g = 0, acc_b = 0;
+
+    for (int sample = 0; sample < NUM_SAMPLES; sample++) {
+        Vec3 c = trace_sample(cam, x, y, sample);
+        acc_r += c.x;
+        acc_g += c.y;
+        acc_b += c.z;
+    }
+
+    return resolve_color(acc_r, acc_g, acc_b, NUM_SAMPLES);
+}
+
 Color trace_path(int16_t x, int16_t y) {
     //#pragma HLS ALLOCATION function instances=mul limit=32
     //#pragma HLS ALLOCATION function instances=div_fp limit=8
     //#pragma HLS ALLOCATION function instances=intersect_plane limit=1
     //#pragma HLS ALLOCATION function instances=intersect_sphere limit=1
-    #pragma HLS bind_storage variable=g_unit_vector_lut type=rom_1p
+    #pragma HLS bind_storage variable=g_cos_lut type=rom_1p
 
-    Ray cam = {{F(0), F(0.8), F(2)}, {F(0), F(0), F(-1)}};
-    float fov_rad = FOV * M_PI / 180.0;
-    float fov_scale = tan(fov_rad / 2.0);
-    //float aspect_ratio = (float)WIDTH / HEIGHT;
+    return trace_pixel(camera_ray(x, y), x, y);
+}
 
-    float sx_ndc = (2.0f * (x) / WIDTH) - 1.0f;
-    float sy_ndc = 1.0f - (2.0f * (y) / HEIGHT);
+Color trace_path_sized(int16_t x, int16_t y, int16_t width, int16_t height) {
+    #pragma HLS bind_storage variable=g_cos_lut type=rom_1p
 
-    Ray r;
+    return trace_pixel(camera_ray_steps(x, y, CAM_STEP(height), CAM_SCALE_X(width, height)), x, y);
+}
 
-    int32_t acc_r = 0, acc_g = 0, acc_b = 0;
+void trace_path_sum(int16_t x, int16_t y, int first, int count, int32_t sum[3]) {
+    #pragma HLS bind_storage variable=g_cos_lut type=rom_1p
 
-    for (int sample = 0; sample < NUM_SAMPLES; sample++) {r = cam;
-        r = cam;
-        r.dir.x = F(sx_ndc * fov_scale);
-        r.dir.y = F(sy_ndc * fov_scale);
-        r.dir = vec_norm(r.dir);
-        Vec3 path_color = {F(0), F(0), F(0)};
-        Vec3 path_attenuation = {ONE, ONE, ONE};
-
-        for (int b = 0; b < MAX_BOUNCES; ++b) {
-            #pragma HLS pipeline off
-            Intersection inter = intersect_scene(r);
-
-            if (!inter.hit) {
-                path_attenuation = (Vec3){F(0), F(0), F(0)};
-                break;
-            }
+    Ray cam = camera_ray(x, y);
+    sum[0] = sum[1] = sum[2] = 0;
 
-            int32_t t = inter.t;
-            int hit_object_type = inter.hit_type;
-            int hit_object_index = inter.hit_index;
+    for (int sample = first; sample < first + count; sample++) {
+        Vec3 c = trace_sample(cam, x, y, sample);
+        sum[0] += c.x;
+        sum[1] += c.y;
+        sum[2] += c.z;
+    }
+}
 
-            Vec3 hit_point = vec_add(r.orig, vec_scale(r.dir, t));
-            Vec3 hit_normal;
-            Material mat;
+// Sample value as seen after fp_to_u8: anything past white is white, so
+// fireflies on already-saturated pixels do not keep the pixel sampling.
+static int32_t display_clamp(fp_t v) {
+    const int32_t white = ONE >> BRIGHTNESS_SHIFT;
+    return v < 0 ? 0 : (v > white ? white : v);
+}
 
-            if (hit_object_type == 0) { // Sphere
-                mat = g_spheres[hit_object_index].material;
-                hit_normal = vec_norm(vec_sub(hit_point, g_spheres[hit_object_index].center));
-            } else { // Plane
-                mat = g_planes[hit_object_index].material;
-                hit_normal = g_planes[hit_object_index].normal;
-            }
+// 16 t^2 for the two-sided 95% Student-t quantile at 1..T_SQ_ENTRIES degrees
+// of freedom, rounded up; past the end the last entry is kept, a little above
+// the true value.
+#define T_SQ_ENTRIES 15
+static const int16_t g_t_sq_x16[T_SQ_ENTRIES] = {
+    2584, 297, 163, 124, 106, 96, 90, 86, 82, 80, 78, 76, 75, 74, 73
+};
 
-            Material surface_mat = mat;
-            if (mat.is_light) { // If we hit the ceiling plane
-                if (is_on_light(hit_point)) {
-                    // Only add emission for camera rays to avoid float counting with NEE
-                    if (b == 0) {
-                        path_color = vec_add(path_color, mat.color);
-                    }
-                    path_attenuation = (Vec3){F(0), F(0), F(0)};
-                } else {
-                    // Hit ceiling, but outside the light. Treat as grey.
-                    surface_mat.color = (Vec3){F(0.2), F(0.2), F(0.2)};
-                }
-            }
+Color trace_path_adaptive(int16_t x, int16_t y, int *num_samples) {
+    #pragma HLS bind_storage variable=g_cos_lut type=rom_1p
 
-            // Check if it is in a shadow
-            int32_t rand1 = rand_fp(); // 0…ONE
-            int32_t rand2 = rand_fp();
-            Vec3 light_point = {F(-1.0) + mul(F(2.0), rand1), F(2.99), F(-3.2) + mul(F(0.4), rand2)};
-            Vec3 light_vec = vec_sub(light_point, hit_point);
-            int32_t dist_sq = vec_len_sq(light_vec);
-            Vec3 light_dir = vec_norm(light_vec);
-
-            Ray shadow_ray = {vec_add(hit_point, vec_scale(hit_normal, F(0.01))), light_dir};
-            int occluded = 0;
-            for (size_t i = 0; i < NUM_SPHERES; ++i) {
-                #pragma HLS pipeline off
-                int32_t shadow_t = intersect_sphere(shadow_ray, g_spheres[i]);
-                if (shadow_t < FP_INF && mul(shadow_t, shadow_t) < dist_sq) { occluded = 1; }
-            }
-            LOOP_J:
-            for (size_t j = 0; j < NUM_PLANES; ++j) {
-                #pragma HLS pipeline off
-                if (g_planes[j].material.is_light) continue; // Don't treat the emissive plane as occluder
-                int32_t shadow_t = intersect_plane(shadow_ray, g_planes[j]);
-                if (shadow_t < FP_INF && mul(shadow_t, shadow_t) < dist_sq) { occluded = 1; }
-            }
+    Ray cam = camera_ray(x, y);
 
-            if (!occluded) {
-                // if it is NOT in a shadow, calculate the direct light contribution
-                int32_t cos_theta = vec_dot(hit_normal, light_dir);
-                Vec3 light_normal = {0, -ONE, 0}; // Light surface normal points down into the box
-                int32_t cos_alpha = vec_dot(light_normal, vec_scale(light_dir, -ONE));
-
-                if (cos_theta > 0 && cos_alpha > 0) { // if the light and surface are facing each other
-                    Material light_mat = g_planes[1].material;
-                    int32_t light_area = F(2.0 * 0.4);
-                    int32_t geom_term_num = mul(cos_theta, cos_alpha);
-                    int32_t geom_term = div_fp(geom_term_num, dist_sq);
-
-                    Vec3 direct_light = vec_mul(path_attenuation, surface_mat.color);
-                    direct_light = vec_mul(direct_light, light_mat.color);
-                    direct_light = vec_scale(direct_light, geom_term);
-                    direct_light = vec_scale(direct_light, light_area);
-                    // Divide by PI for diffuse BRDF
-                    direct_light = vec_scale(direct_light, F(0.3183)); 
-                    path_color = vec_add(path_color, direct_light);
-                }
-            }
+    int32_t acc_r = 0, acc_g = 0, acc_b = 0;
+    // Running sums over batches of the batch sums of display-clamped samples
+    int64_t sum[3] = {0, 0, 0}, sum_sq[3] = {0, 0, 0};
+    int n = 0, batches = 0;
+
+    LOOP_ADAPTIVE:
+    while (n < ADAPTIVE_MAX_SAMPLES) {
+        int32_t batch[3] = {0, 0, 0};
+        for (int i = 0; i < ADAPTIVE_BATCH; ++i, ++n) {
+            Vec3 c = trace_sample(cam, x, y, n);
+            acc_r += c.x;
+            acc_g += c.y;
+            acc_b += c.z;
+            batch[0] += display_clamp(c.x);
+            batch[1] += display_clamp(c.y);
+            batch[2] += display_clamp(c.z);
+        }
+        for (int k = 0; k < 3; ++k) {
+            sum[k] += batch[k];
+            sum_sq[k] += (int64_t)batch[k] * batch[k];
+        }
+        ++batches;
+        if (n < ADAPTIVE_MIN_SAMPLES || batches < 2)
+            continue;
+
+        // Each batch is an aligned, stratified block of the Sobol sequence,
+        // so the error of the pixel mean follows the spread of the batch
+        // means; the spread of single samples overstates it.
+        // Stop once t * sqrt(s^2 / J) < tolerance on every channel, over J
+        // batches of B samples, with s^2 = (J*sum_sq - sum^2) / (J (J-1) B^2)
+        // the variance of the batch means and t the 95% Student-t quantile
+        // for J-1 degrees of freedom. Squared and multiplied out by
+        // 16 J^2 (J-1) B^2 to stay in integers.
+        int j = batches;
+        int64_t t_sq = g_t_sq_x16[(j - 1 < T_SQ_ENTRIES ? j - 1 : T_SQ_ENTRIES) - 1];
+        int converged = 1;
+        for (int k = 0; k < 3; ++k) {
+            int64_t spread = (int64_t)j * sum_sq[k] - sum[k] * sum[k];
+            int64_t limit = 16LL * ADAPTIVE_TOLERANCE * ADAPTIVE_TOLERANCE * ADAPTIVE_BATCH * ADAPTIVE_BATCH
+                          * j * j * (j - 1);
+            if (t_sq * spread >= limit)
+                converged = 0;
+        }
+        if (converged)
+            break;
+    }
 
-            // Attenuate path for next bounce (indirect light)
-            path_attenuation = vec_mul(path_attenuation, surface_mat.color);
-            
-            // New random direction for bounced ray
-            Vec3 random_dir = random_unit_vector();
-            Vec3 bounce_dir = vec_add(hit_normal, random_dir);
+    *num_samples = n;
+    return resolve_color(acc_r, acc_g, acc_b, n);
+}
+
+// Streaming kernel
+// One dataflow region of FIFO-connected processes: a camera stage, one stage
+// per bounce and a resolve stage. Each call's pixels become STREAM_PATHS path
+// slots that flow through the stages in order, one slot at a time, so every
+// stage works on its own path while the others work on theirs. A path that
+// ended rides along dead, so every stage sees the same count * NUM_SAMPLES
+// slots and reads and writes them strictly in order. Within a stage one path
+// is traced at a time (pipeline off, as in trace_sample); the overlap is
+// between the stages.
+
+#define STREAM_PATHS (STREAM_MAX_PIXELS * NUM_SAMPLES)
 
-            r.orig = vec_add(hit_point, vec_scale(hit_normal, F(0.01)));
-            r.dir = vec_norm(bounce_dir);
+typedef struct {
+    PathState ps;
+    PathKey key;
+    uint8_t alive;
+} PathSlot;
+
+// Reads each pixel's coordinates and starts every sample at its camera ray
+static void stream_camera(const uint32_t coords[STREAM_MAX_PIXELS], int count, int16_t width, int16_t height,
+                          PathSlot out[STREAM_PATHS]) {
+    int32_t step = CAM_STEP(height), scale_x = CAM_SCALE_X(width, height);
+    LOOP_STREAM_CAMERA:
+    for (int p = 0; p < count; ++p) {
+        #pragma HLS loop_tripcount max=STREAM_MAX_PIXELS
+        uint32_t c = coords[p];
+        int16_t x = (int16_t)(c & 0xFFFF), y = (int16_t)(c >> 16);
+        Ray cam = camera_ray_steps(x, y, step, scale_x);
+        for (int sample = 0; sample < NUM_SAMPLES; ++sample) {
+            #pragma HLS pipeline II=1
+            PathSlot slot = {{cam, {F(0), F(0), F(0)}, {ONE, ONE, ONE}}, rand_path_key(x, y, sample), 1};
+            out[p * NUM_SAMPLES + sample] = slot;
         }
-        acc_r += path_color.x;
-        acc_g += path_color.y;
-        acc_b += path_color.z;
     }
+}
 
-    return (Color){fp_to_u8((fp_t)(acc_r / NUM_SAMPLES)), fp_to_u8((fp_t)(acc_g / NUM_SAMPLES)), fp_to_u8((fp_t)(acc_b / NUM_SAMPLES))};
+// Bounce b of every live slot, as in trace_sample
+static void stream_bounce(int b, int count, const PathSlot in[STREAM_PATHS], PathSlot out[STREAM_PATHS]) {
+    LOOP_STREAM_BOUNCE:
+    for (int i = 0; i < count * NUM_SAMPLES; ++i) {
+        #pragma HLS loop_tripcount max=STREAM_PATHS
+        #pragma HLS pipeline off
+        PathSlot slot = in[i];
+        if (slot.alive) {
+            BounceState bs;
+            Intersection inter = intersect_scene(slot.ps.ray);
+            if (!path_hit(&slot.ps, inter, b, slot.key, &bs)) {
+                slot.alive = 0;
+            } else {
+                int blocked = occluded(bs.shadow_ray, bs.light_dist);
+                if (!path_bounce(&slot.ps, &bs, blocked, b, slot.key))
+                    slot.alive = 0;
+            }
+        }
+        out[i] = slot;
+    }
+}
+
+// Sums each pixel's samples in sample order, like trace_path, and writes
+// its colour
+static void stream_resolve(const PathSlot in[STREAM_PATHS], int count, uint32_t colors[STREAM_MAX_PIXELS]) {
+    LOOP_STREAM_RESOLVE:
+    for (int p = 0; p < count; ++p) {
+        #pragma HLS loop_tripcount max=STREAM_MAX_PIXELS
+        int32_t acc_r = 0, acc_g = 0, acc_b = 0;
+        for (int sample = 0; sample < NUM_SAMPLES; ++sample) {
+            #pragma HLS pipeline II=1
+            Vec3 c = in[p * NUM_SAMPLES + sample].ps.color;
+            acc_r += c.x;
+            acc_g += c.y;
+            acc_b += c.z;
+        }
+        Color rgb = resolve_color(acc_r, acc_g, acc_b, NUM_SAMPLES);
+        colors[p] = STREAM_COLOR(rgb);
+    }
+}
+
+void trace_path_stream(const uint32_t coords[STREAM_MAX_PIXELS], uint32_t colors[STREAM_MAX_PIXELS], int count,
+                       int16_t width, int16_t height) {
+    #pragma HLS INTERFACE mode=axis port=coords
+    #pragma HLS INTERFACE mode=axis port=colors
+    #pragma HLS INTERFACE mode=s_axilite port=count
+    #pragma HLS INTERFACE mode=s_axilite port=width
+    #pragma HLS INTERFACE mode=s_axilite port=height
+    #pragma HLS INTERFACE mode=ap_ctrl_chain port=return
+    #pragma HLS bind_storage variable=g_cos_lut type=rom_1p
+    #pragma HLS dataflow
+
+    // paths[b] carries the slots into bounce stage b; paths[MAX_BOUNCES]
+    // into the resolve stage. In synthesis these are FIFOs of
+    // STREAM_FIFO_DEPTH; in C simulation they are whole arrays, about 0.6 MB
+    // at the default sizes, so they are kept off the stack there (which also
+    // makes the host version non-reentrant).
+#ifndef __SYNTHESIS__
+    static
+#endif
+    PathSlot paths[MAX_BOUNCES + 1][STREAM_PATHS];
+    #pragma HLS array_partition variable=paths dim=1 type=complete
+    #pragma HLS stream variable=paths depth=STREAM_FIFO_DEPTH
+
+    stream_camera(coords, count, width, height, paths[0]);
+    LOOP_STREAM_STAGES:
+    for (int b = 0; b < MAX_BOUNCES; ++b) {
+        #pragma HLS unroll
+        stream_bounce(b, count, paths[b], paths[b + 1]);
+    }
+    stream_resolve(paths[MAX_BOUNCES], count, colors);
+}
+
+PixelFeatures trace_path_features(int16_t x, int16_t y) {
+    Ray cam = camera_ray(x, y);
+    Intersection inter = intersect_scene(cam);
+    PixelFeatures f = {{0, 0, 0}, {0, 0, 0}, FP_INF};
+    if (inter.hit) {
+        Vec3 hit_point;
+        f.albedo = hit_surface(cam, inter, &hit_point, &f.normal).color;
+        f.depth = inter.t;
+    }
+    return f;
 }
 
 // Check if a point is on the rectangular light source on the ceiling
 int is_on_light(Vec3 p) {
-    return (p.x >= F(-1.0) && p.x <= F(1.0) && p.z >= F(-3.2) && p.z <= F(-2.8));
+    return (p.x >= LIGHT_X_MIN && p.x <= LIGHT_X_MAX && p.z >= LIGHT_Z_MIN && p.z <= LIGHT_Z_MAX);
 }
@@ -0,0 +1,375 @@
+#ifndef TRACE_PATH_H
+#define TRACE_PATH_H
+
+#include <stdint.h>
+
+// Path tracing settings
+#ifndef MAX_BOUNCES
+#define MAX_BOUNCES 3
+#endif
+// Russian roulette: from this bounce on, a path continues with probability
+// equal to its largest throughput component (at least RR_MIN_SURVIVAL) and
+// the survivors' throughput is divided by that probability, which keeps the
+// estimate unbiased. Deep MAX_BOUNCES then cost little more than shallow ones.
+// Set RR_START_BOUNCE >= MAX_BOUNCES to turn it off, as the default does for
+// three bounces: there it saves little and adds more noise than the sampler
+// leaves.
+#ifndef RR_START_BOUNCE
+#define RR_START_BOUNCE 3
+#endif
+#define RR_MIN_SURVIVAL F(0.25)   // caps the 1/p boost at 4, inside the fp_t range
+#define FOV 60.0
+#define FOV_SCALE 0.57735026918962576   // tan(FOV / 2); keep in step with FOV
+#define LIGHT_INTENSITY 2.0
+#define BRIGHTNESS_SHIFT 4
+#ifndef NUM_SAMPLES
+#define NUM_SAMPLES 16
+#endif
+
+// Adaptive sampling (trace_path_adaptive). Samples are taken in batches of
+// ADAPTIVE_BATCH, each an aligned block of the Sobol sequence, until the 95%
+// confidence interval of the pixel mean, measured from the spread between the
+// batch means, is narrower than ADAPTIVE_TOLERANCE, or ADAPTIVE_MAX_SAMPLES is
+// reached. The tolerance is in 4.12 ulps of the path colour; one ulp is about
+// one display level at the default BRIGHTNESS_SHIFT.
+// The maximum defaults to NUM_SAMPLES: on the Cornell box the noise is spread
+// evenly enough that sending more samples to the noisy pixels buys no more
+// than giving them to all of them, so the gain is in the pixels that converge.
+// A looser tolerance stops noisy pixels early too, but those are mostly the
+// ones whose first samples came out dark, and the frame darkens with them.
+#ifndef ADAPTIVE_MIN_SAMPLES
+#define ADAPTIVE_MIN_SAMPLES 8
+#endif
+#ifndef ADAPTIVE_MAX_SAMPLES
+#define ADAPTIVE_MAX_SAMPLES NUM_SAMPLES
+#endif
+#ifndef ADAPTIVE_BATCH
+#define ADAPTIVE_BATCH 4
+#endif
+#ifndef ADAPTIVE_TOLERANCE
+#define ADAPTIVE_TOLERANCE 4
+#endif
+
+// Scene capacity. The scene lives in fixed-size arrays (BRAM on the FPGA);
+// the host testbench can load a different scene into them at runtime.
+// hls_config.cfg lowers them for synthesis: at the host defaults g_spheres and
+// g_bvh take about 208 KB, nearly all of the XC7A35T's 225 KB of BRAM, while
+// MAX_SPHERES=256 takes about 13 KB per copy of the IP.
+#ifndef MAX_SPHERES
+#define MAX_SPHERES 4096
+#endif
+#ifndef MAX_PLANES
+#define MAX_PLANES 16
+#endif
+#define MAX_BVH_NODES (2 * MAX_SPHERES)
+#define BVH_STACK_SIZE 32    // enough for a median-split tree over MAX_SPHERES
+
+// Frame size. Host builds render at WIDTH x HEIGHT unless set_resolution()
+// picks another size up to MAX_RESOLUTION on a side, and size their buffers
+// from g_width / g_height. The FPGA kernels (trace_path_sized,
+// trace_path_stream) take the size as arguments instead, within the same
+// limits.
+#ifndef WIDTH
+#define WIDTH 256
+#endif
+#ifndef HEIGHT
+#define HEIGHT 256
+#endif
+#define MAX_RESOLUTION 4096
+
+// Fixed-point math settings — 16-bit total (4 integer + 12 fractional) by
+// default. Other formats can be tried with -DFP_BITS=<total> -DFRAC_BITS=<frac>
+// and compared against the float reference with precision.c. fp_t is the
+// narrowest of int16_t / int32_t that holds FP_BITS; every narrowing to fp_t
+// goes through FP_NARROW, which wraps to FP_BITS like a hardware register of
+// that width, or clamps with -DFP_SATURATE (to see whether wrap-around costs
+// image quality).
+#ifndef FP_BITS
+#define FP_BITS 16
+#endif
+#ifndef FRAC_BITS
+#define FRAC_BITS 12
+#endif
+#if FRAC_BITS < 8 || FRAC_BITS > 20 || FP_BITS > 32 || FP_BITS < FRAC_BITS + 3
+#error "unsupported fixed-point format: need 8 <= FRAC_BITS <= 20 and FRAC_BITS + 3 <= FP_BITS <= 32"
+#endif
+#if FP_BITS <= 16
+typedef int16_t fp_t;
+#define FP_STORAGE_BITS 16
+#else
+typedef int32_t fp_t;
+#define FP_STORAGE_BITS 32
+#endif
+#define ONE (1 << FRAC_BITS)
+#define FP_MAX ((int32_t)(((int64_t)1 << (FP_BITS - 1)) - 1))
+#define FP_MIN (-FP_MAX - 1)
+// FP_NARROW_CONST is the same conversion as a constant expression, for F().
+#if defined(FP_SATURATE)
+#define FP_NARROW_CONST(v) ((fp_t)((v) > FP_MAX ? FP_MAX : ((v) < FP_MIN ? FP_MIN : (v))))
+#elif FP_BITS == FP_STORAGE_BITS
+#define FP_NARROW_CONST(v) ((fp_t)(v))
+#else
+#define FP_NARROW_CONST(v) ((fp_t)((int32_t)((uint32_t)(v) << (32 - FP_BITS)) >> (32 - FP_BITS)))
+#endif
+#ifdef TRACE_STATS
+#define FP_NARROW(v) fp_narrow_counted(v)      // counts overflows, see TraceStats
+#else
+#define FP_NARROW(v) FP_NARROW_CONST(v)
+#endif
+// Convert a floating-point value to fixed-point (rounded)
+#define F(x) FP_NARROW_CONST((int32_t)((x) * ONE + ((x) >= 0 ? 0.5f : -0.5f)))
+#define I(x) ((x) >> FRAC_BITS)
+
+// Handy constants
+#define FP_EPS ((fp_t)1)             // one ulp, ≈ 0.00024 in real units at 4.12
+#define FP_INF 0x7FFFFFFF            // Large “infinite” distance sentinel
+
+// Rectangular area light on the ceiling (see is_on_light)
+#define LIGHT_X_MIN F(-1.0)
+#define LIGHT_X_MAX F(1.0)
+#define LIGHT_Z_MIN F(-3.2)
+#define LIGHT_Z_MAX F(-2.8)
+
+// Simple vector struct
+typedef struct {
+    fp_t x, y, z;
+} Vec3;
+
+typedef struct {
+    uint8_t r, g, b;
+} Color;
+
+// Ray
+typedef struct {
+    Vec3 orig, dir;
+} Ray;
+
+// Material
+typedef struct {
+    Vec3 color;
+    int is_light;
+} Material;
+
+// Sphere
+typedef struct {
+    Vec3 center;
+    fp_t radius;
+    Material material;
+} Sphere;
+
+// Plane
+typedef struct {
+    Vec3 normal;
+    fp_t dist;
+    Material material;
+} Plane;
+
+// Structure to hold intersection results
+typedef struct {
+    int32_t t;            // keep 32-bit for extra head-room during comparisons
+    int hit_type; // 0 for sphere, 1 for plane
+    int hit_index;
+    int hit;      // 1 if an object was hit, 0 otherwise
+} Intersection;
+
+// Flattened BVH node over the spheres. Children and leaf ranges are array
+// indices, so the whole tree is one flat table.
+typedef struct {
+    Vec3 min, max;        // bounds, 4.12
+    uint16_t first;       // leaf: first sphere; inner: left child (right is first + 1)
+    uint16_t count;       // spheres in the leaf, 0 for an inner node
+} BvhNode;
+
+// Ray-box slab test needs 1/dir; computed once per ray
+typedef struct {
+    int32_t x, y, z;      // div_fp(ONE, dir), 0 where dir is 0
+} RayInv;
+
+// Identifies one sample of one pixel for the random draws (rand_path_key)
+typedef struct {
+    uint32_t seed;        // hash of the pixel
+    uint32_t index;       // sample number within the pixel
+} PathKey;
+
+// State of one sample's path, carried from bounce to bounce
+typedef struct {
+    Ray ray;
+    Vec3 color;
+    Vec3 attenuation;
+} PathState;
+
+// Everything a bounce needs once its shadow ray has been tested
+typedef struct {
+    Vec3 hit_point;
+    Vec3 hit_normal;
+    Material surface_mat;
+    Vec3 light_dir;
+    int32_t dist_sq;      // squared distance to the light sample
+    int32_t light_dist;   // distance to the light sample, the shadow ray's max_t
+    Ray shadow_ray;
+} BounceState;
+
+// Hot-path counters for the instrumented host build (-DTRACE_STATS, see
+// stats.h). Each thread has its own copy, so the kernels count without locks;
+// in normal and HLS builds STAT_INC compiles to nothing.
+typedef struct {
+    uint64_t camera_rays;               // intersect_scene calls at bounce 0
+    uint64_t bounce_rays;               // ... at later bounces
+    uint64_t escaped[MAX_BOUNCES];      // paths ended at bounce b on !inter.hit
+    uint64_t light_hits;                // paths ended on the area light
+    uint64_t roulette_ended;            // paths ended by Russian roulette or zero throughput
+    uint64_t shadow_rays;
+    uint64_t shadow_occluded;
+    uint64_t sphere_tests;              // intersect_sphere / sphere_blocks calls (or compiled equivalents)
+    uint64_t plane_tests;
+    uint64_t box_tests;                 // BVH node slab tests
+    uint64_t fp_overflow;               // FP_NARROW inputs outside [FP_MIN, FP_MAX]
+    uint64_t u8_saturated;              // fp_to_u8 results clamped to 0 or 255
+} TraceStats;
+
+#ifdef TRACE_STATS
+extern __thread TraceStats g_trace_stats;
+#define STAT_INC(field) (++g_trace_stats.field)
+
+static inline fp_t fp_narrow_counted(int64_t v) {
+    if (v < FP_MIN || v > FP_MAX) STAT_INC(fp_overflow);
+    return FP_NARROW_CONST(v);
+}
+#else
+#define STAT_INC(field) ((void)0)
+#endif
+
+// Active scene. Defaults to the Cornell box; see scene.h for loading others.
+extern Sphere g_spheres[MAX_SPHERES];
+extern Plane g_planes[MAX_PLANES];
+extern BvhNode g_bvh[MAX_BVH_NODES];
+extern int g_num_spheres;
+extern int g_num_planes;
+extern int g_light_plane;     // emissive plane sampled for direct light
+
+// Active frame size, WIDTH x HEIGHT unless set_resolution() changed it
+extern int g_width;
+extern int g_height;
+// Sets the frame size and the camera steps for it. Returns -1 if either side
+// is outside [1, MAX_RESOLUTION] or one is more than 4 times the other.
+// Host only: call it before tracing.
+int set_resolution(int width, int height);
+
+int is_on_light(Vec3 p);
+int32_t intersect_sphere(Ray r, Sphere s);
+int32_t intersect_plane(Ray r, Plane p);
+RayInv ray_inv(Vec3 dir);
+// Entry distance of the ray into the box (clamped to 0), FP_INF on a miss.
+int32_t intersect_box(Ray r, RayInv inv, const BvhNode *n);
+Intersection intersect_scene(Ray r);
+// Any-hit tests: does the ray cross the primitive at 0 < t < max_t? Cheaper
+// than the nearest-hit tests above (no square root or divide).
+int sphere_blocks(Ray r, Sphere s, int32_t max_t);
+int plane_blocks(Ray r, Plane p, int32_t max_t);
+// Occlusion query: 1 if any non-emissive primitive crosses the ray at
+// 0 < t < max_t. Stops at the first blocker found.
+int occluded(Ray ray, int32_t max_t);
+
+// Fixed-point multiplication (4.12 × 4.12 → 4.12, 64-bit intermediate).
+// In the header so every user inlines it.
+static inline int32_t mul(int32_t a, int32_t b) {
+    return (int32_t)(((int64_t)a * (int64_t)b) >> FRAC_BITS);
+}
+// Fixed-point division; 0 when b is 0.
+int32_t div_fp(int32_t a, int32_t b);
+// Integer-only 1/sqrt(x) and sqrt(x) for 4.12 inputs; 0 for x <= 0.
+int32_t inv_sqrt_fp(int32_t x);
+int32_t sqrt_fp(int32_t n);
+int32_t vec_dot(Vec3 a, Vec3 b);
+Vec3 vec_norm(Vec3 v);
+// Seeds of inv_sqrt_fp(), exported so packet.c can repeat it lane by lane
+#define INV_SQRT_LUT_SIZE 96
+extern const uint16_t g_inv_sqrt_lut[INV_SQRT_LUT_SIZE];
+
+// Random draws, one point per (path key, bounce, dimension).
+#define RAND_DIM_LIGHT   0   // light sample position along x and z
+#define RAND_DIM_BOUNCE  1   // diffuse bounce direction
+#define RAND_DIM_RR      2   // Russian roulette, 1D
+#define RAND_DIMS        3   // dimensions per bounce
+// Stratified point in [0, 1)^2 as two 0.32 fixed-point values: Owen-scrambled
+// Sobol over the pixel's samples, decorrelated across bounces and dimensions.
+void sample_2d(PathKey key, int bounce, int dim, uint32_t u[2]);
+// First coordinate of sample_2d() alone
+uint32_t sample_1d(PathKey key, int bounce, int dim);
+// Cosine-weighted diffuse bounce direction about the unit normal n (RAND_DIM_BOUNCE)
+Vec3 cosine_direction(PathKey key, int bounce, Vec3 n);
+// Sines and cosines for cosine_direction(): a quarter wave in Q15, read with
+// the top bits of the angle
+#define QUARTER_WAVE_BITS 8
+#define QUARTER_WAVE_SIZE (1 << QUARTER_WAVE_BITS)
+extern const uint16_t g_cos_lut[QUARTER_WAVE_SIZE + 1];
+
+// Path stages. trace_path runs them in order for every sample and bounce;
+// host tracers (packet.c) reuse them around their own intersection kernels.
+PathKey rand_path_key(int16_t x, int16_t y, int sample);
+Ray camera_ray(int16_t x, int16_t y);
+// Shades a hit and prepares its shadow ray, which the caller tests with
+// occluded(bs->shadow_ray, bs->light_dist). Returns 0 if the path ends here:
+// the ray escaped, or it hit the light (its emission is added at bounce 0).
+int path_hit(PathState *ps, Intersection inter, int b, PathKey key, BounceState *bs);
+// Adds direct light and sets up the next bounce ray. Returns 0 if the path
+// ends instead: its throughput is zero or Russian roulette stopped it.
+int path_bounce(PathState *ps, const BounceState *bs, int occluded, int b, PathKey key);
+// Averages n accumulated path colours into an output pixel.
+Color resolve_color(int32_t acc_r, int32_t acc_g, int32_t acc_b, int n);
+
+// Traces one pixel. Random draws are keyed on (x, y, sample, bounce), so pixels
+// can be traced in any order (or on any thread) and still give the same image.
+Color trace_path(int16_t x, int16_t y);
+// trace_path with the frame size as arguments rather than g_width / g_height,
+// the top function of the per-pixel IP (syn.top=trace_path_sized). Gives what
+// trace_path gives after set_resolution(width, height).
+Color trace_path_sized(int16_t x, int16_t y, int16_t width, int16_t height);
+
+// Raw sums of the path colours of samples [first, first + count) of a pixel,
+// before averaging and tone mapping. Sample indices key the random numbers, so
+// sums over consecutive ranges add up to the sum trace_path takes over
+// [0, NUM_SAMPLES). Used by the progressive renderer (progressive.h).
+void trace_path_sum(int16_t x, int16_t y, int first, int count, int32_t sum[3]);
+
+// Traces one pixel with adaptive sampling (see ADAPTIVE_*). The number of
+// samples taken is stored in *num_samples. Converged pixels (the light,
+// regions past white) stop at ADAPTIVE_MIN_SAMPLES; the rest go further.
+Color trace_path_adaptive(int16_t x, int16_t y, int *num_samples);
+
+// Streaming kernel for the FPGA (syn.top=trace_path_stream in hls_config.cfg),
+// in place of one ap_start / ap_done handshake per pixel. Reads count pixel
+// coordinates, at most STREAM_MAX_PIXELS, from the coords stream and writes
+// each pixel's colour to the colors stream, in the same order; width and
+// height are the frame's, as in trace_path_sized. Inside, one
+// dataflow stage per bounce passes path slots to the next through a FIFO of
+// STREAM_FIFO_DEPTH, so all the stages trace at once. A frame goes through
+// in calls of up to STREAM_MAX_PIXELS pixels; with ap_ctrl_chain the next
+// call starts while the last one drains.
+// Not integrated yet: Vivado/top.v still drives trace_path_sized, and this
+// kernel has only been checked in C simulation (./render -S). Its frame time
+// is modelled by stream_model.c, not measured.
+#ifndef STREAM_MAX_PIXELS
+#define STREAM_MAX_PIXELS 256   // a row of the default frame
+#endif
+#ifndef STREAM_FIFO_DEPTH
+#define STREAM_FIFO_DEPTH (2 * NUM_SAMPLES)    // path slots between neighbouring stages
+#endif
+// x in bits 15:0, y in 31:16
+#define STREAM_COORD(x, y) (((uint32_t)(uint16_t)(y) << 16) | (uint16_t)(x))
+// r in bits 7:0, g in 15:8, b in 23:16, the layout of trace_path's ap_return
+#define STREAM_COLOR(c) ((uint32_t)(c).r | ((uint32_t)(c).g << 8) | ((uint32_t)(c).b << 16))
+void trace_path_stream(const uint32_t coords[STREAM_MAX_PIXELS], uint32_t colors[STREAM_MAX_PIXELS], int count,
+                       int16_t width, int16_t height);
+
+// First-hit features of a pixel, the guides of the host denoiser (denoise.h).
+// All samples of a pixel share the camera ray, so one intersection gives them
+// exactly.
+typedef struct {
+    Vec3 normal;          // unit surface normal; 0 where the ray escapes
+    Vec3 albedo;          // surface colour, the emission on the light; 0 on escape
+    int32_t depth;        // distance along the camera ray, FP_INF on escape
+} PixelFeatures;
+PixelFeatures trace_path_features(int16_t x, int16_t y);
+
+#endif
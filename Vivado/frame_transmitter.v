@@ -0,0 +1,292 @@
+`timescale 1ns / 1ps
+//////////////////////////////////////////////////////////////////////////////////
+// Company: RaySkechers
+// Engineer:
+//
+// Module Name: frame_transmitter
+// Project Name: RaySkecherV1
+// Target Devices: Basys 3
+// Description:
+//   Sends the pixels of a frame, which arrive in scanline order, over the UART
+//   in framed packets (replaces color_transmitter's 3 raw bytes a pixel):
+//
+//     A5 5A  type  fields...  CRC-16 (hi, lo)
+//
+//     type 01 frame start  frame, width (2), height (2), encoding
+//     type 02 block        frame, encoding, x (2), y (2), w (2), h (2),
+//                          then the block's w*h pixels, row-major
+//     type 03 frame end    frame, blocks (2)
+//
+//   Multi-byte fields are big-endian. The CRC is CRC-16/CCITT-FALSE (poly
+//   1021, init FFFF) over everything after the sync word. Each row goes out
+//   as one block, so a corrupted byte costs the host one row, and the sync
+//   word lets it pick up again at the next.
+//
+//   encoding[1:0]  00 RGB888: r, g, b
+//                  01 RGB565: {r[7:3], g[7:2], b[7:3]}, high byte first
+//                  10 RGB332: {r[7:5], g[7:5], b[7:6]}, as the framebuffer
+//   encoding[7]    run-length coding within each block: a pixel equal to
+//                  the one before it is followed by a count byte, the number
+//                  of further copies (0-255), after which the next pixel
+//                  starts afresh
+//   The encoding and the frame's width and height are latched at
+//   frame_start; encoding 11 is sent as RGB888.
+//   uart_protocol.py in the repository root decodes the stream.
+//
+// Dependencies: transmitter
+//
+//////////////////////////////////////////////////////////////////////////////////
+
+
+module frame_transmitter #(
+    parameter CLK_FREQ  = 100_000_000,
+    parameter BAUD_RATE = 2_000_000
+)(
+    input         clk,
+    input         reset,
+    input         frame_start,  // a frame begins, latch the encoding and size
+    input  [7:0]  encoding,
+    input  [15:0] width,
+    input  [15:0] height,
+    input         start,        // one pixel, scanline order
+    input  [23:0] rgb,
+    output        busy,         // high until the pixel's bytes are handed to the UART
+    output        TxD
+);
+    localparam[7:0] SYNC0 = 8'hA5, SYNC1 = 8'h5A;
+    localparam[7:0] PKT_FRAME_START = 8'h01, PKT_BLOCK = 8'h02, PKT_FRAME_END = 8'h03;
+    localparam[1:0] ENC_RGB888 = 2'd0, ENC_RGB565 = 2'd1, ENC_RGB332 = 2'd2;
+
+    // What a pixel sends, in order; plan has a bit for each step still to go
+    localparam[2:0] ST_IDLE     = 3'd0,
+                    ST_FSTART   = 3'd1,     // frame start packet
+                    ST_BHDR     = 3'd2,     // block header
+                    ST_CNT_PRE  = 3'd3,     // count byte ending the run before this pixel
+                    ST_PIX      = 3'd4,     // the pixel
+                    ST_CNT_POST = 3'd5,     // count byte of a run the row ends in
+                    ST_BCRC     = 3'd6,     // block CRC
+                    ST_FEND     = 3'd7;     // frame end packet
+
+    wire tx_idle;
+    reg  tx_strobe;
+    reg  [7:0] tx_data;
+
+    transmitter #(
+        .CLK_FREQ (CLK_FREQ),
+        .BAUD_RATE(BAUD_RATE)
+    ) UART (
+        .clk      (clk),
+        .reset    (reset),
+        .transmit (tx_strobe),
+        .data     (tx_data),
+        .TxD      (TxD),
+        .idle     (tx_idle)
+    );
+
+    function [15:0] crc16_update(input [15:0] crc, input [7:0] data);
+        reg [15:0] c;
+        integer k;
+        begin
+            c = crc ^ {data, 8'h00};
+            for (k = 0; k < 8; k = k + 1)
+                c = c[15] ? (c << 1) ^ 16'h1021 : (c << 1);
+            crc16_update = c;
+        end
+    endfunction
+
+    function [2:0] first_step(input [7:0] steps);
+        integer k;
+        begin
+            first_step = ST_IDLE;
+            for (k = 7; k >= 1; k = k - 1)
+                if (steps[k]) first_step = k;
+        end
+    endfunction
+
+    reg [2:0]  step;
+    reg [3:0]  idx;             // byte within the step
+    reg [7:0]  plan;
+    reg [7:0]  enc;
+    reg [7:0]  frame;
+    reg [15:0] W, H;            // frame size
+    reg [15:0] x, y;            // the next pixel
+    reg [15:0] row;             // row of the open block
+    reg [23:0] pix;             // encoded pixel, low plen bytes used
+    reg [1:0]  plen;
+    reg [15:0] crc;
+
+    // Run-length state
+    reg        have_last, counting;
+    reg [23:0] last;
+    reg [7:0]  count, count_pre;
+
+    assign busy = start | (step != ST_IDLE);
+
+    // Encoded incoming pixel
+    reg [23:0] pv;
+    reg [1:0]  pv_len;
+    always @(*) begin
+        case (enc[1:0])
+            ENC_RGB565: begin pv = {8'h00, rgb[7:3], rgb[15:10], rgb[23:19]}; pv_len = 2'd2; end
+            ENC_RGB332: begin pv = {16'h0000, rgb[7:5], rgb[15:13], rgb[23:22]}; pv_len = 2'd1; end
+            default:    begin pv = {rgb[7:0], rgb[15:8], rgb[23:16]}; pv_len = 2'd3; end
+        endcase
+    end
+
+    wire same       = have_last & (pv == last);
+    wire absorb     = counting & same & (count != 8'd255);
+    wire run_start  = enc[7] & same & ~counting;
+    wire row_end    = (x == W - 1);
+    wire frame_end  = row_end & (y == H - 1);
+    wire[7:0] new_plan = {frame_end,                        // ST_FEND
+                          row_end,                          // ST_BCRC
+                          row_end & (absorb | run_start),   // ST_CNT_POST
+                          ~absorb,                          // ST_PIX
+                          counting & ~absorb,               // ST_CNT_PRE
+                          x == 0,                           // ST_BHDR
+                          (x == 0) & (y == 0),              // ST_FSTART
+                          1'b0};
+
+    // Byte of the current step, and whether it goes into the CRC
+    reg [7:0] out_byte;
+    reg       out_last, crc_init, crc_skip;
+    always @(*) begin
+        out_byte = 8'h00;
+        out_last = 1'b0;
+        crc_init = 1'b0;
+        crc_skip = 1'b0;
+        case (step)
+            ST_FSTART, ST_BHDR, ST_FEND: begin
+                crc_init = (idx == 4'd2);
+                crc_skip = (idx < 4'd2);
+                case (idx)
+                    4'd0: out_byte = SYNC0;
+                    4'd1: out_byte = SYNC1;
+                    4'd2: out_byte = step == ST_FSTART ? PKT_FRAME_START : step == ST_BHDR ? PKT_BLOCK : PKT_FRAME_END;
+                    4'd3: out_byte = frame;
+                    default: ;
+                endcase
+                if (step == ST_FSTART) begin
+                    case (idx)
+                        4'd4: out_byte = W[15:8];
+                        4'd5: out_byte = W[7:0];
+                        4'd6: out_byte = H[15:8];
+                        4'd7: out_byte = H[7:0];
+                        4'd8: out_byte = enc;
+                        4'd9: out_byte = crc[15:8];
+                        4'd10: out_byte = crc[7:0];
+                        default: ;
+                    endcase
+                    crc_skip = crc_skip | (idx >= 4'd9);
+                    out_last = (idx == 4'd10);
+                end else if (step == ST_BHDR) begin
+                    case (idx)
+                        4'd4: out_byte = enc;
+                        4'd5, 4'd6: out_byte = 8'h00;       // x
+                        4'd7: out_byte = row[15:8];
+                        4'd8: out_byte = row[7:0];
+                        4'd9: out_byte = W[15:8];
+                        4'd10: out_byte = W[7:0];
+                        4'd11: out_byte = 8'h00;            // h
+                        4'd12: out_byte = 8'h01;
+                        default: ;
+                    endcase
+                    out_last = (idx == 4'd12);
+                end else begin
+                    case (idx)
+                        4'd4: out_byte = H[15:8];           // one block a row
+                        4'd5: out_byte = H[7:0];
+                        4'd6: out_byte = crc[15:8];
+                        4'd7: out_byte = crc[7:0];
+                        default: ;
+                    endcase
+                    crc_skip = crc_skip | (idx >= 4'd6);
+                    out_last = (idx == 4'd7);
+                end
+            end
+            ST_CNT_PRE: begin
+                out_byte = count_pre;
+                out_last = 1'b1;
+            end
+            ST_PIX: begin
+                out_byte = pix[8 * (plen - 1 - idx) +: 8];
+                out_last = (idx == plen - 1);
+            end
+            ST_CNT_POST: begin
+                out_byte = count;
+                out_last = 1'b1;
+            end
+            ST_BCRC: begin
+                out_byte = idx == 4'd0 ? crc[15:8] : crc[7:0];
+                out_last = (idx == 4'd1);
+                crc_skip = 1'b1;
+            end
+            default: ;
+        endcase
+    end
+
+    wire send = (step != ST_IDLE) & tx_idle & ~tx_strobe;
+    wire[7:0] plan_left = plan & ~(8'd1 << step);
+
+    always @(posedge clk or posedge reset) begin
+        if (reset) begin
+            step      <= ST_IDLE;
+            idx       <= 0;
+            plan      <= 0;
+            enc       <= 0;
+            frame     <= 0;
+            x         <= 0;
+            y         <= 0;
+            have_last <= 1'b0;
+            counting  <= 1'b0;
+            tx_strobe <= 1'b0;
+            tx_data   <= 8'hFF;
+        end
+        else begin
+            tx_strobe <= 1'b0;
+
+            if (step == ST_IDLE) begin
+                if (frame_start) begin
+                    enc       <= {encoding[7], 5'b0, encoding[1:0] == 2'd3 ? ENC_RGB888 : encoding[1:0]};
+                    frame     <= frame + 1;
+                    W         <= width;
+                    H         <= height;
+                    x         <= 0;
+                    y         <= 0;
+                    have_last <= 1'b0;
+                    counting  <= 1'b0;
+                end else if (start) begin
+                    pix       <= pv;
+                    plen      <= pv_len;
+                    row       <= y;
+                    count_pre <= count;
+                    count     <= absorb ? count + 1 : 8'd0;
+                    counting  <= (absorb | run_start) & ~row_end;
+                    have_last <= ~row_end;
+                    last      <= pv;
+                    x         <= row_end ? 16'd0 : x + 1;
+                    if (row_end) y <= frame_end ? 16'd0 : y + 1;
+                    plan      <= new_plan;
+                    step      <= first_step(new_plan);
+                    idx       <= 0;
+                end
+            end
+            else if (send) begin
+                tx_strobe <= 1'b1;
+                tx_data   <= out_byte;
+                if (crc_init)
+                    crc <= crc16_update(16'hFFFF, out_byte);
+                else if (~crc_skip)
+                    crc <= crc16_update(crc, out_byte);
+
+                if (out_last) begin
+                    idx  <= 0;
+                    plan <= plan_left;
+                    step <= first_step(plan_left);
+                end else begin
+                    idx <= idx + 1;
+                end
+            end
+        end
+    end
+endmodule
@@ -0,0 +1,154 @@
+`timescale 1ns / 1ps
+//////////////////////////////////////////////////////////////////////////////////
+// Company: RaySkechers
+// Engineer:
+//
+// Module Name: pixel_dispatcher
+// Project Name: RaySkecherV1
+// Target Devices: Basys 3
+// Description:
+//   Hands the pixels of a frame, in scanline order, to an array of NUM_TRACERS
+//   trace_path instances (replaces image_pulse's single counter). The frame
+//   is width x height pixels, num_pixels of them, all three held steady by
+//   the caller while busy; a pixel's sequence number is its position in
+//   scanline order, starting at 0.
+//   • A tracer gets a one-cycle start pulse when it is idle and its last
+//     result has been taken; its x/y stay on tracer_x/tracer_y until it is
+//     done.
+//   • Results are captured on ap_done and handed out one per cycle on
+//     result_*, tagged with their x, y and sequence number, in whatever order
+//     the tracers finish.
+//   • A pixel is only handed out while it is less than WINDOW pixels ahead
+//     of retired (the reorder buffer's count of pixels passed on in order),
+//     so the reorder buffer never overflows.
+//   The frame runs from start until retired reaches num_pixels.
+//
+// Dependencies: reorder_buffer (retired)
+//
+//////////////////////////////////////////////////////////////////////////////////
+
+
+module pixel_dispatcher #(
+    parameter NUM_TRACERS = 4,
+    parameter WINDOW      = 64
+)(
+    input clk,
+    input rst,
+    input start,
+    input[15:0] width,
+    input[31:0] num_pixels,
+    input[31:0] retired,
+
+    output reg[NUM_TRACERS-1:0]  tracer_start,
+    output[NUM_TRACERS*16-1:0]   tracer_x,       // x of tracer i at [16*i +: 16]
+    output[NUM_TRACERS*16-1:0]   tracer_y,
+    input[NUM_TRACERS-1:0]       tracer_done,
+    input[NUM_TRACERS-1:0]       tracer_idle,
+    input[NUM_TRACERS*24-1:0]    tracer_return,
+
+    output reg        result_valid,
+    output reg[15:0]  result_x,
+    output reg[15:0]  result_y,
+    output reg[31:0]  result_seq,
+    output reg[23:0]  result_color,
+
+    output busy
+);
+    reg active;
+    reg[31:0] next;                     // next pixel to hand out
+    reg[15:0] next_x, next_y;
+    reg[NUM_TRACERS-1:0] running;       // started, not done yet
+    reg[NUM_TRACERS-1:0] held;          // done, result not taken yet
+    reg[15:0] x_r[0:NUM_TRACERS-1];
+    reg[15:0] y_r[0:NUM_TRACERS-1];
+    reg[31:0] seq_r[0:NUM_TRACERS-1];
+    reg[23:0] color_r[0:NUM_TRACERS-1];
+
+    assign busy = active;
+
+    genvar g;
+    generate
+        for (g = 0; g < NUM_TRACERS; g = g + 1) begin : tags
+            assign tracer_x[16*g +: 16] = x_r[g];
+            assign tracer_y[16*g +: 16] = y_r[g];
+        end
+    endgenerate
+
+    // Lowest free tracer and lowest held result
+    wire[NUM_TRACERS-1:0] free = ~running & ~held & tracer_idle;
+    reg  free_any, held_any;
+    reg[31:0] free_sel, held_sel;
+    integer i, j;
+    always @(*) begin
+        free_any = 1'b0;
+        held_any = 1'b0;
+        free_sel = 0;
+        held_sel = 0;
+        for (i = NUM_TRACERS - 1; i >= 0; i = i - 1) begin
+            if (free[i]) begin
+                free_any = 1'b1;
+                free_sel = i;
+            end
+            if (held[i]) begin
+                held_any = 1'b1;
+                held_sel = i;
+            end
+        end
+    end
+
+    wire in_window = (next - retired) < WINDOW;
+    wire dispatch = active & (next != num_pixels) & in_window & free_any;
+
+    always @(posedge clk) begin
+        tracer_start <= 0;
+        result_valid <= 1'b0;
+
+        if (rst) begin
+            active  <= 1'b0;
+            next    <= 0;
+            running <= 0;
+            held    <= 0;
+        end else begin
+            if (start & ~active) begin
+                active <= 1'b1;
+                next   <= 0;
+                next_x <= 0;
+                next_y <= 0;
+            end else if (active & (retired == num_pixels)) begin
+                active <= 1'b0;
+            end
+
+            if (dispatch) begin
+                x_r[free_sel]          <= next_x;
+                y_r[free_sel]          <= next_y;
+                seq_r[free_sel]        <= next;
+                running[free_sel]      <= 1'b1;
+                tracer_start[free_sel] <= 1'b1;
+                next                   <= next + 1;
+                if (next_x == width - 1) begin
+                    next_x <= 0;
+                    next_y <= next_y + 1;
+                end else begin
+                    next_x <= next_x + 1;
+                end
+            end
+
+            for (j = 0; j < NUM_TRACERS; j = j + 1) begin
+                if (running[j] & tracer_done[j]) begin
+                    running[j] <= 1'b0;
+                    held[j]    <= 1'b1;
+                    color_r[j] <= tracer_return[24*j +: 24];
+                end
+            end
+
+            if (held_any) begin
+                held[held_sel] <= 1'b0;
+                result_valid   <= 1'b1;
+                result_x       <= x_r[held_sel];
+                result_y       <= y_r[held_sel];
+                result_seq     <= seq_r[held_sel];
+                result_color   <= color_r[held_sel];
+            end
+        end
+    end
+endmodule
@@ -0,0 +1,72 @@
+`timescale 1ns / 1ps
+//////////////////////////////////////////////////////////////////////////////////
+// Company: RaySkechers
+// Engineer:
+//
+// Module Name: reorder_buffer
+// Project Name: RaySkecherV1
+// Target Devices: Basys 3
+// Description:
+//   Puts the tagged results of pixel_dispatcher back into scanline order for
+//   frame_transmitter, which takes the pixels without coordinates. A result is
+//   parked in slot seq mod DEPTH, seq being its position in scanline order; the slot of the next pixel in order is
+//   passed on as soon as it is filled and out_ready is high. retired counts
+//   the pixels passed on; the dispatcher keeps every pixel in flight less
+//   than DEPTH ahead of it, so no slot is written twice. Nothing is passed
+//   on past num_pixels, the frame's pixel count.
+//   The buffer is DEPTH x 24 bits of distributed RAM.
+//
+//////////////////////////////////////////////////////////////////////////////////
+
+
+module reorder_buffer #(
+    parameter DEPTH_LOG2 = 6
+)(
+    input clk,
+    input rst,
+    input clear,            // start of a frame
+    input[31:0] num_pixels,
+
+    input        in_valid,
+    input[31:0]  in_seq,
+    input[23:0]  in_color,
+
+    input             out_ready,
+    output reg        out_valid,    // one-cycle strobe, out_color valid with it
+    output reg[23:0]  out_color,
+    output reg[31:0]  retired
+);
+    localparam DEPTH = 1 << DEPTH_LOG2;
+
+    reg[23:0] mem[0:DEPTH-1];
+    reg[DEPTH-1:0] filled;
+
+    wire[DEPTH_LOG2-1:0] in_slot = in_seq[DEPTH_LOG2-1:0];
+    wire[DEPTH_LOG2-1:0] head = retired[DEPTH_LOG2-1:0];
+
+    always @(posedge clk) begin
+        if (in_valid)
+            mem[in_slot] <= in_color;
+    end
+
+    always @(posedge clk) begin
+        out_valid <= 1'b0;
+
+        if (rst | clear) begin
+            filled  <= 0;
+            retired <= 0;
+        end else begin
+            // A filled slot is never written again: the pixel would be
+            // DEPTH ahead of the one waiting in it
+            if (in_valid)
+                filled[in_slot] <= 1'b1;
+
+            if (filled[head] & out_ready & (retired != num_pixels)) begin
+                filled[head] <= 1'b0;
+                out_valid    <= 1'b1;
+                out_color    <= mem[head];
+                retired      <= retired + 1;
+            end
+        end
+    end
+endmodule
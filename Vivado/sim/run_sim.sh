@@ -0,0 +1,64 @@
+#!/bin/sh
+# Runs both testbenches on the C model's vectors and checks every UART stream
+# against uart_protocol.py's encoder byte for byte. Each case prints PASS or
+# FAIL and the script exits 1 if any of them failed.
+#
+#   sim/run_sim.sh [workdir]        (workdir defaults to sim/work)
+#
+# IVERILOG, VVP, CC and PYTHON pick the tools (default iverilog, vvp, gcc and
+# python3). The tb_top cases trace whole frames, cycle by cycle, so expect
+# minutes rather than seconds.
+
+cd "$(dirname "$0")/.." || exit 1
+VIVADO=$(pwd)
+VITIS=$VIVADO/../Vitis
+WORK=${1:-sim/work}
+
+IVERILOG=${IVERILOG:-iverilog}
+VVP=${VVP:-vvp}
+CC=${CC:-gcc}
+PYTHON=${PYTHON:-python3}
+
+mkdir -p "$WORK" || exit 1
+WORK=$(cd "$WORK" && pwd)
+
+TOP_SRC="sim/tb_top.v sim/trace_path_0.v top.v pixel_dispatcher.v reorder_buffer.v
+         frame_transmitter.v transmitter.v vga_ctrl.v"
+FT_SRC="sim/tb_frame_transmitter.v frame_transmitter.v transmitter.v"
+
+echo "== stream_model vectors"
+$CC -std=c99 -O2 -DTRACE_STATS "$VITIS/stream_model.c" "$VITIS/scene.c" \
+    "$VITIS/trace_path.c" -o "$WORK/stream_model" -lm || exit 1
+"$WORK/stream_model" -v "$WORK/v256.hex" > /dev/null || exit 1
+"$WORK/stream_model" -r 320x240 -v "$WORK/v320.hex" > /dev/null || exit 1
+
+failed=0
+passed=0
+
+# run <name> <vectors> <encoding> <width> <iverilog defines and sources...>
+run() {
+    name=$1 vectors=$2 enc=$3 width=$4
+    shift 4
+    echo "== $name"
+    if $IVERILOG -g2005 -DENCODING="'h${enc#0x}" -DTRACE_VECTORS="\"$vectors\"" \
+            -DUART_OUT="\"$WORK/$name.hex\"" -o "$WORK/$name.vvp" "$@" \
+        && $VVP "$WORK/$name.vvp" | tee "$WORK/$name.log" \
+        && grep -qx PASS "$WORK/$name.log" \
+        && $PYTHON ../uart_protocol.py check "$vectors" "$WORK/$name.hex" -e "$enc" -w "$width"
+    then
+        passed=$((passed + 1))
+    else
+        echo "FAIL: $name"
+        failed=$((failed + 1))
+    fi
+}
+
+run ft_256_rgb888     "$WORK/v256.hex" 0x00 256 $FT_SRC
+run ft_256_rle_rgb565 "$WORK/v256.hex" 0x81 256 $FT_SRC
+run ft_256_rle_rgb332 "$WORK/v256.hex" 0x82 256 $FT_SRC
+run ft_320_rle_rgb565 "$WORK/v320.hex" 0x81 320 -DWIDTH=320 -DHEIGHT=240 $FT_SRC
+run top_4_256_rgb888  "$WORK/v256.hex" 0x00 256 -DNUM_TRACERS=4 $TOP_SRC
+run top_8_320_rle_rgb332 "$WORK/v320.hex" 0x82 320 -DNUM_TRACERS=8 -DRESOLUTION=1 $TOP_SRC
+
+echo "== $passed passed, $failed failed"
+[ "$failed" -eq 0 ]
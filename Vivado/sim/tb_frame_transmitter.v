@@ -0,0 +1,122 @@
+`timescale 1ns / 1ps
+//////////////////////////////////////////////////////////////////////////////////
+// Company: RaySkechers
+// Engineer:
+//
+// Module Name: tb_frame_transmitter
+// Project Name: RaySkecherV1
+// Description:
+//   Feeds the colours of the C model (stream_model -v) for a `WIDTH x
+//   `HEIGHT frame to frame_transmitter in scanline order, with random gaps between pixels, and writes the UART
+//   bytes to `UART_OUT, one hex byte a line. uart_protocol.py check then
+//   decodes them and compares them with its own encoder byte for byte.
+//
+//   iverilog -g2005 -DENCODING="'h82" -DTRACE_VECTORS='"vectors.hex"' -o tb_ft \
+//       sim/tb_frame_transmitter.v frame_transmitter.v transmitter.v
+//   vvp tb_ft
+//   python3 ../uart_protocol.py check vectors.hex uart.hex -e 0x82
+//   (other sizes: stream_model -r WxH, -DWIDTH/-DHEIGHT here and -w for
+//   the check)
+//
+//////////////////////////////////////////////////////////////////////////////////
+
+`ifndef TRACE_VECTORS
+`define TRACE_VECTORS "vectors.hex"
+`endif
+`ifndef ENCODING
+`define ENCODING 0
+`endif
+`ifndef UART_OUT
+`define UART_OUT "uart.hex"
+`endif
+`ifndef WIDTH
+`define WIDTH 256
+`endif
+`ifndef HEIGHT
+`define HEIGHT 256
+`endif
+
+module tb_frame_transmitter;
+    localparam CLK_FREQ  = 100_000_000;
+    localparam BAUD_RATE = CLK_FREQ / 2;
+    localparam DIV       = CLK_FREQ / BAUD_RATE;
+    localparam NUM_PIXELS = `WIDTH * `HEIGHT;
+
+    reg clk = 1'b0;
+    reg reset = 1'b1;
+    reg frame_start = 1'b0;
+    reg start = 1'b0;
+    reg[23:0] rgb = 24'h0;
+    wire busy, TxD;
+
+    always #5 clk = ~clk;
+
+    frame_transmitter #(
+        .CLK_FREQ(CLK_FREQ),
+        .BAUD_RATE(BAUD_RATE)
+    ) dut (
+        .clk(clk),
+        .reset(reset),
+        .frame_start(frame_start),
+        .encoding(`ENCODING),
+        .width(16'd`WIDTH),
+        .height(16'd`HEIGHT),
+        .start(start),
+        .rgb(rgb),
+        .busy(busy),
+        .TxD(TxD)
+    );
+
+    reg[47:0] vectors[0:NUM_PIXELS-1];
+
+    integer rx_bytes = 0, rx_errors = 0, rx_file;
+    reg[7:0] rx_byte;
+    integer b;
+    initial rx_file = $fopen(`UART_OUT, "w");
+    always begin
+        @(negedge TxD);
+        repeat (DIV + DIV / 2) @(posedge clk);
+        for (b = 0; b < 8; b = b + 1) begin
+            rx_byte[b] = TxD;
+            repeat (DIV) @(posedge clk);
+        end
+        if (TxD !== 1'b1)
+            rx_errors = rx_errors + 1;
+        $fwrite(rx_file, "%02x\n", rx_byte);
+        rx_bytes = rx_bytes + 1;
+        wait (TxD === 1'b1);
+    end
+
+    integer p, seed;
+    initial begin
+        $readmemh(`TRACE_VECTORS, vectors);
+        seed = 1;
+        repeat (10) @(posedge clk);
+        reset <= 1'b0;
+        repeat (10) @(posedge clk);
+        frame_start <= 1'b1;
+        @(posedge clk);
+        frame_start <= 1'b0;
+
+        for (p = 0; p < NUM_PIXELS; p = p + 1) begin
+            while (busy) @(posedge clk);
+            repeat ($unsigned($random(seed)) % 4) @(posedge clk);
+            start <= 1'b1;
+            rgb   <= vectors[p][23:0];
+            @(posedge clk);
+            start <= 1'b0;
+        end
+
+        @(posedge clk);
+        wait (busy === 1'b0 && dut.UART.idle === 1'b1);
+        repeat (12 * DIV) @(posedge clk);
+        $fclose(rx_file);
+        $display("%0d bytes (%.2f of raw RGB888), %0d framing errors, in %s",
+                 rx_bytes, rx_bytes / (3.0 * NUM_PIXELS), rx_errors, `UART_OUT);
+        if (rx_bytes > 0 && rx_errors == 0)
+            $display("PASS");
+        else
+            $display("FAIL");
+        $finish;
+    end
+endmodule
@@ -0,0 +1,172 @@
+`timescale 1ns / 1ps
+//////////////////////////////////////////////////////////////////////////////////
+// Company: RaySkechers
+// Engineer:
+//
+// Module Name: tb_top
+// Project Name: RaySkecherV1
+// Description:
+//   Renders one frame through top.v with `NUM_TRACERS instances of the
+//   trace_path_0 stand-in and checks it:
+//   • every framebuffer pixel holds the RGB332 of the C model's colour (the
+//     top-left 256x256 of larger frames);
+//   • the UART bytes go to `UART_OUT for uart_protocol.py check, which
+//     decodes them and compares them with the vectors byte for byte (left out
+//     with -DNO_UART, which sets sw[0] for a VGA-only frame). -DENCODING=n
+//     sets switches 3..1 to the encoding's (n = 'h82 is RGB332 with RLE).
+//   -DRESOLUTION=n sets switches 5..4 to pick the frame size (see top.v; 1 is
+//   320x240); the vectors must be for that size.
+//   It prints the frame time against the ideal, the sum of the stand-in's
+//   latencies shared out over the tracers, so runs with different
+//   NUM_TRACERS show how the frame time scales. The UART runs at CLK_FREQ / 2
+//   here, 23 cycles a byte, which keeps up with up to 8 tracers at the
+//   default LATENCY_SHIFT in RGB888; past that, or to take it out of the
+//   picture, use -DNO_UART.
+//
+//   ./stream_model -v vectors.hex          (Vitis, built with -DTRACE_STATS)
+//   iverilog -g2005 -DNUM_TRACERS=4 -DTRACE_VECTORS='"vectors.hex"' -o tb_top \
+//       sim/tb_top.v sim/trace_path_0.v top.v pixel_dispatcher.v \
+//       reorder_buffer.v frame_transmitter.v transmitter.v vga_ctrl.v
+//   vvp tb_top
+//   python3 ../uart_protocol.py check vectors.hex uart.hex -e 0
+//   (with -DRESOLUTION=1: stream_model -r 320x240 and check -w 320)
+//   (Verilator: verilator --binary --top-module tb_top with the same files
+//   and defines.)
+//
+//////////////////////////////////////////////////////////////////////////////////
+
+`ifndef NUM_TRACERS
+`define NUM_TRACERS 4
+`endif
+`ifndef TRACE_VECTORS
+`define TRACE_VECTORS "vectors.hex"
+`endif
+`ifndef LATENCY_SHIFT
+`define LATENCY_SHIFT 5
+`endif
+`ifndef ENCODING
+`define ENCODING 0
+`endif
+`ifndef UART_OUT
+`define UART_OUT "uart.hex"
+`endif
+`ifndef RESOLUTION
+`define RESOLUTION 0
+`endif
+
+module tb_top;
+    localparam CLK_FREQ  = 100_000_000;
+    localparam BAUD_RATE = CLK_FREQ / 2;
+    localparam DIV       = CLK_FREQ / BAUD_RATE;
+    // The frame sizes of top.v's sw[5:4]
+    localparam WIDTH  = `RESOLUTION == 1 ? 320 : `RESOLUTION == 2 ? 640 : `RESOLUTION == 3 ? 160 : 256;
+    localparam HEIGHT = `RESOLUTION == 1 ? 240 : `RESOLUTION == 2 ? 480 : `RESOLUTION == 3 ? 120 : 256;
+    localparam NUM_PIXELS = WIDTH * HEIGHT;
+
+    reg clk = 1'b0;
+    reg btnC = 1'b1;
+    reg btnD = 1'b0;
+    reg[15:0] sw = 16'h0000;
+    wire[15:0] led;
+    wire[3:0] vgaRed, vgaGreen, vgaBlue;
+    wire Hsync, Vsync, TxD;
+
+    always #5 clk = ~clk;
+
+    top #(
+        .NUM_TRACERS(`NUM_TRACERS),
+        .CLK_FREQ(CLK_FREQ),
+        .BAUD_RATE(BAUD_RATE)
+    ) dut (
+        .sw(sw), .led(led), .clk(clk),
+        .btnU(1'b0), .btnC(btnC), .btnL(1'b0), .btnR(1'b0), .btnD(btnD),
+        .vgaRed(vgaRed), .vgaGreen(vgaGreen), .vgaBlue(vgaBlue),
+        .Hsync(Hsync), .Vsync(Vsync), .TxD(TxD)
+    );
+
+    reg[47:0] vectors[0:NUM_PIXELS-1];
+
+    // UART receiver, one byte a line into `UART_OUT
+    integer rx_bytes = 0, rx_errors = 0, rx_file;
+    reg[7:0] rx_byte;
+    integer b;
+    initial rx_file = $fopen(`UART_OUT, "w");
+    always begin
+        @(negedge TxD);
+        repeat (DIV + DIV / 2) @(posedge clk);
+        for (b = 0; b < 8; b = b + 1) begin
+            rx_byte[b] = TxD;
+            repeat (DIV) @(posedge clk);
+        end
+        // Now in the stop bit
+        if (TxD !== 1'b1)
+            rx_errors = rx_errors + 1;
+        $fwrite(rx_file, "%02x\n", rx_byte);
+        rx_bytes = rx_bytes + 1;
+        wait (TxD === 1'b1);
+    end
+
+    integer p, fb_errors, cycles;
+    reg[23:0] c;
+    reg[63:0] work;
+
+    initial begin
+        $readmemh(`TRACE_VECTORS, vectors);
+        work = 0;
+        for (p = 0; p < NUM_PIXELS; p = p + 1) begin
+            c = vectors[p][47:24] >> `LATENCY_SHIFT;
+            work = work + (c > 1 ? c : 1);
+        end
+        sw[3]   = (`ENCODING >> 7) & 1;
+        sw[2:1] = `ENCODING & 3;
+        sw[5:4] = `RESOLUTION;
+`ifdef NO_UART
+        sw[0] = 1'b1;
+`endif
+
+        repeat (10) @(posedge clk);
+        btnC = 1'b0;
+        repeat (10) @(posedge clk);
+        btnD = 1'b1;
+        repeat (10) @(posedge clk);
+        btnD = 1'b0;
+
+        wait (dut.pix_busy === 1'b1);
+        cycles = 0;
+        while (dut.pix_busy === 1'b1) begin
+            @(posedge clk);
+            cycles = cycles + 1;
+        end
+`ifndef NO_UART
+        // The last row's CRC and the frame end are still on the line
+        wait (dut.out.busy === 1'b0 && dut.out.UART.idle === 1'b1);
+        repeat (12 * DIV) @(posedge clk);
+`endif
+        $fclose(rx_file);
+        repeat (10) @(posedge clk);
+
+        fb_errors = 0;
+        for (p = 0; p < NUM_PIXELS; p = p + 1) begin
+            c = vectors[p][23:0];
+            if (p % WIDTH < 256 && p / WIDTH < 256
+                && dut.vga.fb_mem[p / WIDTH * 256 + p % WIDTH] !== {c[7:5], c[15:13], c[23:22]}) begin
+                if (fb_errors < 10)
+                    $display("framebuffer (%0d, %0d): got %02x, expected %02x", p % WIDTH, p / WIDTH,
+                             dut.vga.fb_mem[p / WIDTH * 256 + p % WIDTH], {c[7:5], c[15:13], c[23:22]});
+                fb_errors = fb_errors + 1;
+            end
+        end
+
+        $display("%0d tracers, %0dx%0d: frame in %0d cycles, ideal %0d (%.1f%% tracer utilisation)",
+                 `NUM_TRACERS, WIDTH, HEIGHT, cycles, work / `NUM_TRACERS, 100.0 * work / (`NUM_TRACERS * cycles));
+`ifndef NO_UART
+        $display("UART: %0d bytes, %0d framing errors, in %s", rx_bytes, rx_errors, `UART_OUT);
+`endif
+        $display("framebuffer: %0d wrong pixels", fb_errors);
+        if (fb_errors == 0 && rx_errors == 0)
+            $display("PASS");
+        else
+            $display("FAIL");
+        $finish;
+    end
+endmodule
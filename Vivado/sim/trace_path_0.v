@@ -0,0 +1,89 @@
+`timescale 1ns / 1ps
+//////////////////////////////////////////////////////////////////////////////////
+// Company: RaySkechers
+// Engineer:
+//
+// Module Name: trace_path_0 (simulation stand-in)
+// Project Name: RaySkecherV1
+// Description:
+//   Behavioral model of the HLS trace_path_sized IP for simulating top.v
+//   without Vivado. It has the IP's ports and ap_ctrl_hs handshake, and
+//   replays the C model instead of tracing: stream_model -v writes, for every
+//   pixel, the kernel's colour and an estimate of its latency in cycles (see
+//   Vitis/stream_model.c). A call takes that latency >> `LATENCY_SHIFT cycles
+//   (at least 1), so a frame simulates in reasonable time with the real
+//   frame's load, slow and fast pixels alike. The vectors must be for the
+//   frame size on width/height (stream_model -r WxH), at most `MAX_VECTORS
+//   pixels.
+//   It reports x/y changing during a call, which the real IP may read at any
+//   time.
+//
+// Dependencies: `TRACE_VECTORS, the file written by stream_model -v
+//
+//////////////////////////////////////////////////////////////////////////////////
+
+`ifndef TRACE_VECTORS
+`define TRACE_VECTORS "vectors.hex"
+`endif
+`ifndef LATENCY_SHIFT
+`define LATENCY_SHIFT 5
+`endif
+`ifndef MAX_VECTORS
+`define MAX_VECTORS 307200
+`endif
+
+module trace_path_0 (
+    input             ap_clk,
+    input             ap_rst,
+    input             ap_start,
+    output reg        ap_done,
+    output            ap_idle,
+    output reg        ap_ready,
+    output reg[23:0]  ap_return,
+    input[15:0]       x,
+    input[15:0]       y,
+    input[15:0]       width,
+    input[15:0]       height
+);
+    reg[47:0] vectors[0:`MAX_VECTORS-1];
+    initial $readmemh(`TRACE_VECTORS, vectors);
+
+    reg running;
+    reg[23:0] count;
+    reg[23:0] color;
+    reg[15:0] x_r, y_r;
+
+    wire[31:0] pixel = y * width + x;
+    wire[23:0] latency = vectors[pixel][47:24] >> `LATENCY_SHIFT;
+
+    assign ap_idle = ~running;
+
+    always @(posedge ap_clk) begin
+        ap_done  <= 1'b0;
+        ap_ready <= 1'b0;
+
+        if (ap_rst) begin
+            running <= 1'b0;
+        end else if (~running) begin
+            if (ap_start) begin
+                running <= 1'b1;
+                count   <= latency > 1 ? latency - 1 : 0;
+                color   <= vectors[pixel][23:0];
+                x_r     <= x;
+                y_r     <= y;
+            end
+        end else begin
+            if (x != x_r || y != y_r)
+                $display("%m: x/y changed from (%0d, %0d) to (%0d, %0d) during a call at %0t",
+                         x_r, y_r, x, y, $time);
+            if (count == 0) begin
+                running   <= 1'b0;
+                ap_done   <= 1'b1;
+                ap_ready  <= 1'b1;
+                ap_return <= color;
+            end else begin
+                count <= count - 1;
+            end
+        end
+    end
+endmodule
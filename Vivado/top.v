@@ -19,7 +19,12 @@
 // 
 //////////////////////////////////////////////////////////////////////////////////
 
-module top(
+module top #(
+    parameter NUM_TRACERS = 4,          // trace_path_0 instances; each takes ~13 KB of BRAM at MAX_SPHERES=256 (hls_config.cfg)
+    parameter ROB_DEPTH_LOG2 = 6,       // reorder window of 64 pixels
+    parameter CLK_FREQ = 100_000_000,
+    parameter BAUD_RATE = 2_000_000     // main.py --baud must match
+)(
     input[15:0] sw,
     output[15:0] led,
     input clk,
@@ -37,8 +42,9 @@ module top(
 );
 
     reg  btnD_r1, btnD_r2;
-    wire ap_done, ap_idle, ap_ready, ap_start;
-    wire[23:0] ap_return;
+    wire ap_start;
+    wire[NUM_TRACERS-1:0] ap_done, ap_idle, ap_ready;
+    wire[NUM_TRACERS*24-1:0] ap_return;
     
     always @(posedge clk) begin
         btnD_r1 <= btnD;
@@ -58,9 +64,47 @@ module top(
         else if (btnD_rise)        ap_start_r <= 1'b1;
     end
     assign ap_start = ap_start_r;
+    wire busy;
+    // A frame also waits for the last one's trailing packets to go out
+    wire frame_start = ap_start & ~pix_busy & ~busy;
     
-    wire[15:0] x, y;
-    assign {x[15:8], y[15:8]} = 0;
+    // Read at the start of each frame:
+    //   sw[0]    up: VGA only, results are not held back for the UART, so the
+    //            frame time is the tracers' alone
+    //   sw[2:1]  UART pixel format: 0 RGB888, 1 RGB565, 2 RGB332
+    //   sw[3]    run-length coding
+    //   sw[5:4]  frame size: 0 256x256, 1 320x240, 2 640x480, 3 160x120; the
+    //            VGA shows the top-left 256x256 of it
+    reg uart_on;
+    always @(posedge clk) begin
+        if (ap_rst)           uart_on <= 1'b1;
+        else if (frame_start) uart_on <= ~sw[0];
+    end
+    wire[7:0] encoding = {sw[3], 5'b0, sw[2:1]};
+
+    reg[15:0] size_w, size_h;
+    always @(*) begin
+        case (sw[5:4])
+            2'd1:    begin size_w = 16'd320; size_h = 16'd240; end
+            2'd2:    begin size_w = 16'd640; size_h = 16'd480; end
+            2'd3:    begin size_w = 16'd160; size_h = 16'd120; end
+            default: begin size_w = 16'd256; size_h = 16'd256; end
+        endcase
+    end
+    // Size of the frame being traced, for the tracers and the dispatcher
+    reg[15:0] frame_w, frame_h;
+    reg[31:0] frame_pixels;
+    always @(posedge clk) begin
+        if (ap_rst) begin
+            frame_w      <= 16'd256;
+            frame_h      <= 16'd256;
+            frame_pixels <= 32'd65536;
+        end else if (frame_start) begin
+            frame_w      <= size_w;
+            frame_h      <= size_h;
+            frame_pixels <= size_w * size_h;
+        end
+    end
 
     reg[23:0] last_val;
     
@@ -69,62 +113,95 @@ module top(
     assign led[7:4] = last_val[15:12];
     assign led[11:8] = last_val[23:20];
     
-    wire busy;
-    wire start;
-    reg prev_done;
-    reg start_delayed;
-    initial prev_done = 0;
-    
-    always @(posedge clk)
-        prev_done <= ap_done;
-    always @(posedge clk)
-        start_delayed <= start;
+    wire[NUM_TRACERS-1:0] tp_start;
+    wire[NUM_TRACERS*16-1:0] tp_x, tp_y;
+
+    // Results tagged with their pixel, in completion order
+    wire res_valid;
+    wire[15:0] res_x, res_y;
+    wire[31:0] res_seq;
+    wire[23:0] res_color;
+
+    // Results in scanline order, for the UART
+    wire out_valid;
+    wire[23:0] out_color;
+    wire[31:0] retired;
     
-    reg[7:0] prev_x, prev_y;
     always @(posedge clk) begin
-        if (start) begin
-            prev_x <= x;
-            prev_y <= y;
-            last_val <= ap_return;
-        end
+        if (res_valid)
+            last_val <= res_color;
     end
     
-    assign start = ap_done & (~prev_done);
-    
-    assign led[15] = ap_done;
-    assign led[14] = ap_idle;
+    assign led[15] = |ap_done;
+    assign led[14] = &ap_idle;
     assign led[13] = btnD;
     assign led[12] = pix_busy;
     
-    wire tp_start;
-    
-    
-    image_pulse ctrl (
+    pixel_dispatcher #(
+        .NUM_TRACERS(NUM_TRACERS),
+        .WINDOW(1 << ROB_DEPTH_LOG2)
+    ) ctrl (
         .clk(clk),
-        .tgts_busy(busy | ~ap_idle | start | tp_start),
-        .start(ap_start),
-        .signal(tp_start),
-        .x(x[7:0]),
-        .y(y[7:0]),
+        .rst(ap_rst),
+        .start(frame_start),
+        .width(frame_w),
+        .num_pixels(frame_pixels),
+        .retired(retired),
+        .tracer_start(tp_start),
+        .tracer_x(tp_x),
+        .tracer_y(tp_y),
+        .tracer_done(ap_done),
+        .tracer_idle(ap_idle),
+        .tracer_return(ap_return),
+        .result_valid(res_valid),
+        .result_x(res_x),
+        .result_y(res_y),
+        .result_seq(res_seq),
+        .result_color(res_color),
         .busy(pix_busy)
     );
     
-    color_transmitter out (
+    reorder_buffer #(
+        .DEPTH_LOG2(ROB_DEPTH_LOG2)
+    ) rob (
+        .clk(clk),
+        .rst(ap_rst),
+        .clear(frame_start),
+        .num_pixels(frame_pixels),
+        .in_valid(res_valid),
+        .in_seq(res_seq),
+        .in_color(res_color),
+        .out_ready(~uart_on | ~busy),
+        .out_valid(out_valid),
+        .out_color(out_color),
+        .retired(retired)
+    );
+    
+    frame_transmitter #(
+        .CLK_FREQ(CLK_FREQ),
+        .BAUD_RATE(BAUD_RATE)
+    ) out (
         .clk(clk),
         .reset(ap_rst),
-        .start(start),
-        .rgb(ap_return),
+        .frame_start(frame_start & ~sw[0]),
+        .encoding(encoding),
+        .width(size_w),
+        .height(size_h),
+        .start(out_valid & uart_on),
+        .rgb(out_color),
         .busy(busy),
         .TxD(TxD)
     );
     
+    // The framebuffer is addressed, so it takes results as they finish; it
+    // holds 256x256, so larger frames are cropped
     framebuffer_vga_dual vga (
         .clk (clk),
         .rst_btn (ap_rst),
-        .wr_x    (prev_x),
-        .wr_y    (prev_y),
-        .wr_pix  ({last_val[7:5], last_val[15:13], last_val[23:22]}),
-        .wr_we   (start_delayed),
+        .wr_x    (res_x[7:0]),
+        .wr_y    (res_y[7:0]),
+        .wr_pix  ({res_color[7:5], res_color[15:13], res_color[23:22]}),
+        .wr_we   (res_valid & (res_x < 16'd256) & (res_y < 16'd256)),
         .vga_r   (vgaRed),
         .vga_g   (vgaGreen),
         .vga_b   (vgaBlue),
@@ -133,15 +210,22 @@ module top(
     );
 
 
-    trace_path_0 main_fn (
-      .ap_clk(clk),        // input wire ap_clk
-      .ap_rst(ap_rst),        // input wire ap_rst
-      .ap_done(ap_done),      // output wire ap_done
-      .ap_idle(ap_idle),      // output wire ap_idle
-      .ap_ready(ap_ready),    // output wire ap_ready
-      .ap_start(tp_start),    // input wire ap_start
-      .ap_return(ap_return),  // output wire [23 : 0] ap_return
-      .x(x),                  // input wire [15 : 0] x
-      .y(y)                  // input wire [15 : 0] y
-    );
+    genvar i;
+    generate
+        for (i = 0; i < NUM_TRACERS; i = i + 1) begin : tracers
+            trace_path_0 main_fn (
+              .ap_clk(clk),                       // input wire ap_clk
+              .ap_rst(ap_rst),                    // input wire ap_rst
+              .ap_done(ap_done[i]),               // output wire ap_done
+              .ap_idle(ap_idle[i]),               // output wire ap_idle
+              .ap_ready(ap_ready[i]),             // output wire ap_ready
+              .ap_start(tp_start[i]),             // input wire ap_start
+              .ap_return(ap_return[24*i +: 24]),  // output wire [23 : 0] ap_return
+              .x(tp_x[16*i +: 16]),               // input wire [15 : 0] x
+              .y(tp_y[16*i +: 16]),               // input wire [15 : 0] y
+              .width(frame_w),                    // input wire [15 : 0] width
+              .height(frame_h)                    // input wire [15 : 0] height
+            );
+        end
+    endgenerate
 endmodule
\ No newline at end of file
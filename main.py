@@ -1,9 +1,33 @@
-import serial
-import sys
+"""UART client: receives the frames top.v sends and writes them to disk.
+
+The output file is a binary PPM that doubles as the frame buffer. It is
+memory-mapped, and the decoder writes each row into it as the row's block
+arrives, so an image viewer that reloads on change shows the frame filling
+in. It keeps receiving frame after frame until -n frames are done or Ctrl-C;
+each new frame overwrites the file, or gets its own with --numbered.
+
+    python3 main.py                          # first serial port, forever
+    python3 main.py --port /dev/ttyUSB1 -n 1 -o frame.ppm
+    python3 main.py --record capture.bin     # keep the raw stream too
+
+replay.py plays a recorded stream into a pseudo-terminal to test this
+without the board.
+"""
+
+import argparse
 import glob
-import numpy as np
-from PIL import Image
-from tqdm import tqdm
+import mmap
+import os
+import sys
+import time
+
+import serial
+
+from uart_protocol import FrameAssembler, FrameDecoder, FrameStart
+
+# Must match BAUD_RATE in Vivado/top.v
+BAUD_RATE = 2_000_000
+READ_SIZE = 1 << 16     # most bytes taken from the port at once
 
 def serial_ports():
     """ Lists serial port names
@@ -33,31 +57,122 @@ def serial_ports():
             pass
     return result
 
-print(serial_ports())
 
+class PPMFrames:
+    """new_frame for FrameAssembler: maps a PPM file of the frame's size and
+    hands back its pixels. The header is written first and the pixels start
+    black, so the file is a valid image from the first row on."""
+
+    def __init__(self, path, numbered):
+        self.path, self.numbered = path, numbered
+        self.count = 0
+        self.map = None
+        # (pixels, path) of the frame being received and of the one before,
+        # which a frame start can end after its successor's file is open
+        self.latest = self.previous = (None, None)
+
+    def __call__(self, frame, width, height):
+        path = self.path
+        if self.numbered:
+            root, ext = os.path.splitext(self.path)
+            path = f"{root}-{self.count:04d}{ext}"
+        self.count += 1
+        header = b"P6\n%d %d\n255\n" % (width, height)
+        size = len(header) + 3 * width * height
+        if path == self.latest[1] and self.map is not None and len(self.map) == size:
+            # Same file and size: just clear the last frame
+            self.map[len(header):] = bytes(size - len(header))
+            return self._pixels(len(header), path)
+        # Views of the last frame's map may still be around; dropping the
+        # reference lets it close once they are gone
+        self.map = None
+        with open(path, "w+b") as f:
+            f.write(header)
+            f.truncate(size)
+            self.map = mmap.mmap(f.fileno(), size)
+        return self._pixels(len(header), path)
+
+    def _pixels(self, offset, path):
+        view = memoryview(self.map)[offset:]
+        self.previous, self.latest = self.latest, (view, path)
+        return view
+
+    def path_of(self, rgb):
+        return self.latest[1] if rgb is self.latest[0] else self.previous[1]
+
+    def flush(self):
+        if self.map is not None:
+            self.map.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Receive frames from the board over the UART")
+    parser.add_argument("--port", help="serial port (default: the first one found)")
+    parser.add_argument("--baud", type=int, default=BAUD_RATE)
+    parser.add_argument("-n", "--frames", type=int, default=0, help="stop after this many frames (0: never)")
+    parser.add_argument("-o", "--output", default="out.ppm")
+    parser.add_argument("--numbered", action="store_true", help="a file a frame: out-0000.ppm, ...")
+    parser.add_argument("--record", help="also append the raw bytes received to this file")
+    args = parser.parse_args()
 
-port = serial_ports()[0]
-print(f"Using port {port}.")
+    port = args.port
+    if port is None:
+        ports = serial_ports()
+        print(ports)
+        if not ports:
+            sys.exit("No serial port found")
+        port = ports[0]
+    print(f"Using port {port} at {args.baud} baud.")
 
-s = serial.Serial(port, 115200)
-output = np.zeros((256,256,3), dtype=np.uint8)
+    s = serial.Serial(port, args.baud, timeout=0.05)
+    record = open(args.record, "ab") if args.record else None
+    files = PPMFrames(args.output, args.numbered)
+    assembler = FrameAssembler(files)
+    decoder = FrameDecoder(assembler.place)
+    done = 0
+    received = 0            # bytes since the last frame start
+    started = time.perf_counter()
 
-try:
-    for i in tqdm(range(256)):
-        for j in range(256):
-            pixel = []
-            for k in range(3):
-                pixel.append(int.from_bytes(s.read(), "big"))
-            output[i][j] = np.asarray(pixel)
-            #print(pixel)
-except KeyboardInterrupt:
-    pass
+    def report(frame):
+        nonlocal done
+        files.flush()
+        done += 1
+        elapsed = time.perf_counter() - started
+        state = "complete" if frame.complete else \
+            f"incomplete, {frame.received} of {frame.width * frame.height} pixels"
+        print(f"frame {frame.frame}: {frame.width}x{frame.height} {state}, {elapsed:.2f} s, "
+              f"{received / elapsed / 1e3:.0f} kB/s -> {files.path_of(frame.rgb)} "
+              f"({decoder.rejected} bad packets, {decoder.skipped} bytes skipped so far)")
 
-import json
+    # Packets that fail their CRC are dropped and the decoder picks up again at
+    # the next sync word, so a bad byte costs a row instead of the whole frame
+    try:
+        while not args.frames or done < args.frames:
+            data = s.read(min(max(s.in_waiting, 1), READ_SIZE))
+            if not data:
+                continue
+            if record:
+                record.write(data)
+            received += len(data)
+            for event in decoder.feed(data):
+                frame = assembler.add(event)
+                if frame:
+                    report(frame)
+                    if args.frames and done >= args.frames:
+                        break
+                if isinstance(event, FrameStart):
+                    received, started = len(data), time.perf_counter()
+    except KeyboardInterrupt:
+        frame = assembler.finish(False)
+        if frame:
+            report(frame)
+    finally:
+        s.close()
+        if record:
+            record.close()
+    # For the host denoiser: ./render -D out.ppm (see Vitis/denoise.h)
+    return 0 if done else 1
 
-with open("out.txt", "w") as f:
-    f.write(json.dumps(output.tolist()))
 
-img = Image.fromarray(output)
-img.show()
-img.save("out.png", "png")
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,76 @@
+"""Plays a recorded UART stream into a pseudo-terminal, standing in for the
+board, so main.py can be tested without it:
+
+    python3 replay.py capture.bin --rate 200000 --loop 3
+    /dev/pts/5
+    python3 main.py --port /dev/pts/5 -n 3
+
+The stream is a capture from main.py --record, uart_protocol.py encode
+output, or a testbench's uart.hex (read as hex text). --rate paces it in
+bytes a second (2 Mbaud is 200000; 0 sends as fast as the reader takes it)
+and --errors flips random bits, as a bad line would.
+"""
+
+import argparse
+import os
+import random
+import sys
+import time
+import tty
+
+from uart_protocol import read_stream
+
+CHUNK = 4096
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Replay a UART stream into a pseudo-terminal")
+    parser.add_argument("stream")
+    parser.add_argument("--rate", type=float, default=200_000, help="bytes a second, 0 for unpaced")
+    parser.add_argument("--loop", type=int, default=1, help="times to send the stream (0: forever)")
+    parser.add_argument("--errors", type=float, default=0, help="chance of a flipped bit in each byte")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--wait", type=float, default=1.0, help="seconds to wait for the reader to open the port")
+    args = parser.parse_args()
+
+    data = read_stream(args.stream)
+    master, slave = os.openpty()
+    # Raw, so the line discipline passes every byte through untouched
+    tty.setraw(slave)
+    print(os.ttyname(slave), flush=True)
+    time.sleep(args.wait)
+
+    rng = random.Random(args.seed)
+    sent, start = 0, time.perf_counter()
+    n = 0
+    try:
+        while not args.loop or n < args.loop:
+            for i in range(0, len(data), CHUNK):
+                chunk = data[i:i + CHUNK]
+                if args.errors:
+                    chunk = bytearray(chunk)
+                    for k in range(len(chunk)):
+                        if rng.random() < args.errors:
+                            chunk[k] ^= 1 << rng.randrange(8)
+                view = memoryview(chunk)
+                while view:
+                    view = view[os.write(master, view):]
+                sent += len(chunk)
+                if args.rate:
+                    ahead = sent / args.rate - (time.perf_counter() - start)
+                    if ahead > 0:
+                        time.sleep(ahead)
+            n += 1
+    except KeyboardInterrupt:
+        pass
+    elapsed = time.perf_counter() - start
+    print(f"{sent} bytes in {elapsed:.2f} s ({sent / elapsed / 1e3:.0f} kB/s)", file=sys.stderr)
+    # Let the reader drain the pty before it goes away
+    time.sleep(args.wait)
+    os.close(master)
+    os.close(slave)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
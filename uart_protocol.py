@@ -0,0 +1,503 @@
+"""Framed UART pixel protocol sent by Vivado/frame_transmitter.v.
+
+Every packet is
+
+    A5 5A  type  fields...  CRC-16 (hi, lo)
+
+    type 01 frame start  frame, width (2), height (2), encoding
+    type 02 block        frame, encoding, x (2), y (2), w (2), h (2),
+                         then the block's w*h pixels, row-major; h is
+                         always 1, frame_transmitter sends a row a block
+    type 03 frame end    frame, blocks (2)
+
+with big-endian fields and a CRC-16/CCITT-FALSE over everything after the
+sync word. The encoding's low bits select the pixel format (RGB888, RGB565
+or RGB332) and bit 7 turns on run-length coding: a pixel equal to the one
+before it is followed by a count of further copies, after which the next
+pixel starts afresh. See frame_transmitter.v for the details.
+
+FrameDecoder takes the byte stream in pieces of any size and returns the
+packets whose CRC checks out. On a bad packet it drops the first sync byte
+and searches for the next sync word, so a lost or corrupted byte costs one
+block. A block header that is not one row is bad at once: waiting for the
+pixels of a corrupted h could hold up the next sync word for many rows.
+FrameAssembler puts the blocks of each frame together, in a buffer the
+caller may supply (main.py gives it a memory-mapped PPM file), and rows are
+decoded straight into it. Pixels are widened a channel at a time with
+bytes.translate, so a frame decodes in milliseconds.
+
+Command line, for checking the RTL simulation (Vivado/sim):
+
+    python3 uart_protocol.py decode stream.bin [-o frame.ppm]
+    python3 uart_protocol.py encode vectors.hex -e 0x82 [-w 256] -o stream.bin
+    python3 uart_protocol.py check vectors.hex stream.hex -e 0x82 [-w 256]
+
+A path ending in .hex is read as hex text (the testbench's $fwrite output);
+anything else as raw bytes. -w is the width of the frame the vectors hold;
+the height is however many rows they fill.
+"""
+
+import argparse
+import binascii
+import struct
+import sys
+from collections import namedtuple
+
+SYNC = b"\xA5\x5A"
+PKT_FRAME_START, PKT_BLOCK, PKT_FRAME_END = 1, 2, 3
+RGB888, RGB565, RGB332 = 0, 1, 2
+RLE = 0x80
+MAX_SIZE = 4096     # largest width or height taken from a header
+
+FrameStart = namedtuple("FrameStart", "frame width height encoding")
+Block = namedtuple("Block", "frame encoding x y w h rgb")     # rgb: w*h*3 bytes, row-major
+FrameEnd = namedtuple("FrameEnd", "frame blocks")
+
+_NEED_MORE, _BAD = object(), object()
+
+
+def crc16(data):
+    return binascii.crc_hqx(data, 0xFFFF)
+
+
+def pixel_size(encoding):
+    return {RGB888: 3, RGB565: 2, RGB332: 1}[encoding & 3]
+
+
+def valid_encoding(encoding):
+    return encoding & 3 != 3 and encoding & 0x7C == 0
+
+
+def encode_pixel(r, g, b, encoding):
+    """Packs a pixel the way frame_transmitter does."""
+    fmt = encoding & 3
+    if fmt == RGB565:
+        return (r >> 3) << 11 | (g >> 2) << 5 | b >> 3
+    if fmt == RGB332:
+        return (r >> 5) << 5 | (g >> 5) << 2 | b >> 6
+    return r << 16 | g << 8 | b
+
+
+def decode_pixel(v, encoding):
+    """Expands a packed pixel to 8 bits a channel by repeating its bits."""
+    fmt = encoding & 3
+    if fmt == RGB565:
+        r, g, b = v >> 11, (v >> 5) & 63, v & 31
+        return bytes((r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2))
+    if fmt == RGB332:
+        r, g, b = v >> 5, (v >> 2) & 7, v & 3
+        return bytes((r << 5 | r << 2 | r >> 1, g << 5 | g << 2 | g >> 1, b * 0x55))
+    return bytes((v >> 16, (v >> 8) & 255, v & 255))
+
+
+def _packet(ptype, fields):
+    body = bytes((ptype,)) + fields
+    return SYNC + body + crc16(body).to_bytes(2, "big")
+
+
+def encode_block(frame, encoding, x, y, w, h, pixels):
+    """One block packet; pixels are packed values (encode_pixel), row-major."""
+    size = pixel_size(encoding)
+    out = bytearray()
+    have_last = counting = False
+    last = count = 0
+    for v in pixels:
+        same = have_last and v == last
+        if counting:
+            if same and count < 255:
+                count += 1
+                continue
+            out.append(count)
+            counting = False
+            same = False
+        out += v.to_bytes(size, "big")
+        if encoding & RLE and same:
+            counting, count = True, 0
+        have_last, last = True, v
+    if counting:
+        out.append(count)
+    fields = bytes((frame & 255, encoding)) + b"".join(n.to_bytes(2, "big") for n in (x, y, w, h))
+    return _packet(PKT_BLOCK, fields + bytes(out))
+
+
+def encode_frame(rgb, width, height, encoding, frame=1):
+    """The byte stream frame_transmitter sends for a frame. rgb holds
+    width*height (r, g, b) tuples in scanline order; each row is a block."""
+    out = bytearray(_packet(PKT_FRAME_START, bytes((frame & 255,)) + width.to_bytes(2, "big")
+                            + height.to_bytes(2, "big") + bytes((encoding,))))
+    for y in range(height):
+        row = [encode_pixel(*p, encoding) for p in rgb[y * width:(y + 1) * width]]
+        out += encode_block(frame, encoding, 0, y, width, 1, row)
+    out += _packet(PKT_FRAME_END, bytes((frame & 255,)) + height.to_bytes(2, "big"))
+    return bytes(out)
+
+
+def _expand_table(bits, shift):
+    """Byte -> the bits-wide field at shift, widened to 8 bits."""
+    out = bytearray(256)
+    for v in range(256):
+        f = (v >> shift) & ((1 << bits) - 1)
+        wide = 0
+        for at in range(8 - bits, -bits, -bits):
+            wide |= f << at if at >= 0 else f >> -at
+        out[v] = wide & 255
+    return bytes(out)
+
+
+_R332, _G332, _B332 = _expand_table(3, 5), _expand_table(3, 2), _expand_table(2, 0)
+_R565, _B565, _G6 = _expand_table(5, 3), _expand_table(5, 0), _expand_table(6, 0)
+_G565_HI = bytes((v & 7) << 3 for v in range(256))     # green bits of the high byte
+_G565_LO = bytes(v >> 5 for v in range(256))            # and of the low byte
+
+
+def expand_pixels(encoding, packed, out):
+    """Widens n packed pixels (n * pixel_size bytes, no run-length coding) to
+    RGB888 in out, a writable buffer of 3n bytes. Works a channel at a time
+    with bytes.translate and strided slices, so no Python code runs per
+    pixel."""
+    fmt = encoding & 3
+    out = memoryview(out)
+    if fmt == RGB888:
+        out[:] = packed
+    elif fmt == RGB332:
+        out[0::3] = packed.translate(_R332)
+        out[1::3] = packed.translate(_G332)
+        out[2::3] = packed.translate(_B332)
+    else:
+        hi, lo = packed[0::2], packed[1::2]
+        n = len(hi)
+        out[0::3] = hi.translate(_R565)
+        out[2::3] = lo.translate(_B565)
+        # The two halves of green never overlap, so one big-integer OR
+        # combines them for the whole block
+        g = int.from_bytes(hi.translate(_G565_HI), "big") | int.from_bytes(lo.translate(_G565_LO), "big")
+        out[1::3] = g.to_bytes(n, "big").translate(_G6)
+
+
+class FrameDecoder:
+    """Incremental decoder. feed() is a generator of the packets completed
+    so far, as FrameStart, Block and FrameEnd tuples in stream order; iterate
+    it to consume the data.
+
+    place(frame, x, y, w, h), if given, is asked for the buffer a block that
+    passed its CRC check should be decoded into, and may return a writable
+    view of w*h*3 bytes (FrameAssembler.place gives one into its frame) or
+    None. Without one, a Block's rgb is a view of the decoder's scratch
+    buffer, only valid until the next packet is taken."""
+
+    def __init__(self, place=None):
+        self.place = place
+        self.buf = bytearray()
+        self.scratch = bytearray(3 * 256)
+        self.width = self.height = None     # from the last frame start
+        self.packets = 0
+        self.rejected = 0                   # sync words that did not start a good packet
+        self.skipped = 0                    # bytes dropped looking for a sync word
+
+    def feed(self, data):
+        buf = self.buf
+        buf += data
+        pos = 0
+        try:
+            while True:
+                i = buf.find(SYNC, pos)
+                if i < 0:
+                    # Keep a trailing first sync byte, its partner may be next
+                    keep = 1 if buf.endswith(SYNC[:1]) else 0
+                    self.skipped += len(buf) - keep - pos
+                    pos = len(buf) - keep
+                    return
+                self.skipped += i - pos
+                pos = i
+                result = self._parse(pos)
+                if result is _NEED_MORE:
+                    return
+                if result is _BAD:
+                    self.rejected += 1
+                    self.skipped += 1
+                    pos += 1
+                    continue
+                pos, event = result
+                self.packets += 1
+                if isinstance(event, FrameStart):
+                    self.width, self.height = event.width, event.height
+                yield event
+        finally:
+            # One move for the whole feed, not one a packet
+            del buf[:pos]
+
+    def _parse(self, pos):
+        buf = self.buf
+        if len(buf) < pos + 3:
+            return _NEED_MORE
+        ptype = buf[pos + 2]
+        if ptype == PKT_FRAME_START:
+            end = pos + 3 + 6
+        elif ptype == PKT_FRAME_END:
+            end = pos + 3 + 3
+        elif ptype == PKT_BLOCK:
+            return self._parse_block(pos)
+        else:
+            return _BAD
+        if len(buf) < end + 2:
+            return _NEED_MORE
+        if crc16(buf[pos + 2:end]) != int.from_bytes(buf[end:end + 2], "big"):
+            return _BAD
+
+        f = buf[pos + 3:end]
+        if ptype == PKT_FRAME_START:
+            width, height = int.from_bytes(f[1:3], "big"), int.from_bytes(f[3:5], "big")
+            if not (0 < width <= MAX_SIZE and 0 < height <= MAX_SIZE and valid_encoding(f[5])):
+                return _BAD
+            return end + 2, FrameStart(f[0], width, height, f[5])
+        return end + 2, FrameEnd(f[0], int.from_bytes(f[1:3], "big"))
+
+    def _parse_block(self, pos):
+        buf = self.buf
+        data = pos + 13
+        if len(buf) < data:
+            return _NEED_MORE
+        frame, encoding = buf[pos + 3], buf[pos + 4]
+        x, y, w, h = struct.unpack_from(">HHHH", buf, pos + 5)
+        width = self.width or MAX_SIZE
+        height = self.height or MAX_SIZE
+        if not valid_encoding(encoding) or w == 0 or h != 1 or x + w > width or y >= height:
+            return _BAD
+
+        size, n = pixel_size(encoding), w * h
+        if encoding & RLE:
+            packed = self._unpack_runs(data, n, size)
+            if packed is _NEED_MORE or packed is _BAD:
+                return packed
+            end = data + packed[1]
+            packed = packed[0]
+        else:
+            end = data + n * size
+        if len(buf) < end + 2:
+            return _NEED_MORE
+        if crc16(buf[pos + 2:end]) != int.from_bytes(buf[end:end + 2], "big"):
+            return _BAD
+        if not encoding & RLE:
+            packed = buf[data:end]
+
+        rgb = self.place(frame, x, y, w, h) if self.place else None
+        if rgb is None:
+            if len(self.scratch) < 3 * n:
+                # A new buffer rather than a resize: an old block may still be viewed
+                self.scratch = bytearray(3 * n)
+            rgb = memoryview(self.scratch)[:3 * n]
+            expand_pixels(encoding, packed, rgb)
+            rgb = rgb.toreadonly()
+        else:
+            expand_pixels(encoding, packed, rgb)
+        return end + 2, Block(frame, encoding, x, y, w, h, rgb)
+
+    def _unpack_runs(self, at, n, size):
+        """Undoes the run-length coding of n pixels starting at offset at.
+        Returns (packed pixels, bytes used), _NEED_MORE or _BAD."""
+        buf, end = self.buf, len(self.buf)
+        out = bytearray()
+        i, k = at, 0
+        last = None
+        while k < n:
+            if i + size > end:
+                return _NEED_MORE
+            v = buf[i:i + size]
+            i += size
+            out += v
+            k += 1
+            if v == last:
+                if i >= end:
+                    return _NEED_MORE
+                count = buf[i]
+                i += 1
+                k += count
+                if k > n:
+                    return _BAD
+                out += v * count
+                last = None
+            else:
+                last = v
+        return bytes(out), i - at
+
+
+Frame = namedtuple("Frame", "frame width height rgb received complete")
+
+
+class FrameAssembler:
+    """Collects blocks into frames. add() returns a Frame when one is done:
+    at its frame end packet, or when a packet of another frame shows its end
+    was lost. received counts the pixels that arrived.
+
+    new_frame(frame, width, height) gives the buffer a frame is assembled
+    in, width * height * 3 bytes of RGB888 in scanline order; it may be a
+    memory map of the file the frame goes to, so rows land there as they
+    arrive. By default it is a new zeroed bytearray, and pixels that never
+    arrive stay black. A frame whose start was lost takes the size of the
+    last one seen.
+
+    Pass place to FrameDecoder and blocks of whole rows are decoded straight
+    into the frame, with no copy here."""
+
+    def __init__(self, new_frame=None, width=256, height=256):
+        self.new_frame = new_frame or (lambda frame, width, height: bytearray(3 * width * height))
+        self.width, self.height = width, height
+        self.current = None
+        self.placed = None      # the view place() last handed out
+
+    def place(self, frame, x, y, w, h):
+        """Where in the frame being assembled a block of whole rows goes, or
+        None if it is not one or belongs to another frame."""
+        c = self.current
+        if c is None or c["frame"] != frame or x != 0 or w != c["width"] or y + h > c["height"]:
+            return None
+        width = c["width"]
+        self.placed = memoryview(c["rgb"])[3 * y * width:3 * (y + h) * width]
+        return self.placed
+
+    def add(self, event):
+        done = None
+        if isinstance(event, FrameStart):
+            done = self.finish(False)
+            self._open(event.frame, event.width, event.height)
+        elif isinstance(event, Block):
+            if self.current is not None and self.current["frame"] != event.frame:
+                done = self.finish(False)
+            if self.current is None:
+                self._open(event.frame, self.width, self.height)
+            c = self.current
+            if event.x + event.w <= c["width"] and event.y + event.h <= c["height"]:
+                rgb, width = c["rgb"], c["width"]
+                if event.rgb is self.placed:
+                    pass                # already decoded in place
+                elif event.w == width:
+                    # Whole rows are contiguous in the frame
+                    at = 3 * event.y * width
+                    rgb[at:at + len(event.rgb)] = event.rgb
+                else:
+                    row = 3 * event.w
+                    for r in range(event.h):
+                        at = 3 * ((event.y + r) * width + event.x)
+                        rgb[at:at + row] = event.rgb[r * row:(r + 1) * row]
+                c["received"] += event.w * event.h
+                c["blocks"] += 1
+        elif isinstance(event, FrameEnd):
+            if self.current is not None and self.current["frame"] == event.frame:
+                done = self.finish(self.current["blocks"] == event.blocks)
+        return done
+
+    def _open(self, frame, width, height):
+        self.width, self.height = width, height
+        self.current = {"frame": frame, "width": width, "height": height,
+                        "rgb": self.new_frame(frame, width, height), "received": 0, "blocks": 0}
+
+    def finish(self, complete):
+        """Returns the frame being assembled, if any, and starts afresh."""
+        c, self.current = self.current, None
+        self.placed = None
+        if c is None:
+            return None
+        return Frame(c["frame"], c["width"], c["height"], c["rgb"], c["received"], complete)
+
+
+def write_ppm(path, frame):
+    with open(path, "wb") as f:
+        f.write(b"P6\n%d %d\n255\n" % (frame.width, frame.height))
+        f.write(frame.rgb)
+
+
+def read_stream(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    return bytes.fromhex(data.decode()) if path.endswith(".hex") else data
+
+
+def read_vectors(path):
+    """Colours from stream_model -v, as (r, g, b) in scanline order."""
+    rgb = []
+    with open(path) as f:
+        for line in f:
+            if line.strip():
+                c = int(line.strip()[6:], 16)
+                rgb.append((c & 255, (c >> 8) & 255, c >> 16))
+    return rgb
+
+
+def decode_frames(data):
+    assembler, frames = FrameAssembler(), []
+    decoder = FrameDecoder(assembler.place)
+    for event in decoder.feed(data):
+        frame = assembler.add(event)
+        if frame:
+            frames.append(frame)
+    frame = assembler.finish(False)
+    if frame:
+        frames.append(frame)
+    return decoder, frames
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Framed UART pixel protocol tools")
+    sub = parser.add_subparsers(dest="cmd", required=True)
+    p = sub.add_parser("decode", help="decode a captured stream")
+    p.add_argument("stream")
+    p.add_argument("-o", "--output", default="frame.ppm", help="frame file, numbered if there are several")
+    p = sub.add_parser("encode", help="the stream frame_transmitter sends for a frame")
+    p.add_argument("vectors")
+    p.add_argument("-e", "--encoding", type=lambda s: int(s, 0), default=RGB888)
+    p.add_argument("-w", "--width", type=int, default=256, help="frame width; the height is what the vectors fill")
+    p.add_argument("-o", "--output", required=True)
+    p = sub.add_parser("check", help="check a simulated stream against the vectors")
+    p.add_argument("vectors")
+    p.add_argument("stream")
+    p.add_argument("-e", "--encoding", type=lambda s: int(s, 0), default=RGB888)
+    p.add_argument("-w", "--width", type=int, default=256, help="frame width; the height is what the vectors fill")
+    args = parser.parse_args()
+
+    if args.cmd in ("encode", "check"):
+        rgb = read_vectors(args.vectors)
+        if args.width <= 0 or not rgb or len(rgb) % args.width:
+            parser.error(f"{len(rgb)} vectors do not make whole rows of {args.width} pixels")
+        height = len(rgb) // args.width
+
+    if args.cmd == "encode":
+        data = encode_frame(rgb, args.width, height, args.encoding)
+        with open(args.output, "wb") as f:
+            f.write(data)
+        print(f"{args.output}: {len(data)} bytes, {len(data) / (3 * len(rgb)):.2f} of raw RGB888")
+        return 0
+
+    data = read_stream(args.stream)
+    decoder, frames = decode_frames(data)
+    print(f"{len(data)} bytes: {decoder.packets} packets, {decoder.rejected} rejected, "
+          f"{decoder.skipped} bytes skipped, {len(frames)} frames")
+
+    if args.cmd == "decode":
+        for i, frame in enumerate(frames):
+            path = args.output if len(frames) == 1 else args.output.replace(".ppm", f"-{i}.ppm")
+            write_ppm(path, frame)
+            state = "complete" if frame.complete else f"incomplete, {frame.received} pixels"
+            print(f"frame {frame.frame}: {frame.width}x{frame.height}, {state} -> {path}")
+        return 0
+
+    ok = True
+    # The hardware's frame counter is not known here, take the stream's own
+    expected = encode_frame(rgb, args.width, height, args.encoding, frames[0].frame if frames else 1)
+    if data != expected:
+        at = next((i for i, (a, b) in enumerate(zip(data, expected)) if a != b), min(len(data), len(expected)))
+        print(f"stream differs from the reference encoding at byte {at} ({len(data)} vs {len(expected)} bytes)")
+        ok = False
+    if len(frames) != 1 or not frames[0].complete:
+        print("expected one complete frame")
+        ok = False
+    else:
+        want = b"".join(decode_pixel(encode_pixel(*p, args.encoding), args.encoding) for p in rgb)
+        wrong = sum(frames[0].rgb[3 * i:3 * i + 3] != want[3 * i:3 * i + 3] for i in range(len(rgb)))
+        print(f"{wrong} wrong pixels")
+        ok = ok and wrong == 0
+    print("PASS" if ok else "FAIL")
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())